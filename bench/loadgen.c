@@ -0,0 +1,381 @@
+// Load generator for the EMS server.
+// Opens N concurrent sessions and replays a mix of CREATE/RESERVE/SHOW/LIST requests, with the
+// events being hit following a Zipf distribution, then reports throughput and latency per opcode.
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client/api.h"
+#include "common/constants.h"
+#include "common/histogram.h"
+
+enum BenchOp { OP_CREATE, OP_RESERVE, OP_SHOW, OP_LIST, NUM_OPS };
+
+static const char* op_names[NUM_OPS] = {"CREATE", "RESERVE", "SHOW", "LIST"};
+
+typedef struct {
+  const char* server_pipe;
+  unsigned int sessions;
+  double duration;  // Seconds each session runs for
+  unsigned int num_events;
+  size_t rows;
+  size_t cols;
+  size_t max_seats;  // Seats per RESERVE are drawn from [1, max_seats]
+  double zipf_s;     // Zipf exponent, 0 for uniform
+  unsigned int mix[NUM_OPS];
+  double* zipf_cdf;  // Cumulative probability of hitting event i
+  atomic_uint next_event_id;
+  int null_fd;
+} Config;
+
+typedef struct {
+  Config* config;
+  unsigned int index;
+  uint64_t seed;
+  int failed;
+  uint64_t errors[NUM_OPS];
+  Histogram latency[NUM_OPS];
+} Worker;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/// xorshift64* generator, one state per worker.
+static uint64_t next_random(uint64_t* state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ull;
+}
+
+static double next_uniform(uint64_t* state) { return (double)(next_random(state) >> 11) / (double)(1ull << 53); }
+
+/// Picks an event index in [0, num_events) following the precomputed Zipf distribution.
+static unsigned int next_event(Config* config, uint64_t* state) {
+  double u = next_uniform(state);
+  unsigned int lo = 0, hi = config->num_events - 1;
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (config->zipf_cdf[mid] < u) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static int build_zipf(Config* config) {
+  config->zipf_cdf = malloc(sizeof(double) * config->num_events);
+  if (!config->zipf_cdf) return 1;
+
+  double total = 0;
+  for (unsigned int i = 0; i < config->num_events; i++) {
+    total += 1.0 / pow((double)(i + 1), config->zipf_s);
+    config->zipf_cdf[i] = total;
+  }
+  for (unsigned int i = 0; i < config->num_events; i++) {
+    config->zipf_cdf[i] /= total;
+  }
+  return 0;
+}
+
+static enum BenchOp next_op(Config* config, uint64_t* state) {
+  unsigned int total = 0;
+  for (int i = 0; i < NUM_OPS; i++) total += config->mix[i];
+  unsigned int pick = (unsigned int)(next_random(state) % total);
+  for (int i = 0; i < NUM_OPS; i++) {
+    if (pick < config->mix[i]) return (enum BenchOp)i;
+    pick -= config->mix[i];
+  }
+  return OP_SHOW;
+}
+
+static int session_pipes(unsigned int index, char* req, char* resp) {
+  int req_len = snprintf(req, MAX_BUFFER_SIZE, "/tmp/emsb%d.%u.q", getpid(), index);
+  int resp_len = snprintf(resp, MAX_BUFFER_SIZE, "/tmp/emsb%d.%u.r", getpid(), index);
+  return req_len < 0 || resp_len < 0 || req_len >= MAX_BUFFER_SIZE || resp_len >= MAX_BUFFER_SIZE;
+}
+
+static void* worker_thread(void* arg) {
+  Worker* worker = arg;
+  Config* config = worker->config;
+  char req[MAX_BUFFER_SIZE], resp[MAX_BUFFER_SIZE];
+  size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+
+  if (session_pipes(worker->index + 1, req, resp) || ems_setup(req, resp, config->server_pipe)) {
+    fprintf(stderr, "Session %u failed to connect\n", worker->index);
+    worker->failed = 1;
+    return NULL;
+  }
+
+  uint64_t deadline = now_ns() + (uint64_t)(config->duration * 1e9);
+  uint64_t* state = &worker->seed;
+  while (now_ns() < deadline) {
+    enum BenchOp op = next_op(config, state);
+    unsigned int event_id = next_event(config, state) + 1;
+    int ret = 0;
+    uint64_t start = now_ns();
+    switch (op) {
+      case OP_CREATE:
+        ret = ems_create(atomic_fetch_add(&config->next_event_id, 1), config->rows, config->cols);
+        break;
+      case OP_RESERVE: {
+        size_t num_seats = 1 + (size_t)(next_random(state) % config->max_seats);
+        for (size_t i = 0; i < num_seats; i++) {
+          xs[i] = 1 + (size_t)(next_random(state) % config->rows);
+          ys[i] = 1 + (size_t)(next_random(state) % config->cols);
+        }
+        ret = ems_reserve(event_id, num_seats, xs, ys);
+        break;
+      }
+      case OP_SHOW:
+        ret = ems_show(config->null_fd, event_id);
+        break;
+      case OP_LIST:
+        ret = ems_list_events(config->null_fd);
+        break;
+      case NUM_OPS:
+        break;
+    }
+    histogram_record(&worker->latency[op], now_ns() - start);
+    if (ret != 0) worker->errors[op]++;
+  }
+
+  ems_quit();
+  return NULL;
+}
+
+/// Starts the server with the state access delay set to 0 and waits for its pipe to appear.
+static pid_t spawn_server(const char* binary, const char* pipe_path) {
+  unlink(pipe_path);
+  pid_t pid = fork();
+  if (pid == -1) return -1;
+  if (pid == 0) {
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd != -1) {
+      dup2(fd, STDOUT_FILENO);
+      dup2(fd, STDERR_FILENO);
+    }
+    execl(binary, binary, pipe_path, "0", (char*)NULL);
+    _exit(127);
+  }
+
+  struct stat st;
+  for (int i = 0; i < 200; i++) {
+    if (stat(pipe_path, &st) == 0) return pid;
+    struct timespec delay = {0, 10000000};
+    nanosleep(&delay, NULL);
+  }
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+  return -1;
+}
+
+static int parse_mix(const char* text, unsigned int* mix) {
+  unsigned int values[NUM_OPS];
+  if (sscanf(text, "%u,%u,%u,%u", &values[0], &values[1], &values[2], &values[3]) != NUM_OPS) return 1;
+  unsigned int total = 0;
+  for (int i = 0; i < NUM_OPS; i++) {
+    mix[i] = values[i];
+    total += values[i];
+  }
+  return total == 0;
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -S <binary>   server to start with a state access delay of 0 (default: server/ems)\n"
+          "  -p <pipe>     connect to an already running server instead; it must have been started with delay 0\n"
+          "  -n <sessions> concurrent sessions (default: 4)\n"
+          "  -t <seconds>  duration of the run (default: 5)\n"
+          "  -e <events>   events created before the run (default: 100)\n"
+          "  -r <rows>     rows per event (default: 20)\n"
+          "  -c <cols>     columns per event (default: 20)\n"
+          "  -k <seats>    maximum seats per RESERVE (default: 4)\n"
+          "  -z <s>        Zipf exponent of event popularity, 0 for uniform (default: 0.99)\n"
+          "  -m <c,r,s,l>  relative weights of CREATE,RESERVE,SHOW,LIST (default: 1,30,64,5)\n"
+          "  -P <version>  newest wire format to negotiate, 1 for fixed-width fields (default: newest)\n"
+          "  -o <path>     also write the results as CSV to this path\n",
+          program);
+}
+
+int main(int argc, char* argv[]) {
+  Config config = {NULL, 4, 5.0, 100, 20, 20, 4, 0.99, {1, 30, 64, 5}, NULL, 0, -1};
+  const char* server_binary = "server/ems";
+  const char* csv_path = NULL;
+  char own_pipe[MAX_BUFFER_SIZE];
+
+  int opt;
+  while ((opt = getopt(argc, argv, "S:p:n:t:e:r:c:k:z:m:o:P:")) != -1) {
+    switch (opt) {
+      case 'S':
+        server_binary = optarg;
+        break;
+      case 'p':
+        config.server_pipe = optarg;
+        break;
+      case 'n':
+        config.sessions = (unsigned int)strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        config.duration = strtod(optarg, NULL);
+        break;
+      case 'e':
+        config.num_events = (unsigned int)strtoul(optarg, NULL, 10);
+        break;
+      case 'r':
+        config.rows = strtoul(optarg, NULL, 10);
+        break;
+      case 'c':
+        config.cols = strtoul(optarg, NULL, 10);
+        break;
+      case 'k':
+        config.max_seats = strtoul(optarg, NULL, 10);
+        break;
+      case 'z':
+        config.zipf_s = strtod(optarg, NULL);
+        break;
+      case 'm':
+        if (parse_mix(optarg, config.mix)) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'o':
+        csv_path = optarg;
+        break;
+      case 'P':
+        ems_set_max_protocol((unsigned int)strtoul(optarg, NULL, 10));
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (config.sessions == 0 || config.num_events == 0 || config.rows == 0 || config.cols == 0 ||
+      config.max_seats == 0 || config.max_seats >= MAX_RESERVATION_SIZE || config.duration <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  pid_t server = -1;
+  if (config.server_pipe == NULL) {
+    snprintf(own_pipe, sizeof(own_pipe), "/tmp/emsb%d.srv", getpid());
+    server = spawn_server(server_binary, own_pipe);
+    if (server == -1) {
+      fprintf(stderr, "Failed to start %s\n", server_binary);
+      return 1;
+    }
+    config.server_pipe = own_pipe;
+  }
+
+  config.null_fd = open("/dev/null", O_WRONLY);
+  atomic_init(&config.next_event_id, config.num_events + 1);
+  if (config.null_fd == -1 || build_zipf(&config)) {
+    fprintf(stderr, "Failed to prepare the run\n");
+    return 1;
+  }
+
+  // Populate the events every session draws from
+  char req[MAX_BUFFER_SIZE], resp[MAX_BUFFER_SIZE];
+  if (session_pipes(0, req, resp) || ems_setup(req, resp, config.server_pipe)) {
+    fprintf(stderr, "Failed to connect to %s\n", config.server_pipe);
+    return 1;
+  }
+  for (unsigned int i = 1; i <= config.num_events; i++) {
+    if (ems_create(i, config.rows, config.cols)) {
+      fprintf(stderr, "Failed to create event %u\n", i);
+    }
+  }
+  ems_quit();
+
+  Worker* workers = calloc(config.sessions, sizeof(Worker));
+  pthread_t* threads = malloc(sizeof(pthread_t) * config.sessions);
+  if (!workers || !threads) {
+    fprintf(stderr, "Failed to allocate workers\n");
+    return 1;
+  }
+
+  uint64_t start = now_ns();
+  for (unsigned int i = 0; i < config.sessions; i++) {
+    workers[i].config = &config;
+    workers[i].index = i;
+    workers[i].seed = 0x9E3779B97F4A7C15ull * (i + 1);
+    for (int op = 0; op < NUM_OPS; op++) histogram_init(&workers[i].latency[op]);
+    if (pthread_create(&threads[i], NULL, worker_thread, &workers[i]) != 0) {
+      fprintf(stderr, "Failed to start session %u\n", i);
+      return 1;
+    }
+  }
+  for (unsigned int i = 0; i < config.sessions; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double elapsed = (double)(now_ns() - start) / 1e9;
+
+  Histogram totals[NUM_OPS];
+  uint64_t errors[NUM_OPS] = {0};
+  for (int op = 0; op < NUM_OPS; op++) {
+    histogram_init(&totals[op]);
+    for (unsigned int i = 0; i < config.sessions; i++) {
+      histogram_merge(&totals[op], &workers[i].latency[op]);
+      errors[op] += workers[i].errors[op];
+    }
+  }
+
+  FILE* csv = csv_path ? fopen(csv_path, "w") : NULL;
+  if (csv_path && !csv) fprintf(stderr, "Failed to open %s\n", csv_path);
+  if (csv) fprintf(csv, "opcode,ops,errors,ops_per_sec,p50_us,p99_us,p999_us,max_us\n");
+
+  printf("%u sessions, %u events of %zux%zu, zipf %.2f, %.2f s\n", config.sessions, config.num_events, config.rows,
+         config.cols, config.zipf_s, elapsed);
+  printf("%-8s %10s %8s %12s %10s %10s %10s %10s\n", "opcode", "ops", "errors", "ops/s", "p50 us", "p99 us",
+         "p999 us", "max us");
+  uint64_t total_ops = 0;
+  for (int op = 0; op < NUM_OPS; op++) {
+    Histogram* h = &totals[op];
+    double rate = (double)h->count / elapsed;
+    double p50 = (double)histogram_percentile(h, 50) / 1e3;
+    double p99 = (double)histogram_percentile(h, 99) / 1e3;
+    double p999 = (double)histogram_percentile(h, 99.9) / 1e3;
+    double max = (double)h->max / 1e3;
+    total_ops += h->count;
+    printf("%-8s %10llu %8llu %12.1f %10.1f %10.1f %10.1f %10.1f\n", op_names[op], (unsigned long long)h->count,
+           (unsigned long long)errors[op], rate, p50, p99, p999, max);
+    if (csv) {
+      fprintf(csv, "%s,%llu,%llu,%.1f,%.1f,%.1f,%.1f,%.1f\n", op_names[op], (unsigned long long)h->count,
+              (unsigned long long)errors[op], rate, p50, p99, p999, max);
+    }
+  }
+  printf("total    %10llu %8s %12.1f\n", (unsigned long long)total_ops, "", (double)total_ops / elapsed);
+  if (csv) fclose(csv);
+
+  int failed = 0;
+  for (unsigned int i = 0; i < config.sessions; i++) failed |= workers[i].failed;
+
+  if (server != -1) {
+    kill(server, SIGINT);
+    waitpid(server, NULL, 0);
+    unlink(own_pipe);
+  }
+  free(workers);
+  free(threads);
+  free(config.zipf_cdf);
+  close(config.null_fd);
+  return failed;
+}
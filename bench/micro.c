@@ -0,0 +1,624 @@
+// In-process microbenchmarks for the event store and the ems_* operations.
+// Links server/operations.o and server/eventlist.o directly, so no pipes or sessions are involved.
+// Every case runs pinned threads for a warmup repetition followed by timed repetitions, and reports
+// the median repetition so results can be compared across releases. With -c, hardware counters are
+// read through perf_event_open(2) to show where the time goes, such as cache misses per operation.
+
+#define _GNU_SOURCE  // pthread_setaffinity_np
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/constants.h"
+#include "common/io.h"
+#include "server/eventlist.h"
+#include "server/operations.h"
+
+typedef struct MicroCase MicroCase;
+
+#define NUM_COUNTERS 3
+
+static const char* counter_names[NUM_COUNTERS] = {"l1d_miss", "llc_miss", "insns"};
+static const uint64_t counter_configs[NUM_COUNTERS][2] = {
+    {PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+};
+
+typedef struct {
+  MicroCase* micro;
+  unsigned int index;
+  int cpu;  // CPU the thread is pinned to, -1 to leave it unpinned
+  uint64_t seed;
+  uint64_t budget_ns;    // Time to run for in the current repetition
+  uint64_t ops;          // Operations completed in the current repetition
+  uint64_t ns;           // Time spent in the operations, excluding resets
+  unsigned int* buffer;  // Scratch space for copies, allocated by the cases that need it
+  size_t next_seat;      // Next free seat of the thread's event
+  int64_t counts[NUM_COUNTERS];  // Hardware events in the current repetition, -1 if not counted
+} MicroThread;
+
+struct MicroCase {
+  const char* name;
+  size_t size;   // Number of events or seats per side, depending on the case
+  size_t seats;  // Seats per request, when relevant
+  unsigned int threads;
+  int count_events;  // Read hardware counters around every repetition
+  struct EventList* list;
+  int (*prepare)(MicroCase* micro);
+  void (*run)(MicroThread* thread);
+  void (*cleanup)(MicroCase* micro);
+  pthread_barrier_t start;
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t* state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ull;
+}
+
+/// Base id of the events owned by each thread, so threads never touch each other's seats.
+#define THREAD_EVENT_BASE 1000000u
+
+// get_event over a list of `size` events, looking up uniformly random ids
+
+static int prepare_get_event(MicroCase* micro) {
+  micro->list = create_list();
+  if (!micro->list) return 1;
+  for (size_t i = 0; i < micro->size; i++) {
+    struct Event* event = alloc_event(micro->list);
+    if (!event) return 1;
+    event->id = (unsigned int)i;
+    if (append_to_list(micro->list, event)) return 1;
+  }
+  return 0;
+}
+
+static void run_get_event(MicroThread* thread) {
+  struct EventList* list = thread->micro->list;
+  uint64_t start = now_ns(), now = start;
+  volatile unsigned int sink = 0;
+  while (now - start < thread->budget_ns) {
+    for (int i = 0; i < 16; i++) {
+      unsigned int id = (unsigned int)(next_random(&thread->seed) % thread->micro->size);
+      struct Event* event = get_event(list, id);
+      sink += event ? event->id : 0;
+    }
+    thread->ops += 16;
+    now = now_ns();
+  }
+  thread->ns = now - start;
+  (void)sink;
+}
+
+static void cleanup_get_event(MicroCase* micro) {
+  free_list(micro->list);
+  micro->list = NULL;
+}
+
+// ems_reserve of `seats` seats on a `size` x `size` venue, one event per thread
+
+static int prepare_venues(MicroCase* micro) {
+  if (ems_init(0)) return 1;
+  for (unsigned int t = 0; t < micro->threads; t++) {
+    if (ems_create(THREAD_EVENT_BASE + t, micro->size, micro->size)) return 1;
+  }
+  return 0;
+}
+
+static void cleanup_venues(MicroCase* micro) {
+  (void)micro;
+  ems_terminate();
+}
+
+static void run_reserve(MicroThread* thread) {
+  MicroCase* micro = thread->micro;
+  unsigned int event_id = THREAD_EVENT_BASE + thread->index;
+  size_t capacity = micro->size * micro->size;
+  size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+  uint64_t spent = 0;
+
+  while (spent < thread->budget_ns) {
+    // When the venue is full, free it again outside of the timed section
+    if (thread->next_seat + micro->seats > capacity) {
+      ems_clear_event(event_id);
+      thread->next_seat = 0;
+    }
+    for (size_t i = 0; i < micro->seats; i++) {
+      xs[i] = (thread->next_seat + i) / micro->size + 1;
+      ys[i] = (thread->next_seat + i) % micro->size + 1;
+    }
+    thread->next_seat += micro->seats;
+
+    uint64_t start = now_ns();
+    ems_reserve(event_id, micro->seats, xs, ys);
+    spent += now_ns() - start;
+    thread->ops++;
+  }
+  thread->ns = spent;
+}
+
+// ems_reserve of `seats` seats by every thread on the same `size` x `size` venue, the case flat
+// combining is meant for. Each thread takes its own stripe of seats and clears the venue when its
+// stripe runs out, so a few reservations fail around each wrap
+
+static int prepare_hot_venue(MicroCase* micro) {
+  if (ems_init(0)) return 1;
+  return ems_create(THREAD_EVENT_BASE, micro->size, micro->size);
+}
+
+static void run_reserve_hot(MicroThread* thread) {
+  MicroCase* micro = thread->micro;
+  size_t stripe = micro->size * micro->size / micro->threads;
+  size_t first = stripe * thread->index;
+  size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+  uint64_t spent = 0;
+
+  while (spent < thread->budget_ns) {
+    if (thread->next_seat + micro->seats > stripe) {
+      ems_clear_event(THREAD_EVENT_BASE);
+      thread->next_seat = 0;
+    }
+    for (size_t i = 0; i < micro->seats; i++) {
+      xs[i] = (first + thread->next_seat + i) / micro->size + 1;
+      ys[i] = (first + thread->next_seat + i) % micro->size + 1;
+    }
+    thread->next_seat += micro->seats;
+
+    uint64_t start = now_ns();
+    ems_reserve(THREAD_EVENT_BASE, micro->seats, xs, ys);
+    spent += now_ns() - start;
+    thread->ops++;
+  }
+  thread->ns = spent;
+}
+
+// ems_show followed by the copy of the seats the server does when answering
+
+static void run_show(MicroThread* thread) {
+  MicroCase* micro = thread->micro;
+  unsigned int event_id = THREAD_EVENT_BASE + thread->index;
+  if (!thread->buffer) {
+    thread->buffer = malloc(sizeof(unsigned int) * micro->size * micro->size);
+    if (!thread->buffer) return;
+  }
+
+  uint64_t start = now_ns(), now = start;
+  while (now - start < thread->budget_ns) {
+    size_t rows, cols;
+    unsigned int* data;
+    if (ems_show(event_id, &rows, &cols, &data) == 0) {
+      memcpy(thread->buffer, data, sizeof(unsigned int) * rows * cols);
+    }
+    thread->ops++;
+    now = now_ns();
+  }
+  thread->ns = now - start;
+}
+
+// SHOW answered through pipes like a session: a client thread asks for the seats and reads all of
+// them before asking again. The server side writes them like by default (show_pipe) or splices a
+// snapshot of them like with -Z (show_splice)
+
+typedef struct {
+  int requests;   // Reading end of the request pipe, one byte per SHOW
+  int responses;  // Writing end of the response pipe
+  size_t len;     // Bytes in every response
+} ShowClient;
+
+static void* show_client(void* arg) {
+  ShowClient* client = arg;
+  char* seats = malloc(client->len);
+  char request = 5;
+  // The server stops answering once its budget is spent, closing the response pipe
+  while (seats && write_all(client->requests, &request, 1) == 0 &&
+         read_all(client->responses, seats, client->len) == 0) {
+  }
+  free(seats);
+  return NULL;
+}
+
+static void run_show_through_pipe(MicroThread* thread, int zero_copy) {
+  MicroCase* micro = thread->micro;
+  unsigned int event_id = THREAD_EVENT_BASE + thread->index;
+  int requests[2], responses[2];
+  if (pipe(requests) != 0) return;
+  if (pipe(responses) != 0) {
+    close(requests[0]);
+    close(requests[1]);
+    return;
+  }
+  ShowClient client = {requests[1], responses[0], sizeof(unsigned int) * micro->size * micro->size};
+  pthread_t reader;
+  int started = pthread_create(&reader, NULL, show_client, &client) == 0;
+  SeatSnapshot snapshot;
+  snapshot_init(&snapshot);
+
+  uint64_t start = now_ns(), now = start;
+  char request;
+  while (started && now - start < thread->budget_ns && read_all(requests[0], &request, 1) == 0) {
+    size_t rows, cols;
+    unsigned int* data;
+    if (zero_copy) {
+      if (ems_show_snapshot(event_id, &rows, &cols, &snapshot) == 0) {
+        snapshot_send(&snapshot, responses[1], rows * cols);
+      }
+    } else if (ems_show(event_id, &rows, &cols, &data) == 0) {
+      write_all(responses[1], data, sizeof(unsigned int) * rows * cols);
+    }
+    thread->ops++;
+    now = now_ns();
+  }
+  thread->ns = now - start;
+
+  snapshot_release(&snapshot);
+  close(responses[1]);
+  if (started) pthread_join(reader, NULL);
+  close(responses[0]);
+  close(requests[0]);
+  close(requests[1]);
+}
+
+static void run_show_pipe(MicroThread* thread) { run_show_through_pipe(thread, 0); }
+
+static void run_show_splice(MicroThread* thread) { run_show_through_pipe(thread, 1); }
+
+// ems_list_events with `size` events
+
+static int prepare_list(MicroCase* micro) {
+  if (ems_init(0)) return 1;
+  for (size_t i = 0; i < micro->size; i++) {
+    if (ems_create((unsigned int)i + 1, 1, 1)) return 1;
+  }
+  return 0;
+}
+
+static void run_list(MicroThread* thread) {
+  uint64_t start = now_ns(), now = start;
+  while (now - start < thread->budget_ns) {
+    size_t num_events;
+    unsigned int* ids = NULL;
+    size_t* occupancy = NULL;
+    if (ems_list_events(&num_events, &ids, &occupancy) == 0 && num_events > 0) {
+      free(ids);
+      free(occupancy);
+    }
+    thread->ops++;
+    now = now_ns();
+  }
+  thread->ns = now - start;
+}
+
+/// Opens a disabled counter of user space events of the calling thread.
+/// @return The counter's file descriptor, -1 if the CPU or the kernel doesn't offer it.
+static int open_counter(size_t counter) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = (uint32_t)counter_configs[counter][0];
+  attr.config = counter_configs[counter][1];
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void* micro_thread(void* arg) {
+  MicroThread* thread = arg;
+  if (thread->cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET((size_t)thread->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+  thread->ops = 0;
+  thread->ns = 0;
+  int fds[NUM_COUNTERS];
+  for (size_t i = 0; i < NUM_COUNTERS; i++) {
+    fds[i] = thread->micro->count_events ? open_counter(i) : -1;
+    thread->counts[i] = -1;
+  }
+
+  pthread_barrier_wait(&thread->micro->start);
+  // Counted over the whole repetition, including the resets some cases leave out of the timing
+  for (size_t i = 0; i < NUM_COUNTERS; i++) {
+    if (fds[i] != -1) ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+  thread->micro->run(thread);
+  for (size_t i = 0; i < NUM_COUNTERS; i++) {
+    if (fds[i] == -1) continue;
+    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t count;
+    if (read(fds[i], &count, sizeof(count)) == sizeof(count)) thread->counts[i] = (int64_t)count;
+    close(fds[i]);
+  }
+  return NULL;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+typedef struct {
+  unsigned int repetitions;
+  uint64_t budget_ns;
+  int pin;
+  long cpus;
+  int count_events;
+  FILE* csv;
+} Options;
+
+/// Runs one case at the given thread count and prints the median repetition.
+static int run_case(MicroCase* micro, unsigned int threads, const Options* options) {
+  micro->threads = threads;
+  micro->count_events = options->count_events;
+  if (micro->prepare && micro->prepare(micro)) {
+    fprintf(stderr, "%s: failed to prepare\n", micro->name);
+    if (micro->cleanup) micro->cleanup(micro);
+    return 1;
+  }
+
+  MicroThread* state = calloc(threads, sizeof(MicroThread));
+  pthread_t* handles = malloc(sizeof(pthread_t) * threads);
+  double* ns_per_op = malloc(sizeof(double) * options->repetitions);
+  double* ops_per_sec = malloc(sizeof(double) * options->repetitions);
+  if (!state || !handles || !ns_per_op || !ops_per_sec) return 1;
+
+  for (unsigned int t = 0; t < threads; t++) {
+    state[t].micro = micro;
+    state[t].index = t;
+    state[t].cpu = options->pin ? (int)(t % (unsigned long)options->cpus) : -1;
+    state[t].seed = 0x9E3779B97F4A7C15ull * (t + 1);
+  }
+
+  // Events over every timed repetition, -1 once a thread could not count them
+  int64_t counts[NUM_COUNTERS] = {0};
+  uint64_t counted_ops = 0;
+
+  // Repetition 0 is the warmup and is not reported
+  for (unsigned int rep = 0; rep <= options->repetitions; rep++) {
+    pthread_barrier_init(&micro->start, NULL, threads);
+    for (unsigned int t = 0; t < threads; t++) {
+      state[t].budget_ns = rep == 0 ? options->budget_ns / 4 : options->budget_ns;
+      pthread_create(&handles[t], NULL, micro_thread, &state[t]);
+    }
+    uint64_t ops = 0, ns = 0, slowest = 0;
+    for (unsigned int t = 0; t < threads; t++) {
+      pthread_join(handles[t], NULL);
+      ops += state[t].ops;
+      ns += state[t].ns;
+      if (state[t].ns > slowest) slowest = state[t].ns;
+    }
+    pthread_barrier_destroy(&micro->start);
+    if (rep == 0) continue;
+    for (unsigned int t = 0; t < threads; t++) {
+      for (size_t i = 0; i < NUM_COUNTERS; i++) {
+        counts[i] = counts[i] == -1 || state[t].counts[i] == -1 ? -1 : counts[i] + state[t].counts[i];
+      }
+    }
+    counted_ops += ops;
+    ns_per_op[rep - 1] = ops ? (double)ns / (double)ops : 0;
+    ops_per_sec[rep - 1] = slowest ? (double)ops * 1e9 / (double)slowest : 0;
+  }
+
+  qsort(ns_per_op, options->repetitions, sizeof(double), compare_doubles);
+  qsort(ops_per_sec, options->repetitions, sizeof(double), compare_doubles);
+  double median_ns = ns_per_op[options->repetitions / 2];
+  double median_rate = ops_per_sec[options->repetitions / 2];
+  double spread = ns_per_op[options->repetitions - 1] - ns_per_op[0];
+
+  printf("%-12s %10zu %6zu %8u %14.1f %12.1f %14.1f", micro->name, micro->size, micro->seats, threads, median_ns,
+         spread, median_rate);
+  if (options->csv) {
+    fprintf(options->csv, "%s,%zu,%zu,%u,%.1f,%.1f,%.1f", micro->name, micro->size, micro->seats, threads, median_ns,
+            spread, median_rate);
+  }
+  for (size_t i = 0; options->count_events && i < NUM_COUNTERS; i++) {
+    if (counts[i] == -1 || counted_ops == 0) {
+      printf(" %12s", "n/a");
+      if (options->csv) fprintf(options->csv, ",");
+    } else {
+      double per_op = (double)counts[i] / (double)counted_ops;
+      printf(" %12.2f", per_op);
+      if (options->csv) fprintf(options->csv, ",%.2f", per_op);
+    }
+  }
+  printf("\n");
+  if (options->csv) fprintf(options->csv, "\n");
+
+  for (unsigned int t = 0; t < threads; t++) free(state[t].buffer);
+  free(state);
+  free(handles);
+  free(ns_per_op);
+  free(ops_per_sec);
+  if (micro->cleanup) micro->cleanup(micro);
+  return 0;
+}
+
+static void usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options] [case...]\n"
+          "  -t <threads>  run every case with 1..threads threads (default: number of CPUs)\n"
+          "  -r <reps>     timed repetitions per case, the median is reported (default: 5)\n"
+          "  -d <ms>       duration of each repetition (default: 200)\n"
+          "  -u            do not pin threads to CPUs\n"
+          "  -o <path>     also write the results as CSV to this path\n"
+          "  -c            also report hardware events per operation (n/a where the CPU doesn't count them)\n"
+          "Cases: get_event reserve reserve_hot show show_pipe show_splice list (default: all)\n",
+          program);
+}
+
+static int selected(int argc, char* argv[], const char* name) {
+  if (optind >= argc) return 1;
+  for (int i = optind; i < argc; i++) {
+    if (strcmp(argv[i], name) == 0) return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  Options options = {5, 200000000ull, 1, sysconf(_SC_NPROCESSORS_ONLN), 0, NULL};
+  unsigned int max_threads = options.cpus > 0 ? (unsigned int)options.cpus : 1;
+  const char* csv_path = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:r:d:uo:c")) != -1) {
+    switch (opt) {
+      case 't':
+        max_threads = (unsigned int)strtoul(optarg, NULL, 10);
+        break;
+      case 'r':
+        options.repetitions = (unsigned int)strtoul(optarg, NULL, 10);
+        break;
+      case 'd':
+        options.budget_ns = strtoull(optarg, NULL, 10) * 1000000ull;
+        break;
+      case 'u':
+        options.pin = 0;
+        break;
+      case 'o':
+        csv_path = optarg;
+        break;
+      case 'c':
+        options.count_events = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (max_threads == 0 || options.repetitions == 0 || options.budget_ns == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (options.cpus < 1) options.cpus = 1;
+
+  if (csv_path) {
+    options.csv = fopen(csv_path, "w");
+    if (!options.csv) {
+      fprintf(stderr, "Failed to open %s\n", csv_path);
+      return 1;
+    }
+    fprintf(options.csv, "case,size,seats,threads,ns_per_op,spread_ns,ops_per_sec");
+    for (size_t i = 0; options.count_events && i < NUM_COUNTERS; i++) {
+      fprintf(options.csv, ",%s_per_op", counter_names[i]);
+    }
+    fprintf(options.csv, "\n");
+  }
+
+  printf("%-12s %10s %6s %8s %14s %12s %14s", "case", "size", "seats", "threads", "ns/op", "spread", "ops/s");
+  for (size_t i = 0; options.count_events && i < NUM_COUNTERS; i++) {
+    printf(" %9s/op", counter_names[i]);
+  }
+  printf("\n");
+
+  int failed = 0;
+  if (selected(argc, argv, "get_event")) {
+    for (size_t size = 100; size <= 1000000; size *= 10) {
+      for (unsigned int threads = 1; threads <= max_threads; threads++) {
+        MicroCase micro = {.name = "get_event",
+                           .size = size,
+                           .prepare = prepare_get_event,
+                           .run = run_get_event,
+                           .cleanup = cleanup_get_event};
+        failed |= run_case(&micro, threads, &options);
+      }
+    }
+  }
+
+  if (selected(argc, argv, "reserve")) {
+    size_t sizes[] = {10, 100, 1000};
+    size_t seats[] = {1, 16, 64};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      for (size_t k = 0; k < sizeof(seats) / sizeof(seats[0]); k++) {
+        if (seats[k] > sizes[s] * sizes[s]) continue;
+        for (unsigned int threads = 1; threads <= max_threads; threads++) {
+          MicroCase micro = {.name = "reserve",
+                             .size = sizes[s],
+                             .seats = seats[k],
+                             .prepare = prepare_venues,
+                             .run = run_reserve,
+                             .cleanup = cleanup_venues};
+          failed |= run_case(&micro, threads, &options);
+        }
+      }
+    }
+  }
+
+  if (selected(argc, argv, "reserve_hot")) {
+    size_t seats[] = {1, 16};
+    for (size_t k = 0; k < sizeof(seats) / sizeof(seats[0]); k++) {
+      for (unsigned int threads = 1; threads <= max_threads; threads++) {
+        MicroCase micro = {.name = "reserve_hot",
+                           .size = 1000,
+                           .seats = seats[k],
+                           .prepare = prepare_hot_venue,
+                           .run = run_reserve_hot,
+                           .cleanup = cleanup_venues};
+        failed |= run_case(&micro, threads, &options);
+      }
+    }
+  }
+
+  if (selected(argc, argv, "show")) {
+    for (size_t size = 10; size <= 1000; size *= 10) {
+      for (unsigned int threads = 1; threads <= max_threads; threads++) {
+        MicroCase micro = {.name = "show",
+                           .size = size,
+                           .prepare = prepare_venues,
+                           .run = run_show,
+                           .cleanup = cleanup_venues};
+        failed |= run_case(&micro, threads, &options);
+      }
+    }
+  }
+
+  const char* pipe_cases[] = {"show_pipe", "show_splice"};
+  void (*pipe_runs[])(MicroThread*) = {run_show_pipe, run_show_splice};
+  for (size_t c = 0; c < sizeof(pipe_cases) / sizeof(pipe_cases[0]); c++) {
+    if (!selected(argc, argv, pipe_cases[c])) continue;
+    for (size_t size = 100; size <= 1000; size *= 10) {
+      for (unsigned int threads = 1; threads <= max_threads; threads++) {
+        MicroCase micro = {.name = pipe_cases[c],
+                           .size = size,
+                           .prepare = prepare_venues,
+                           .run = pipe_runs[c],
+                           .cleanup = cleanup_venues};
+        failed |= run_case(&micro, threads, &options);
+      }
+    }
+  }
+
+  if (selected(argc, argv, "list")) {
+    for (size_t size = 100; size <= 10000; size *= 10) {
+      for (unsigned int threads = 1; threads <= max_threads; threads++) {
+        MicroCase micro = {.name = "list",
+                           .size = size,
+                           .prepare = prepare_list,
+                           .run = run_list,
+                           .cleanup = cleanup_venues};
+        failed |= run_case(&micro, threads, &options);
+      }
+    }
+  }
+
+  if (options.csv) fclose(options.csv);
+  return failed;
+}
@@ -1,20 +1,31 @@
 #include "api.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "common/batch.h"
 #include "common/constants.h"
 #include "common/io.h"
+#include "common/varint.h"
 
-int req_fd = -1;
-int resp_fd = -1;
-char const* req_pipe;
-char const* resp_pipe;
-unsigned int id;
+// Connection state is per thread, so a process can run one session on each of its threads
+static _Thread_local int req_fd = -1;
+static _Thread_local int resp_fd = -1;
+static _Thread_local char const* req_pipe;
+static _Thread_local char const* resp_pipe;
+static _Thread_local unsigned int id;
+static _Thread_local char notify_pipe[MAX_BUFFER_SIZE] = {0};
+static _Thread_local pthread_t notify_thread;
+static _Thread_local int notify_active = 0;
+static _Thread_local unsigned int protocol = PROTOCOL_V1;  // Agreed on by ems_setup()
+static unsigned int max_protocol = PROTOCOL_VERSION;
 
 enum OPCODES {
   SETUP = 1,
@@ -23,8 +34,44 @@ enum OPCODES {
   RESERVE = 4,
   SHOW = 5,
   LIST = 6,
+  SUBSCRIBE = 7,
+  UNSUBSCRIBE = 8,
+  BATCH = 9,
+  STATS = 10,
+  HOLD = 11,
+  CONFIRM = 12,
+  WAITLIST = 13,
+  EVENT_STATS = 14,
+  VERSION = 15,
 };
 
+enum NOTIFY_KINDS {
+  NOTIFY_RESERVED = 1,
+  NOTIFY_COALESCED = 2,
+  NOTIFY_RELEASED = 3,
+  NOTIFY_WAITLISTED = 4,
+};
+
+/// Agrees on the newest wire format both sides speak. Sent on every new session, before any request.
+/// @return 0 if a version was agreed on, 1 if the server did not answer.
+static int negotiate_protocol(void) {
+  char message[sizeof(int) + sizeof(unsigned int)];
+  int code = VERSION;
+  memcpy(message, &code, sizeof(int));
+  memcpy(message + sizeof(int), &max_protocol, sizeof(unsigned int));
+  protocol = PROTOCOL_V1;
+  if (max_protocol == PROTOCOL_V1) return 0;  // Nothing to agree on
+
+  unsigned int version;
+  if (write_all(req_fd, message, sizeof(message)) != 0 || read_all(resp_fd, &code, sizeof(int)) != 0 ||
+      read_all(resp_fd, &version, sizeof(unsigned int)) != 0) {
+    fprintf(stderr, "Failed to negotiate the protocol version\n");
+    return 1;
+  }
+  if (code == 0 && version >= PROTOCOL_V1 && version <= max_protocol) protocol = version;
+  return 0;
+}
+
 int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path) {
   int tx = open(server_pipe_path, O_WRONLY);
   if (tx == -1) {
@@ -63,6 +110,14 @@ int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const*
   }
 
   read(resp_fd, &id, sizeof(unsigned int));
+  if (id == SESSION_ID_BUSY) {
+    fprintf(stderr, "Server busy, try again later\n");
+    close(resp_fd);
+    resp_fd = -1;
+    unlink(req_pipe_path);
+    unlink(resp_pipe_path);
+    return 1;
+  }
 
   req_fd = open(req_pipe_path, O_WRONLY);
   if (resp_fd == -1) {
@@ -73,7 +128,19 @@ int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const*
   req_pipe = req_pipe_path;
   resp_pipe = resp_pipe_path;
   printf("Got id %u\n", id);
-  return 0;
+  return negotiate_protocol();
+}
+
+void ems_set_max_protocol(unsigned int version) {
+  max_protocol = version < PROTOCOL_V1 ? PROTOCOL_V1 : version > PROTOCOL_VERSION ? PROTOCOL_VERSION : version;
+}
+
+int ems_connected(void) {
+  if (req_fd == -1 || resp_fd == -1) return 0;
+  // Without readers the request pipe reports an error, without writers the response pipe a hangup
+  struct pollfd fds[2] = {{req_fd, 0, 0}, {resp_fd, POLLIN, 0}};
+  if (poll(fds, 2, 0) == -1) return 0;
+  return !(fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) && !(fds[1].revents & (POLLHUP | POLLNVAL));
 }
 
 int ems_quit(void) {
@@ -81,13 +148,34 @@ int ems_quit(void) {
   write(req_fd, &code, sizeof(int));
   close(req_fd);
   close(resp_fd);
+  req_fd = -1;
+  resp_fd = -1;
   unlink(req_pipe);
   unlink(resp_pipe);
+  if (notify_active) {
+    // The server closes the notification pipe when the session ends
+    pthread_join(notify_thread, NULL);
+    unlink(notify_pipe);
+    notify_active = 0;
+  }
   return 0;
 }
 
 int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
   int code = CREATE;
+  if (protocol >= PROTOCOL_V2) {
+    char message[sizeof(int) + sizeof(unsigned int) + 2 * VARINT_MAX_BYTES];
+    size_t len = 0;
+    memcpy(message, &code, sizeof(int));
+    len += sizeof(int);
+    memcpy(message + len, &event_id, sizeof(unsigned int));
+    len += sizeof(unsigned int);
+    len += varint_encode(message + len, num_rows);
+    len += varint_encode(message + len, num_cols);
+    write(req_fd, message, len);
+    read(resp_fd, &code, sizeof(int));
+    return code != 0;
+  }
   write(req_fd, &code, sizeof(int));
   write(req_fd, &event_id, sizeof(unsigned int));
   write(req_fd, &num_rows, sizeof(size_t));
@@ -103,6 +191,30 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
 
 int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
   int code = RESERVE;
+  if (protocol >= PROTOCOL_V2) {
+    // The server decodes the seats without allocating, so it takes no more than it has room for
+    if (num_seats > MAX_RESERVATION_SIZE) return 1;
+    char message[sizeof(int) + sizeof(unsigned int) + 2 * VARINT_MAX_BYTES +
+                 2 * VARINT_MAX_BYTES * MAX_RESERVATION_SIZE];
+    char packed[2 * VARINT_MAX_BYTES * MAX_RESERVATION_SIZE];
+    size_t packed_len = 0;
+    for (size_t i = 0; i < num_seats; i++) {
+      packed_len += varint_encode(packed + packed_len, xs[i]);
+      packed_len += varint_encode(packed + packed_len, ys[i]);
+    }
+    size_t len = 0;
+    memcpy(message, &code, sizeof(int));
+    len += sizeof(int);
+    memcpy(message + len, &event_id, sizeof(unsigned int));
+    len += sizeof(unsigned int);
+    len += varint_encode(message + len, num_seats);
+    len += varint_encode(message + len, packed_len);
+    memcpy(message + len, packed, packed_len);
+    len += packed_len;
+    write(req_fd, message, len);
+    read(resp_fd, &code, sizeof(int));
+    return code != 0;
+  }
   write(req_fd, &code, sizeof(int));
   write(req_fd, &event_id, sizeof(unsigned int));
   write(req_fd, &num_seats, sizeof(size_t));
@@ -118,12 +230,11 @@ int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys)
   return 1;
 }
 
-int ems_show(int out_fd, unsigned int event_id) {
-  int code = SHOW;
+/// Reads the response to a SHOW request and prints the seats to the given file.
+static int read_show_response(int out_fd) {
+  int code;
   size_t num_rows, num_cols;
   unsigned int* seats;
-  write(req_fd, &code, sizeof(int));
-  write(req_fd, &event_id, sizeof(unsigned int));
   read(resp_fd, &code, sizeof(int));
   if (code == 0) {
     if (read(resp_fd, &num_rows, sizeof(size_t)) == -1 || read(resp_fd, &num_cols, sizeof(size_t)) == -1) {
@@ -188,10 +299,16 @@ int ems_show(int out_fd, unsigned int event_id) {
   return 1;
 }
 
-int ems_list_events(int out_fd) {
-  printf("Sending list request\n");
-  int code = LIST;
+int ems_show(int out_fd, unsigned int event_id) {
+  int code = SHOW;
   write(req_fd, &code, sizeof(int));
+  write(req_fd, &event_id, sizeof(unsigned int));
+  return read_show_response(out_fd);
+}
+
+/// Reads the response to a LIST request and prints the events to the given file.
+static int read_list_response(int out_fd) {
+  int code;
   read(resp_fd, &code, sizeof(int));
   if (code == 0) {
     size_t num_events = 0;
@@ -216,6 +333,14 @@ int ems_list_events(int out_fd) {
       free(event_ids);
       return 1;
     }
+    // Taken seats of every event, followed by their total seats
+    size_t* occupancy = malloc(sizeof(size_t) * 2 * num_events);
+    if (occupancy == NULL || read_all(resp_fd, occupancy, sizeof(size_t) * 2 * num_events)) {
+      fprintf(stderr, "Failed to read event occupancy\n");
+      free(occupancy);
+      free(event_ids);
+      return 1;
+    }
     for (size_t i = 0; i < num_events; i++) {
       char buff[] = "Event: ";
       if (print_str(out_fd, buff)) {
@@ -227,8 +352,9 @@ int ems_list_events(int out_fd) {
         perror("Error writing event id to file descriptor\n");
         return 1;
       }
-      write(out_fd, "\n", 1);
+      dprintf(out_fd, " (%zu/%zu seats taken)\n", occupancy[i], occupancy[num_events + i]);
     }
+    free(occupancy);
     free(event_ids);
     return 0;
   } else {
@@ -236,3 +362,236 @@ int ems_list_events(int out_fd) {
   }
   return 1;
 }
+
+int ems_list_events(int out_fd) {
+  int code = LIST;
+  write(req_fd, &code, sizeof(int));
+  return read_list_response(out_fd);
+}
+
+int ems_batch(int out_fd, const Batch* batch) {
+  if (batch->num_ops == 0) {
+    return 0;
+  }
+
+  char header[sizeof(int) + 2 * sizeof(size_t)];
+  int code = BATCH;
+  memcpy(header, &code, sizeof(int));
+  memcpy(header + sizeof(int), &batch->num_ops, sizeof(size_t));
+  memcpy(header + sizeof(int) + sizeof(size_t), &batch->len, sizeof(size_t));
+  if (write_all(req_fd, header, sizeof(header)) || write_all(req_fd, batch->data, batch->len)) {
+    fprintf(stderr, "Failed to send batch\n");
+    return 1;
+  }
+
+  if (read_all(resp_fd, &code, sizeof(int)) || code != 0) {
+    fprintf(stderr, "Batch rejected by the server\n");
+    return 1;
+  }
+
+  size_t offset = 0;
+  BatchOp op;
+  for (size_t i = 0; i < batch->num_ops; i++) {
+    if (batch_next(batch->data, batch->len, &offset, &op, NULL, NULL, MAX_RESERVATION_SIZE) != 0) {
+      return 1;
+    }
+
+    switch (op.op) {
+      case BATCH_OP_CREATE:
+        if (read_all(resp_fd, &code, sizeof(int))) return 1;
+        if (code != 0) fprintf(stderr, "Failed to create event\n");
+        break;
+
+      case BATCH_OP_RESERVE:
+        if (read_all(resp_fd, &code, sizeof(int))) return 1;
+        if (code != 0) fprintf(stderr, "Failed to reserve seats\n");
+        break;
+
+      case BATCH_OP_SHOW:
+        if (read_show_response(out_fd)) fprintf(stderr, "Failed to show event\n");
+        break;
+
+      case BATCH_OP_LIST:
+        if (read_list_response(out_fd)) fprintf(stderr, "Failed to list events\n");
+        break;
+    }
+  }
+
+  return 0;
+}
+
+int ems_event_stats(int out_fd, unsigned int event_id) {
+  int code = EVENT_STATS;
+  if (write_all(req_fd, &code, sizeof(int)) || write_all(req_fd, &event_id, sizeof(unsigned int)) ||
+      read_all(resp_fd, &code, sizeof(int)) || code != 0) {
+    return 1;
+  }
+
+  size_t header[3];  // Rows, columns and taken seats
+  if (read_all(resp_fd, header, sizeof(header))) return 1;
+  size_t* row_occupied = malloc(sizeof(size_t) * header[0] + 1);
+  if (row_occupied == NULL) {
+    fprintf(stderr, "Failed to allocate memory for row occupancy\n");
+    return 1;
+  }
+  if (read_all(resp_fd, row_occupied, sizeof(size_t) * header[0])) {
+    free(row_occupied);
+    return 1;
+  }
+
+  dprintf(out_fd, "Event %u: %zu/%zu seats taken\n", event_id, header[2], header[0] * header[1]);
+  for (size_t row = 0; row < header[0]; row++) {
+    dprintf(out_fd, "Row %zu: %zu/%zu\n", row + 1, row_occupied[row], header[1]);
+  }
+  free(row_occupied);
+  return 0;
+}
+
+int ems_stats(int out_fd) {
+  int code = STATS;
+  if (write_all(req_fd, &code, sizeof(int)) || read_all(resp_fd, &code, sizeof(int)) || code != 0) {
+    return 1;
+  }
+
+  size_t len;
+  if (read_all(resp_fd, &len, sizeof(size_t))) return 1;
+  char* csv = malloc(len + 1);
+  if (csv == NULL) {
+    fprintf(stderr, "Failed to allocate memory for stats\n");
+    return 1;
+  }
+  if (read_all(resp_fd, csv, len) || write_all(out_fd, csv, len)) {
+    free(csv);
+    return 1;
+  }
+  free(csv);
+  return 0;
+}
+
+int ems_hold(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys, unsigned int ttl_s,
+             unsigned int* hold_id) {
+  int code = HOLD;
+  if (write_all(req_fd, &code, sizeof(int)) || write_all(req_fd, &event_id, sizeof(unsigned int)) ||
+      write_all(req_fd, &num_seats, sizeof(size_t)) || write_all(req_fd, xs, sizeof(size_t) * num_seats) ||
+      write_all(req_fd, ys, sizeof(size_t) * num_seats) || write_all(req_fd, &ttl_s, sizeof(unsigned int))) {
+    return 1;
+  }
+  if (read_all(resp_fd, &code, sizeof(int)) || code != 0) return 1;
+  return read_all(resp_fd, hold_id, sizeof(unsigned int));
+}
+
+int ems_confirm(unsigned int hold_id) {
+  int code = CONFIRM;
+  if (write_all(req_fd, &code, sizeof(int)) || write_all(req_fd, &hold_id, sizeof(unsigned int)) ||
+      read_all(resp_fd, &code, sizeof(int))) {
+    return 1;
+  }
+  return code != 0;
+}
+
+/// Prints every change record received on the notification pipe until the server closes it.
+/// @param arg Path of the notification pipe, owned by the session's thread.
+static void* notify_reader(void* arg) {
+  const char* path = arg;
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "Failed to open notification pipe\n");
+    return NULL;
+  }
+
+  while (1) {
+    int kind;
+    unsigned int event_id, version, reservation_id;
+    size_t num_seats;
+    if (read_all(fd, &kind, sizeof(int)) || read_all(fd, &event_id, sizeof(unsigned int)) ||
+        read_all(fd, &version, sizeof(unsigned int)) || read_all(fd, &reservation_id, sizeof(unsigned int)) ||
+        read_all(fd, &num_seats, sizeof(size_t))) {
+      break;
+    }
+
+    size_t* coords = malloc(sizeof(size_t) * num_seats * 2 + 1);
+    if (coords == NULL || read_all(fd, coords, sizeof(size_t) * num_seats * 2)) {
+      free(coords);
+      break;
+    }
+
+    if (kind == NOTIFY_COALESCED) {
+      printf("Event %u changed (version %u): updates coalesced\n", event_id, version);
+    } else if (kind == NOTIFY_WAITLISTED) {
+      printf("Waitlist on event %u fulfilled (version %u): reservation %u", event_id, version, reservation_id);
+      for (size_t i = 0; i < num_seats; i++) {
+        printf(" (%zu,%zu)", coords[i], coords[num_seats + i]);
+      }
+      printf("\n");
+    } else {
+      printf("Event %u changed (version %u): reservation %u%s", event_id, version, reservation_id,
+             kind == NOTIFY_RELEASED ? " released" : "");
+      for (size_t i = 0; i < num_seats; i++) {
+        printf(" (%zu,%zu)", coords[i], coords[num_seats + i]);
+      }
+      printf("\n");
+    }
+    free(coords);
+  }
+
+  close(fd);
+  return NULL;
+}
+
+/// Creates the session's notification pipe and starts printing what arrives on it, once.
+/// @return 0 if the pipe is ready, 1 otherwise.
+static int start_notifications(void) {
+  if (!notify_active) {
+    if (strlen(resp_pipe) + 2 >= MAX_BUFFER_SIZE) {
+      fprintf(stderr, "Response pipe path too long for a notification pipe\n");
+      return 1;
+    }
+    strcpy(notify_pipe, resp_pipe);
+    strcat(notify_pipe, ".n");
+    if (mkfifo(notify_pipe, 0640) && errno != EEXIST) {
+      fprintf(stderr, "Failed to create notification pipe\n");
+      return 1;
+    }
+    if (pthread_create(&notify_thread, NULL, notify_reader, notify_pipe) != 0) {
+      fprintf(stderr, "Failed to start notification reader\n");
+      unlink(notify_pipe);
+      return 1;
+    }
+    notify_active = 1;
+  }
+  return 0;
+}
+
+int ems_subscribe(unsigned int event_id) {
+  if (start_notifications()) return 1;
+
+  char message[sizeof(int) + sizeof(unsigned int) + MAX_BUFFER_SIZE] = {0};
+  int code = SUBSCRIBE;
+  memcpy(message, &code, sizeof(int));
+  memcpy(message + sizeof(int), &event_id, sizeof(unsigned int));
+  strcpy(message + sizeof(int) + sizeof(unsigned int), notify_pipe);
+  write(req_fd, message, sizeof(message));
+  read(resp_fd, &code, sizeof(int));
+  return code == 0 ? 0 : 1;
+}
+
+int ems_waitlist(unsigned int event_id, size_t num_seats) {
+  if (start_notifications()) return 1;
+
+  char message[sizeof(int) + sizeof(unsigned int) + sizeof(size_t) + MAX_BUFFER_SIZE] = {0};
+  int code = WAITLIST;
+  memcpy(message, &code, sizeof(int));
+  memcpy(message + sizeof(int), &event_id, sizeof(unsigned int));
+  memcpy(message + sizeof(int) + sizeof(unsigned int), &num_seats, sizeof(size_t));
+  strcpy(message + sizeof(int) + sizeof(unsigned int) + sizeof(size_t), notify_pipe);
+  if (write_all(req_fd, message, sizeof(message)) || read_all(resp_fd, &code, sizeof(int))) return 1;
+  return code != 0;
+}
+
+int ems_unsubscribe(unsigned int event_id) {
+  int code = UNSUBSCRIBE;
+  write(req_fd, &code, sizeof(int));
+  write(req_fd, &event_id, sizeof(unsigned int));
+  read(resp_fd, &code, sizeof(int));
+  return code == 0 ? 0 : 1;
+}
@@ -3,13 +3,26 @@
 
 #include <stddef.h>
 
+#include "common/batch.h"
+
 /// Connects to an EMS server.
 /// @param req_pipe_path Path to the name pipe to be created for requests.
 /// @param resp_pipe_path Path to the name pipe to be created for responses.
 /// @param server_pipe_path Path to the name pipe where the server is listening.
-/// @return 0 if the connection was established successfully, 1 otherwise.
+/// @return 0 if the connection was established successfully, 1 otherwise, including when the
+///         server is too busy to take a new session.
 int ems_setup(char const* req_pipe_path, char const* resp_pipe_path, char const* server_pipe_path);
 
+/// Limits the wire format ems_setup() agrees on with the server, for every later session of the
+/// process. Defaults to PROTOCOL_VERSION.
+/// @param version Newest version to use, see common/constants.h.
+void ems_set_max_protocol(unsigned int version);
+
+/// Checks whether the session set up by ems_setup() is still open. The server closes a session's
+/// pipes when it ends it on its own, such as after its idle timeout.
+/// @return 1 if both pipes are still connected to the server, 0 otherwise.
+int ems_connected(void);
+
 /// Disconnects from an EMS server.
 /// @return 0 in case of success, 1 otherwise.
 int ems_quit(void);
@@ -35,9 +48,60 @@ int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys)
 /// @return 0 if the event was printed successfully, 1 otherwise.
 int ems_show(int out_fd, unsigned int event_id);
 
-/// Prints all the events to the given file.
+/// Holds seats for a limited time. Unless confirmed in time, the seats are freed again.
+/// @param event_id Id of the event to hold seats of.
+/// @param num_seats Number of seats to hold.
+/// @param xs Array of rows of the seats to hold.
+/// @param ys Array of columns of the seats to hold.
+/// @param ttl_s Seconds the seats are held for.
+/// @param hold_id Pointer to store the id of the hold in.
+/// @return 0 if the seats were held, 1 otherwise.
+int ems_hold(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys, unsigned int ttl_s,
+             unsigned int* hold_id);
+
+/// Confirms a hold made with ems_hold(), so its seats stay reserved.
+/// @param hold_id Id of the hold.
+/// @return 0 if the hold was confirmed, 1 if it failed or already expired.
+int ems_confirm(unsigned int hold_id);
+
+/// Prints all the events to the given file, with how many of their seats are taken.
 /// @param out_fd File descriptor to print the events to.
 /// @return 0 if the events were printed successfully, 1 otherwise.
 int ems_list_events(int out_fd);
 
+/// Sends a compiled batch of operations as a single request and prints the results in order.
+/// SHOW and LIST output goes to out_fd; failed operations are reported on stderr.
+/// @param out_fd File descriptor to print SHOW and LIST results to.
+/// @param batch Operations to run, see common/batch.h.
+/// @return 0 if the batch was executed, 1 if it could not be sent or was rejected.
+int ems_batch(int out_fd, const Batch* batch);
+
+/// Subscribes to seat changes of the given event. Changes are printed to stdout as they arrive.
+/// @param event_id Id of the event to subscribe to.
+/// @return 0 if the subscription was accepted, 1 otherwise.
+int ems_subscribe(unsigned int event_id);
+
+/// Queues a request for any num_seats seats of an event, served in arrival order as seats free up.
+/// The reserved seats are printed to stdout once they are assigned, like subscribed changes.
+/// @param event_id Id of the event to wait for.
+/// @param num_seats Number of seats wanted.
+/// @return 0 if the request was queued, 1 otherwise.
+int ems_waitlist(unsigned int event_id, size_t num_seats);
+
+/// Cancels a subscription made with ems_subscribe().
+/// @param event_id Id of the event to unsubscribe from.
+/// @return 0 if the subscription was removed, 1 otherwise.
+int ems_unsubscribe(unsigned int event_id);
+
+/// Prints how many seats of an event are taken, in total and per row, to the given file.
+/// @param out_fd File descriptor to print the counts to.
+/// @param event_id Id of the event.
+/// @return 0 if the counts were printed successfully, 1 otherwise.
+int ems_event_stats(int out_fd, unsigned int event_id);
+
+/// Prints the server's per-operation counters and latency percentiles to the given file, as CSV.
+/// @param out_fd File descriptor to print the statistics to.
+/// @return 0 if the statistics were printed successfully, 1 otherwise.
+int ems_stats(int out_fd);
+
 #endif  // CLIENT_API_H
@@ -1,53 +1,52 @@
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "api.h"
+#include "common/batch.h"
 #include "common/constants.h"
+#include "common/io.h"
 #include "parser.h"
 
-int main(int argc, char* argv[]) {
-  if (argc < 5) {
-    fprintf(stderr, "Usage: %s <request pipe path> <response pipe path> <server pipe path> <.jobs file path>\n",
-            argv[0]);
-    return 1;
-  }
-
-  if (ems_setup(argv[1], argv[2], argv[3])) {
-    fprintf(stderr, "Failed to set up EMS\n");
-    return 1;
-  }
+// Largest encoding of a single operation, see common/batch.h
+#define MAX_BATCH_OP_SIZE (7 + 8 * MAX_RESERVATION_SIZE)
 
-  const char* dot = strrchr(argv[4], '.');
-  if (dot == NULL || dot == argv[4] || strlen(dot) != 5 || strcmp(dot, ".jobs") ||
-      strlen(argv[4]) > MAX_JOB_FILE_NAME_SIZE) {
-    fprintf(stderr, "The provided .jobs file path is not valid. Path: %s\n", argv[1]);
-    return 1;
-  }
-
-  char out_path[MAX_JOB_FILE_NAME_SIZE];
-  strcpy(out_path, argv[4]);
-  strcpy(strrchr(out_path, '.'), ".out");
-
-  int in_fd = open(argv[4], O_RDONLY);
-  if (in_fd == -1) {
-    fprintf(stderr, "Failed to open input file. Path: %s\n", argv[4]);
-    return 1;
-  }
-
-  int out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
-  if (out_fd == -1) {
-    fprintf(stderr, "Failed to open output file. Path: %s\n", out_path);
-    return 1;
-  }
+/// Sends the pending batch, if any, and waits for its results.
+static void flush_batch(int out_fd, Batch* batch) {
+  if (batch == NULL || batch->num_ops == 0) return;
+  if (ems_batch(out_fd, batch)) fprintf(stderr, "Failed to run batch\n");
+  batch_clear(batch);
+}
 
+/// Runs every command of a .jobs file.
+/// @param in_fd File descriptor of the .jobs file.
+/// @param out_fd File descriptor of the .out file.
+/// @param batch If not NULL, commands are compiled into batches that are sent at every WAIT, BARRIER,
+///              when full and at the end of the file, instead of one request per command.
+/// @return Number of operations sent to the server.
+static size_t run_jobs(int in_fd, int out_fd, Batch* batch) {
+  size_t num_ops = 0;
   while (1) {
     unsigned int event_id;
     size_t num_rows, num_columns, num_coords;
     unsigned int delay = 0;
+    unsigned int ttl_s, hold_id;
     size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
 
+    if (batch && batch->len + MAX_BATCH_OP_SIZE > MAX_BATCH_SIZE) {
+      flush_batch(out_fd, batch);
+    }
+
     switch (get_next(in_fd)) {
       case CMD_CREATE:
         if (parse_create(in_fd, &event_id, &num_rows, &num_columns) != 0) {
@@ -55,7 +54,12 @@ int main(int argc, char* argv[]) {
           continue;
         }
 
-        if (ems_create(event_id, num_rows, num_columns)) fprintf(stderr, "Failed to create event\n");
+        num_ops++;
+        if (batch) {
+          if (batch_add_create(batch, event_id, num_rows, num_columns)) fprintf(stderr, "Failed to create event\n");
+        } else if (ems_create(event_id, num_rows, num_columns)) {
+          fprintf(stderr, "Failed to create event\n");
+        }
         break;
 
       case CMD_RESERVE:
@@ -66,7 +70,12 @@ int main(int argc, char* argv[]) {
           continue;
         }
 
-        if (ems_reserve(event_id, num_coords, xs, ys)) fprintf(stderr, "Failed to reserve seats\n");
+        num_ops++;
+        if (batch) {
+          if (batch_add_reserve(batch, event_id, num_coords, xs, ys)) fprintf(stderr, "Failed to reserve seats\n");
+        } else if (ems_reserve(event_id, num_coords, xs, ys)) {
+          fprintf(stderr, "Failed to reserve seats\n");
+        }
         break;
 
       case CMD_SHOW:
@@ -75,11 +84,21 @@ int main(int argc, char* argv[]) {
           continue;
         }
 
-        if (ems_show(out_fd, event_id)) fprintf(stderr, "Failed to show event\n");
+        num_ops++;
+        if (batch) {
+          if (batch_add_show(batch, event_id)) fprintf(stderr, "Failed to show event\n");
+        } else if (ems_show(out_fd, event_id)) {
+          fprintf(stderr, "Failed to show event\n");
+        }
         break;
 
       case CMD_LIST_EVENTS:
-        if (ems_list_events(out_fd)) fprintf(stderr, "Failed to list events\n");
+        num_ops++;
+        if (batch) {
+          if (batch_add_list(batch)) fprintf(stderr, "Failed to list events\n");
+        } else if (ems_list_events(out_fd)) {
+          fprintf(stderr, "Failed to list events\n");
+        }
         break;
 
       case CMD_WAIT:
@@ -88,12 +107,97 @@ int main(int argc, char* argv[]) {
           continue;
         }
 
+        // Everything before a WAIT must have happened before the wait starts
+        flush_batch(out_fd, batch);
         if (delay > 0) {
           printf("Waiting...\n");
           sleep(delay);
         }
         break;
 
+      case CMD_BARRIER:
+        flush_batch(out_fd, batch);
+        break;
+
+      case CMD_SUBSCRIBE:
+        if (parse_subscribe(in_fd, &event_id) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        num_ops++;
+        flush_batch(out_fd, batch);
+        if (ems_subscribe(event_id)) fprintf(stderr, "Failed to subscribe to event\n");
+        break;
+
+      case CMD_UNSUBSCRIBE:
+        if (parse_subscribe(in_fd, &event_id) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        num_ops++;
+        flush_batch(out_fd, batch);
+        if (ems_unsubscribe(event_id)) fprintf(stderr, "Failed to unsubscribe from event\n");
+        break;
+
+      case CMD_STATS:
+        num_ops++;
+        flush_batch(out_fd, batch);
+        if (ems_stats(out_fd)) fprintf(stderr, "Failed to get server stats\n");
+        break;
+
+      case CMD_HOLD:
+        num_coords = parse_hold(in_fd, MAX_RESERVATION_SIZE, &event_id, &ttl_s, xs, ys);
+
+        if (num_coords == 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        // The hold id is needed right away, so holds are never batched
+        num_ops++;
+        flush_batch(out_fd, batch);
+        if (ems_hold(event_id, num_coords, xs, ys, ttl_s, &hold_id)) {
+          fprintf(stderr, "Failed to hold seats\n");
+        } else {
+          dprintf(out_fd, "Hold %u\n", hold_id);
+        }
+        break;
+
+      case CMD_CONFIRM:
+        if (parse_confirm(in_fd, &hold_id) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        num_ops++;
+        flush_batch(out_fd, batch);
+        if (ems_confirm(hold_id)) fprintf(stderr, "Failed to confirm hold\n");
+        break;
+
+      case CMD_WAITLIST:
+        if (parse_waitlist(in_fd, &event_id, &num_coords) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        num_ops++;
+        flush_batch(out_fd, batch);
+        if (ems_waitlist(event_id, num_coords)) fprintf(stderr, "Failed to join the waitlist\n");
+        break;
+
+      case CMD_EVENT_STATS:
+        if (parse_show(in_fd, &event_id) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        num_ops++;
+        flush_batch(out_fd, batch);
+        if (ems_event_stats(out_fd, event_id)) fprintf(stderr, "Failed to get event stats\n");
+        break;
+
       case CMD_INVALID:
         fprintf(stderr, "Invalid command. See HELP for usage\n");
         break;
@@ -103,9 +207,17 @@ int main(int argc, char* argv[]) {
             "Available commands:\n"
             "  CREATE <event_id> <num_rows> <num_columns>\n"
             "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
+            "  HOLD <event_id> <ttl_s> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
+            "  CONFIRM <hold_id>\n"
+            "  WAITLIST <event_id> <num_seats>\n"
             "  SHOW <event_id>\n"
             "  LIST\n"
             "  WAIT <delay_ms>\n"
+            "  BARRIER\n"
+            "  SUBSCRIBE <event_id>\n"
+            "  UNSUBSCRIBE <event_id>\n"
+            "  STATS\n"
+            "  EVENT_STATS <event_id>\n"
             "  HELP\n");
 
         break;
@@ -114,10 +226,657 @@ int main(int argc, char* argv[]) {
         break;
 
       case EOC:
-        close(in_fd);
-        close(out_fd);
-        ems_quit();
-        return 0;
+        flush_batch(out_fd, batch);
+        return num_ops;
+    }
+  }
+}
+
+typedef struct {
+  char* path;      // Path of the .jobs file
+  size_t num_ops;  // Operations sent while running it
+  double seconds;  // Time spent running it, including session setup
+  int failed;      // Set if the file could not be run
+} JobFile;
+
+typedef struct {
+  JobFile* files;
+  size_t num_files;
+  atomic_size_t next;  // Index of the next file to be picked up by a runner thread
+  const char* req_pipe_path;
+  const char* resp_pipe_path;
+  const char* server_pipe_path;
+  int batch_mode;
+} Runner;
+
+static double elapsed_seconds(const struct timespec* start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/// Opens a .jobs file and creates the .out file next to it.
+/// @param path Path of the .jobs file.
+/// @param in_fd Pointer to store the file descriptor of the .jobs file in.
+/// @param out_fd Pointer to store the file descriptor of the .out file in.
+/// @return 0 if both files were opened, 1 otherwise.
+static int open_job_file(const char* path, int* in_fd, int* out_fd) {
+  const char* dot = strrchr(path, '.');
+  if (dot == NULL || dot == path || strlen(dot) != 5 || strcmp(dot, ".jobs") ||
+      strlen(path) >= MAX_JOB_FILE_NAME_SIZE) {
+    fprintf(stderr, "The provided .jobs file path is not valid. Path: %s\n", path);
+    return 1;
+  }
+
+  char out_path[MAX_JOB_FILE_NAME_SIZE];
+  strcpy(out_path, path);
+  strcpy(strrchr(out_path, '.'), ".out");
+
+  *in_fd = open(path, O_RDONLY);
+  if (*in_fd == -1) {
+    fprintf(stderr, "Failed to open input file. Path: %s\n", path);
+    return 1;
+  }
+
+  *out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+  if (*out_fd == -1) {
+    fprintf(stderr, "Failed to open output file. Path: %s\n", out_path);
+    close(*in_fd);
+    return 1;
+  }
+  return 0;
+}
+
+/// Runs a single .jobs file on its own session, writing the results next to it as a .out file.
+/// @return 0 if the file was run, 1 otherwise.
+static int run_job_file(Runner* runner, size_t index) {
+  JobFile* file = &runner->files[index];
+  char req_path[MAX_BUFFER_SIZE], resp_path[MAX_BUFFER_SIZE];
+
+  // A single file keeps the given pipe names, several files get one pair of pipes each
+  int req_len, resp_len;
+  if (runner->num_files == 1) {
+    req_len = snprintf(req_path, sizeof(req_path), "%s", runner->req_pipe_path);
+    resp_len = snprintf(resp_path, sizeof(resp_path), "%s", runner->resp_pipe_path);
+  } else {
+    req_len = snprintf(req_path, sizeof(req_path), "%s.%zu", runner->req_pipe_path, index);
+    resp_len = snprintf(resp_path, sizeof(resp_path), "%s.%zu", runner->resp_pipe_path, index);
+  }
+  if (req_len < 0 || resp_len < 0 || (size_t)req_len >= sizeof(req_path) || (size_t)resp_len >= sizeof(resp_path)) {
+    fprintf(stderr, "Pipe paths too long for %s\n", file->path);
+    return 1;
+  }
+
+  int in_fd, out_fd;
+  if (open_job_file(file->path, &in_fd, &out_fd)) return 1;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (ems_setup(req_path, resp_path, runner->server_pipe_path)) {
+    fprintf(stderr, "Failed to set up EMS\n");
+    close(in_fd);
+    close(out_fd);
+    return 1;
+  }
+
+  Batch batch;
+  batch_init(&batch);
+  file->num_ops = run_jobs(in_fd, out_fd, runner->batch_mode ? &batch : NULL);
+  batch_free(&batch);
+  ems_quit();
+  file->seconds = elapsed_seconds(&start);
+
+  close(in_fd);
+  close(out_fd);
+  return 0;
+}
+
+static void* runner_thread(void* arg) {
+  Runner* runner = arg;
+  while (1) {
+    size_t index = atomic_fetch_add(&runner->next, 1);
+    if (index >= runner->num_files) break;
+    runner->files[index].failed = run_job_file(runner, index);
+  }
+  return NULL;
+}
+
+static int compare_paths(const void* a, const void* b) {
+  return strcmp(((const JobFile*)a)->path, ((const JobFile*)b)->path);
+}
+
+/// Adds a .jobs file, or every .jobs file in a directory, to the list of files to run.
+/// @return 0 on success, 1 otherwise.
+static int collect_job_files(const char* path, JobFile** files, size_t* num_files, size_t* cap) {
+  struct stat st;
+  if (stat(path, &st) == -1) {
+    fprintf(stderr, "Failed to access %s\n", path);
+    return 1;
+  }
+
+  DIR* dir = NULL;
+  struct dirent* entry = NULL;
+  if (S_ISDIR(st.st_mode)) {
+    dir = opendir(path);
+    if (dir == NULL) {
+      fprintf(stderr, "Failed to open directory %s\n", path);
+      return 1;
     }
   }
-}
\ No newline at end of file
+
+  while (1) {
+    char* file_path;
+    if (dir) {
+      entry = readdir(dir);
+      if (entry == NULL) break;
+      const char* dot = strrchr(entry->d_name, '.');
+      if (dot == NULL || dot == entry->d_name || strcmp(dot, ".jobs") != 0) continue;
+      file_path = malloc(strlen(path) + strlen(entry->d_name) + 2);
+      if (file_path) sprintf(file_path, "%s/%s", path, entry->d_name);
+    } else {
+      file_path = strdup(path);
+    }
+
+    if (file_path == NULL) {
+      fprintf(stderr, "Failed to allocate memory for job file path\n");
+      if (dir) closedir(dir);
+      return 1;
+    }
+
+    if (*num_files == *cap) {
+      size_t new_cap = *cap ? *cap * 2 : 16;
+      JobFile* grown = realloc(*files, new_cap * sizeof(JobFile));
+      if (grown == NULL) {
+        fprintf(stderr, "Failed to allocate memory for job files\n");
+        free(file_path);
+        if (dir) closedir(dir);
+        return 1;
+      }
+      *files = grown;
+      *cap = new_cap;
+    }
+    (*files)[(*num_files)++] = (JobFile){file_path, 0, 0, 0};
+
+    if (!dir) break;
+  }
+
+  if (dir) closedir(dir);
+  return 0;
+}
+
+// Daemon mode (-d) opens its sessions once and keeps them, taking .jobs files from a control pipe
+// instead of the command line, so running many short files doesn't pay for a session setup each.
+// Files are submitted with -s and the daemon is stopped with -q, both through the same pipe.
+
+typedef struct {
+  char jobs_path[MAX_JOB_FILE_NAME_SIZE];  // Absolute, empty asks the daemon to stop
+  char reply_path[MAX_BUFFER_SIZE];        // Pipe the result is written to
+  size_t index;                            // Returned with the result
+} DaemonRequest;  // Smaller than PIPE_BUF, so requests from concurrent submitters never interleave
+
+typedef struct {
+  size_t index;
+  size_t num_ops;
+  double seconds;
+  int failed;
+} DaemonResult;
+
+typedef struct DaemonJob {
+  DaemonRequest request;
+  struct DaemonJob* next;
+} DaemonJob;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t changed;
+  DaemonJob* head;
+  DaemonJob* tail;
+  size_t num_sessions;
+  size_t ready;   // Sessions that finished their setup, successfully or not
+  size_t failed;  // Sessions that could not be set up
+  int stopping;   // Set once no more jobs are queued, sessions quit when the queue is empty
+  const char* req_pipe_path;
+  const char* resp_pipe_path;
+  const char* server_pipe_path;
+  int batch_mode;
+} Daemon;
+
+typedef struct {
+  Daemon* daemon;
+  size_t index;
+} DaemonSession;
+
+/// Sends the result of a job to its submitter. A submitter that went away just misses it.
+static void daemon_reply(const DaemonRequest* request, const DaemonResult* result) {
+  // Non-blocking, so a reply pipe without a reader fails instead of blocking the session
+  int fd = open(request->reply_path, O_WRONLY | O_NONBLOCK);
+  if (fd == -1) return;
+  if (write_all(fd, result, sizeof(*result))) fprintf(stderr, "Failed to reply to %s\n", request->reply_path);
+  close(fd);
+}
+
+/// Runs a .jobs file on the calling thread's session, writing the results next to it as a .out file.
+/// @param connected Whether the thread has a session, the file fails without one.
+static void daemon_run(Daemon* daemon, const DaemonRequest* request, int connected) {
+  DaemonResult result = {request->index, 0, 0, 1};
+  int in_fd, out_fd;
+  if (connected && open_job_file(request->jobs_path, &in_fd, &out_fd) == 0) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Batch batch;
+    batch_init(&batch);
+    result.num_ops = run_jobs(in_fd, out_fd, daemon->batch_mode ? &batch : NULL);
+    batch_free(&batch);
+    result.seconds = elapsed_seconds(&start);
+    result.failed = !ems_connected();
+    if (result.failed) fprintf(stderr, "Session closed by the server while running %s\n", request->jobs_path);
+    close(in_fd);
+    close(out_fd);
+  }
+  daemon_reply(request, &result);
+}
+
+/// Sets up one session and runs queued jobs on it until the daemon stops.
+static void* daemon_session(void* arg) {
+  DaemonSession* session = arg;
+  Daemon* daemon = session->daemon;
+
+  // A single session keeps the given pipe names, several sessions get one pair of pipes each
+  char req_path[MAX_BUFFER_SIZE], resp_path[MAX_BUFFER_SIZE];
+  int req_len, resp_len;
+  if (daemon->num_sessions == 1) {
+    req_len = snprintf(req_path, sizeof(req_path), "%s", daemon->req_pipe_path);
+    resp_len = snprintf(resp_path, sizeof(resp_path), "%s", daemon->resp_pipe_path);
+  } else {
+    req_len = snprintf(req_path, sizeof(req_path), "%s.%zu", daemon->req_pipe_path, session->index);
+    resp_len = snprintf(resp_path, sizeof(resp_path), "%s.%zu", daemon->resp_pipe_path, session->index);
+  }
+  int failed = req_len < 0 || resp_len < 0 || (size_t)req_len >= sizeof(req_path) ||
+               (size_t)resp_len >= sizeof(resp_path);
+  if (failed) {
+    fprintf(stderr, "Pipe paths too long for session %zu\n", session->index);
+  } else if (ems_setup(req_path, resp_path, daemon->server_pipe_path)) {
+    fprintf(stderr, "Failed to set up EMS\n");
+    failed = 1;
+  }
+
+  int connected = !failed;
+  pthread_mutex_lock(&daemon->mutex);
+  daemon->ready++;
+  if (failed) daemon->failed++;
+  pthread_cond_broadcast(&daemon->changed);
+  while (!failed) {
+    while (daemon->head == NULL && !daemon->stopping) pthread_cond_wait(&daemon->changed, &daemon->mutex);
+    DaemonJob* job = daemon->head;
+    if (job == NULL) break;
+    daemon->head = job->next;
+    if (daemon->head == NULL) daemon->tail = NULL;
+    pthread_mutex_unlock(&daemon->mutex);
+
+    // The server may have ended the session meanwhile, such as after its idle timeout
+    if (connected && !ems_connected()) {
+      fprintf(stderr, "Session %zu closed by the server, setting it up again\n", session->index);
+      ems_quit();
+      connected = 0;
+    }
+    if (!connected) {
+      connected = ems_setup(req_path, resp_path, daemon->server_pipe_path) == 0;
+      if (!connected) fprintf(stderr, "Failed to set up EMS\n");
+    }
+    daemon_run(daemon, &job->request, connected);
+    free(job);
+    pthread_mutex_lock(&daemon->mutex);
+  }
+  pthread_mutex_unlock(&daemon->mutex);
+
+  if (connected) ems_quit();
+  return NULL;
+}
+
+/// Runs the daemon: sets up its sessions and queues the jobs read from the control pipe until asked
+/// to stop, then lets the sessions finish the queue and quit.
+/// @return 0 if the daemon ran and stopped cleanly, 1 otherwise.
+static int run_daemon(const char* control_path, Daemon* daemon) {
+  if (mkfifo(control_path, 0640) && errno != EEXIST) {
+    fprintf(stderr, "Failed to create control pipe %s\n", control_path);
+    return 1;
+  }
+  // Also opened for writing, so the pipe never reports end of file in between submitters
+  int control_fd = open(control_path, O_RDWR);
+  if (control_fd == -1) {
+    fprintf(stderr, "Failed to open control pipe %s\n", control_path);
+    unlink(control_path);
+    return 1;
+  }
+
+  DaemonSession* sessions = malloc(daemon->num_sessions * sizeof(DaemonSession));
+  pthread_t* threads = malloc(daemon->num_sessions * sizeof(pthread_t));
+  if (sessions == NULL || threads == NULL) {
+    fprintf(stderr, "Failed to allocate memory for daemon sessions\n");
+    free(sessions);
+    free(threads);
+    close(control_fd);
+    unlink(control_path);
+    return 1;
+  }
+
+  size_t started = 0;
+  for (; started < daemon->num_sessions; started++) {
+    sessions[started] = (DaemonSession){daemon, started};
+    if (pthread_create(&threads[started], NULL, daemon_session, &sessions[started]) != 0) {
+      fprintf(stderr, "Failed to create session thread\n");
+      break;
+    }
+  }
+
+  pthread_mutex_lock(&daemon->mutex);
+  while (daemon->ready < started) pthread_cond_wait(&daemon->changed, &daemon->mutex);
+  int failed = started < daemon->num_sessions || daemon->failed > 0;
+  pthread_mutex_unlock(&daemon->mutex);
+
+  if (!failed) {
+    printf("Daemon listening on %s with %zu sessions\n", control_path, daemon->num_sessions);
+    fflush(stdout);
+  }
+  while (!failed) {
+    DaemonRequest request;
+    if (read_all(control_fd, &request, sizeof(request))) {
+      fprintf(stderr, "Failed to read from control pipe\n");
+      failed = 1;
+      break;
+    }
+    if (request.jobs_path[0] == '\0') break;
+    request.jobs_path[sizeof(request.jobs_path) - 1] = '\0';
+    request.reply_path[sizeof(request.reply_path) - 1] = '\0';
+
+    DaemonJob* job = malloc(sizeof(DaemonJob));
+    if (job == NULL) {
+      DaemonResult result = {request.index, 0, 0, 1};
+      daemon_reply(&request, &result);
+      continue;
+    }
+    job->request = request;
+    job->next = NULL;
+    pthread_mutex_lock(&daemon->mutex);
+    if (daemon->tail) {
+      daemon->tail->next = job;
+    } else {
+      daemon->head = job;
+    }
+    daemon->tail = job;
+    pthread_cond_signal(&daemon->changed);
+    pthread_mutex_unlock(&daemon->mutex);
+  }
+
+  pthread_mutex_lock(&daemon->mutex);
+  daemon->stopping = 1;
+  pthread_cond_broadcast(&daemon->changed);
+  pthread_mutex_unlock(&daemon->mutex);
+  for (size_t i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  // Sessions that failed to set up leave their jobs behind
+  while (daemon->head) {
+    DaemonJob* job = daemon->head;
+    daemon->head = job->next;
+    DaemonResult result = {job->request.index, 0, 0, 1};
+    daemon_reply(&job->request, &result);
+    free(job);
+  }
+
+  free(sessions);
+  free(threads);
+  close(control_fd);
+  unlink(control_path);
+  return failed;
+}
+
+/// Opens the control pipe of a running daemon for writing.
+/// @return The file descriptor, or -1 if no daemon is listening.
+static int open_control_pipe(const char* control_path) {
+  // Non-blocking, so a missing daemon is reported instead of waited for
+  int fd = open(control_path, O_WRONLY | O_NONBLOCK);
+  if (fd == -1) {
+    fprintf(stderr, "No daemon listening on %s\n", control_path);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  return fd;
+}
+
+/// Asks the daemon to stop once the files already submitted have run.
+/// @return 0 if the request was sent, 1 otherwise.
+static int stop_daemon(const char* control_path) {
+  int control_fd = open_control_pipe(control_path);
+  if (control_fd == -1) return 1;
+  DaemonRequest request;
+  memset(&request, 0, sizeof(request));
+  int failed = write_all(control_fd, &request, sizeof(request));
+  if (failed) fprintf(stderr, "Failed to write to control pipe\n");
+  close(control_fd);
+  return failed;
+}
+
+/// Submits every file to the daemon and waits for all of their results.
+/// @return 0 if every result arrived, 1 otherwise.
+static int submit_job_files(const char* control_path, JobFile* files, size_t num_files) {
+  DaemonRequest request;
+  memset(&request, 0, sizeof(request));
+  snprintf(request.reply_path, sizeof(request.reply_path), "/tmp/ems_reply.%ld", (long)getpid());
+  unlink(request.reply_path);  // Left behind by an earlier submitter with the same pid that crashed
+  if (mkfifo(request.reply_path, 0640)) {
+    fprintf(stderr, "Failed to create reply pipe %s\n", request.reply_path);
+    return 1;
+  }
+  // Also opened for writing, so it doesn't report end of file in between replies
+  int reply_fd = open(request.reply_path, O_RDWR);
+  int control_fd = reply_fd == -1 ? -1 : open_control_pipe(control_path);
+  if (control_fd == -1) {
+    if (reply_fd != -1) close(reply_fd);
+    unlink(request.reply_path);
+    return 1;
+  }
+
+  char cwd[MAX_JOB_FILE_NAME_SIZE];
+  if (getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+
+  size_t sent = 0;
+  for (; sent < num_files; sent++) {
+    JobFile* file = &files[sent];
+    file->failed = 1;
+    // The daemon doesn't share this working directory
+    int len = -1;
+    if (file->path[0] == '/') {
+      len = snprintf(request.jobs_path, sizeof(request.jobs_path), "%s", file->path);
+    } else if (cwd[0] != '\0') {
+      len = snprintf(request.jobs_path, sizeof(request.jobs_path), "%s/%s", cwd, file->path);
+    }
+    if (len < 0 || (size_t)len >= sizeof(request.jobs_path)) {
+      fprintf(stderr, "The provided .jobs file path is not valid. Path: %s\n", file->path);
+      continue;
+    }
+    request.index = sent;
+    if (write_all(control_fd, &request, sizeof(request))) {
+      fprintf(stderr, "Failed to write to control pipe\n");
+      break;
+    }
+    file->failed = -1;  // Waiting for its result
+  }
+
+  int failed = sent < num_files;
+  size_t pending = 0;
+  for (size_t i = 0; i < sent; i++) {
+    if (files[i].failed == -1) pending++;
+  }
+  while (pending > 0) {
+    // The control pipe is kept open to watch the daemon: once it exits, the pipe has no reader left
+    // and reports an error, so files it never replied to fail instead of being waited for forever
+    struct pollfd fds[2] = {{reply_fd, POLLIN, 0}, {control_fd, 0, 0}};
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) continue;
+      failed = 1;
+      break;
+    }
+    if (!(fds[0].revents & POLLIN)) {
+      fprintf(stderr, "Daemon on %s exited before running every file\n", control_path);
+      failed = 1;
+      break;
+    }
+
+    DaemonResult result;
+    if (read_all(reply_fd, &result, sizeof(result)) || result.index >= sent || files[result.index].failed != -1) {
+      fprintf(stderr, "Failed to read from reply pipe\n");
+      failed = 1;
+      break;
+    }
+    files[result.index].failed = result.failed;
+    files[result.index].num_ops = result.num_ops;
+    files[result.index].seconds = result.seconds;
+    pending--;
+  }
+  for (size_t i = 0; i < num_files; i++) {
+    if (files[i].failed == -1) files[i].failed = 1;
+  }
+
+  close(control_fd);
+  close(reply_fd);
+  unlink(request.reply_path);
+  return failed;
+}
+
+int main(int argc, char* argv[]) {
+  const char* program = argv[0];
+  const char* daemon_path = NULL;
+  const char* submit_path = NULL;
+  const char* stop_path = NULL;
+  int batch_mode = 0;
+  size_t parallelism = 0;
+  int usage = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "bj:d:s:q:")) != -1) {
+    switch (opt) {
+      case 'b':
+        batch_mode = 1;
+        break;
+      case 'j': {
+        char* endptr;
+        unsigned long value = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || value == 0) usage = 1;
+        parallelism = (size_t)value;
+        break;
+      }
+      case 'd':
+        daemon_path = optarg;
+        break;
+      case 's':
+        submit_path = optarg;
+        break;
+      case 'q':
+        stop_path = optarg;
+        break;
+      default:
+        usage = 1;
+        break;
+    }
+  }
+  // Shift the positional arguments so they keep their usual indexes
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  int modes = (daemon_path != NULL) + (submit_path != NULL) + (stop_path != NULL);
+  if (modes > 1 || (daemon_path && argc != 4) || (submit_path && (argc < 2 || batch_mode || parallelism)) ||
+      (stop_path && (argc != 1 || batch_mode || parallelism)) || (modes == 0 && argc < 5)) {
+    usage = 1;
+  }
+  if (usage) {
+    fprintf(stderr,
+            "Usage: %s [-b] [-j <jobs>] <request pipe path> <response pipe path> <server pipe path> "
+            "<.jobs file or directory>...\n"
+            "       %s -d <control pipe path> [-b] [-j <sessions>] <request pipe path> <response pipe path> "
+            "<server pipe path>\n"
+            "       %s -s <control pipe path> <.jobs file or directory>...\n"
+            "       %s -q <control pipe path>\n"
+            "  -b  compile the .jobs file into batches, one request per WAIT/BARRIER segment\n"
+            "  -j  number of .jobs files run concurrently, each on its own session (default: %d),\n"
+            "      or number of sessions kept open with -d (default: 1)\n"
+            "  -d  run as a daemon that keeps its sessions open and runs the .jobs files submitted with -s\n"
+            "  -s  submit .jobs files to the daemon listening on the control pipe and wait for them\n"
+            "  -q  stop the daemon listening on the control pipe, once the files submitted to it have run\n",
+            program, program, program, program, MAX_SESSION_COUNT);
+    return 1;
+  }
+
+  // A daemon or session that went away shows up as a failed write instead of killing the process
+  if (modes > 0) signal(SIGPIPE, SIG_IGN);
+  if (stop_path) return stop_daemon(stop_path);
+  if (daemon_path) {
+    Daemon daemon = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, parallelism ? parallelism : 1,
+                     0, 0, 0, argv[1], argv[2], argv[3], batch_mode};
+    return run_daemon(daemon_path, &daemon);
+  }
+
+  Runner runner = {NULL, 0, 0, argv[1], argv[2], argv[3], batch_mode};
+  size_t cap = 0;
+  for (int i = submit_path ? 1 : 4; i < argc; i++) {
+    if (collect_job_files(argv[i], &runner.files, &runner.num_files, &cap)) return 1;
+  }
+  if (runner.num_files == 0) {
+    fprintf(stderr, "No .jobs files to run\n");
+    return 1;
+  }
+  qsort(runner.files, runner.num_files, sizeof(JobFile), compare_paths);
+
+  if (parallelism == 0) parallelism = MAX_SESSION_COUNT;
+  if (parallelism > runner.num_files) parallelism = runner.num_files;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int failed = 0;
+  if (submit_path) {
+    failed = submit_job_files(submit_path, runner.files, runner.num_files);
+  } else if (parallelism == 1) {
+    runner_thread(&runner);
+  } else {
+    pthread_t* threads = malloc(parallelism * sizeof(pthread_t));
+    if (threads == NULL) {
+      fprintf(stderr, "Failed to allocate memory for runner threads\n");
+      return 1;
+    }
+    size_t started = 0;
+    for (; started < parallelism; started++) {
+      if (pthread_create(&threads[started], NULL, runner_thread, &runner) != 0) {
+        fprintf(stderr, "Failed to create runner thread\n");
+        break;
+      }
+    }
+    if (started == 0) runner_thread(&runner);
+    for (size_t i = 0; i < started; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    free(threads);
+  }
+  double seconds = elapsed_seconds(&start);
+
+  size_t total_ops = 0;
+  for (size_t i = 0; i < runner.num_files; i++) {
+    JobFile* file = &runner.files[i];
+    if (file->failed) {
+      printf("%s: failed\n", file->path);
+      failed = 1;
+    } else if (runner.num_files > 1) {
+      printf("%s: %zu ops in %.3f s (%.1f ops/s)\n", file->path, file->num_ops, file->seconds,
+             file->seconds > 0 ? (double)file->num_ops / file->seconds : 0.0);
+    }
+    total_ops += file->num_ops;
+    free(file->path);
+  }
+  if (runner.num_files > 1 && submit_path) {
+    printf("Total: %zu files, %zu ops in %.3f s (%.1f ops/s) through %s\n", runner.num_files, total_ops, seconds,
+           seconds > 0 ? (double)total_ops / seconds : 0.0, submit_path);
+  } else if (runner.num_files > 1) {
+    printf("Total: %zu files, %zu ops in %.3f s (%.1f ops/s) with %zu sessions\n", runner.num_files, total_ops,
+           seconds, seconds > 0 ? (double)total_ops / seconds : 0.0, parallelism);
+  }
+  free(runner.files);
+  return failed;
+}
@@ -22,7 +22,21 @@ enum Command get_next(int fd) {
 
   switch (buf[0]) {
     case 'C':
-      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
+      if (read(fd, buf + 1, 1) != 1) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      if (buf[1] == 'O') {
+        if (read(fd, buf + 2, 6) != 6 || strncmp(buf, "CONFIRM ", 8) != 0) {
+          cleanup(fd);
+          return CMD_INVALID;
+        }
+
+        return CMD_CONFIRM;
+      }
+
+      if (read(fd, buf + 2, 5) != 5 || strncmp(buf, "CREATE ", 7) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -38,13 +52,49 @@ enum Command get_next(int fd) {
       return CMD_RESERVE;
 
     case 'S':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
+      if (read(fd, buf + 1, 1) != 1) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      if (buf[1] == 'U') {
+        if (read(fd, buf + 2, 8) != 8 || strncmp(buf, "SUBSCRIBE ", 10) != 0) {
+          cleanup(fd);
+          return CMD_INVALID;
+        }
+
+        return CMD_SUBSCRIBE;
+      }
+
+      if (buf[1] == 'T') {
+        if (read(fd, buf + 2, 3) != 3 || strncmp(buf, "STATS", 5) != 0) {
+          cleanup(fd);
+          return CMD_INVALID;
+        }
+
+        if (read(fd, buf + 5, 1) != 0 && buf[5] != '\n') {
+          cleanup(fd);
+          return CMD_INVALID;
+        }
+
+        return CMD_STATS;
+      }
+
+      if (read(fd, buf + 2, 3) != 3 || strncmp(buf, "SHOW ", 5) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
 
       return CMD_SHOW;
 
+    case 'U':
+      if (read(fd, buf + 1, 11) != 11 || strncmp(buf, "UNSUBSCRIBE ", 12) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      return CMD_UNSUBSCRIBE;
+
     case 'L':
       if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
         cleanup(fd);
@@ -59,15 +109,56 @@ enum Command get_next(int fd) {
       return CMD_LIST_EVENTS;
 
     case 'W':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
+      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT", 4) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      if (buf[4] == 'L') {
+        if (read(fd, buf + 5, 4) != 4 || strncmp(buf, "WAITLIST ", 9) != 0) {
+          cleanup(fd);
+          return CMD_INVALID;
+        }
+
+        return CMD_WAITLIST;
+      }
+
+      if (buf[4] != ' ') {
         cleanup(fd);
         return CMD_INVALID;
       }
 
       return CMD_WAIT;
 
+    case 'B':
+      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "BARRIER", 7) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      if (read(fd, buf + 7, 1) != 0 && buf[7] != '\n') {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      return CMD_BARRIER;
+
     case 'H':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
+      if (read(fd, buf + 1, 1) != 1) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      if (buf[1] == 'O') {
+        if (read(fd, buf + 2, 3) != 3 || strncmp(buf, "HOLD ", 5) != 0) {
+          cleanup(fd);
+          return CMD_INVALID;
+        }
+
+        return CMD_HOLD;
+      }
+
+      if (read(fd, buf + 2, 2) != 2 || strncmp(buf, "HELP", 4) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -79,6 +170,14 @@ enum Command get_next(int fd) {
 
       return CMD_HELP;
 
+    case 'E':
+      if (read(fd, buf + 1, 11) != 11 || strncmp(buf, "EVENT_STATS ", 12) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      return CMD_EVENT_STATS;
+
     case '#':
       cleanup(fd);
       return CMD_EMPTY;
@@ -117,14 +216,11 @@ int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_c
   return 0;
 }
 
-size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, size_t *ys) {
+/// Parses a list of seats, up to the end of the line.
+/// @return Number of coordinates read. 0 on failure.
+static size_t parse_seats(int fd, size_t max, size_t *xs, size_t *ys) {
   char ch;
 
-  if (parse_uint(fd, event_id, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
-    return 0;
-  }
-
   if (read(fd, &ch, 1) != 1 || ch != '[') {
     cleanup(fd);
     return 0;
@@ -176,6 +272,33 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
   return num_coords;
 }
 
+size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, size_t *ys) {
+  char ch;
+
+  if (parse_uint(fd, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(fd);
+    return 0;
+  }
+
+  return parse_seats(fd, max, xs, ys);
+}
+
+size_t parse_hold(int fd, size_t max, unsigned int *event_id, unsigned int *ttl_s, size_t *xs, size_t *ys) {
+  char ch;
+
+  if (parse_uint(fd, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(fd);
+    return 0;
+  }
+
+  if (parse_uint(fd, ttl_s, &ch) != 0 || ch != ' ') {
+    cleanup(fd);
+    return 0;
+  }
+
+  return parse_seats(fd, max, xs, ys);
+}
+
 int parse_show(int fd, unsigned int *event_id) {
   char ch;
 
@@ -187,6 +310,28 @@ int parse_show(int fd, unsigned int *event_id) {
   return 0;
 }
 
+int parse_subscribe(int fd, unsigned int *event_id) { return parse_show(fd, event_id); }
+
+int parse_confirm(int fd, unsigned int *hold_id) { return parse_show(fd, hold_id); }
+
+int parse_waitlist(int fd, unsigned int *event_id, size_t *num_seats) {
+  char ch;
+
+  if (parse_uint(fd, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(fd);
+    return 1;
+  }
+
+  unsigned int u_num_seats;
+  if (parse_uint(fd, &u_num_seats, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+    cleanup(fd);
+    return 1;
+  }
+  *num_seats = (size_t)u_num_seats;
+
+  return 0;
+}
+
 int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
   char ch;
 
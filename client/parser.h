@@ -9,6 +9,14 @@ enum Command {
   CMD_SHOW,
   CMD_LIST_EVENTS,
   CMD_WAIT,
+  CMD_BARRIER,
+  CMD_SUBSCRIBE,
+  CMD_UNSUBSCRIBE,
+  CMD_STATS,
+  CMD_HOLD,
+  CMD_CONFIRM,
+  CMD_WAITLIST,
+  CMD_EVENT_STATS,
   CMD_HELP,
   CMD_EMPTY,
   CMD_INVALID,
@@ -37,12 +45,41 @@ int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_c
 /// @return Number of coordinates read. 0 on failure.
 size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, size_t *ys);
 
-/// Parses a SHOW command.
+/// Parses a HOLD command.
+/// @param fd File descriptor to read from.
+/// @param max Maximum number of coordinates to read.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @param ttl_s Pointer to the variable to store the hold duration, in seconds, in.
+/// @param xs Pointer to the array to store the X coordinates in.
+/// @param ys Pointer to the array to store the Y coordinates in.
+/// @return Number of coordinates read. 0 on failure.
+size_t parse_hold(int fd, size_t max, unsigned int *event_id, unsigned int *ttl_s, size_t *xs, size_t *ys);
+
+/// Parses a SHOW or EVENT_STATS command.
 /// @param fd File descriptor to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @return 0 if the command was parsed successfully, 1 otherwise.
 int parse_show(int fd, unsigned int *event_id);
 
+/// Parses a SUBSCRIBE or UNSUBSCRIBE command.
+/// @param fd File descriptor to read from.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_subscribe(int fd, unsigned int *event_id);
+
+/// Parses a CONFIRM command.
+/// @param fd File descriptor to read from.
+/// @param hold_id Pointer to the variable to store the hold ID in.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_confirm(int fd, unsigned int *hold_id);
+
+/// Parses a WAITLIST command.
+/// @param fd File descriptor to read from.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @param num_seats Pointer to the variable to store the number of seats in.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_waitlist(int fd, unsigned int *event_id, size_t *num_seats);
+
 /// Parses a WAIT command.
 /// @param fd File descriptor to read from.
 /// @param delay Pointer to the variable to store the wait delay in.
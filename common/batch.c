@@ -0,0 +1,172 @@
+#include "batch.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int reserve_space(Batch *batch, size_t extra) {
+  if (batch->len + extra <= batch->cap) {
+    return 0;
+  }
+
+  size_t cap = batch->cap ? batch->cap : 256;
+  while (cap < batch->len + extra) {
+    cap *= 2;
+  }
+
+  char *data = realloc(batch->data, cap);
+  if (!data) {
+    return 1;
+  }
+
+  batch->data = data;
+  batch->cap = cap;
+  return 0;
+}
+
+static void put_u8(Batch *batch, int value) { batch->data[batch->len++] = (char)value; }
+
+static void put_u16(Batch *batch, size_t value) {
+  batch->data[batch->len++] = (char)(value & 0xff);
+  batch->data[batch->len++] = (char)((value >> 8) & 0xff);
+}
+
+static void put_u32(Batch *batch, size_t value) {
+  for (int i = 0; i < 4; i++) {
+    batch->data[batch->len++] = (char)((value >> (8 * i)) & 0xff);
+  }
+}
+
+static size_t get_u16(const char *data) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  return (size_t)bytes[0] | (size_t)bytes[1] << 8;
+}
+
+static uint32_t get_u32(const char *data) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+void batch_init(Batch *batch) {
+  batch->data = NULL;
+  batch->len = 0;
+  batch->cap = 0;
+  batch->num_ops = 0;
+}
+
+void batch_free(Batch *batch) {
+  free(batch->data);
+  batch_init(batch);
+}
+
+void batch_clear(Batch *batch) {
+  batch->len = 0;
+  batch->num_ops = 0;
+}
+
+int batch_add_create(Batch *batch, unsigned int event_id, size_t num_rows, size_t num_cols) {
+  if (num_rows > UINT32_MAX || num_cols > UINT32_MAX || reserve_space(batch, 13)) {
+    return 1;
+  }
+
+  put_u8(batch, BATCH_OP_CREATE);
+  put_u32(batch, event_id);
+  put_u32(batch, num_rows);
+  put_u32(batch, num_cols);
+  batch->num_ops++;
+  return 0;
+}
+
+int batch_add_reserve(Batch *batch, unsigned int event_id, size_t num_seats, const size_t *xs, const size_t *ys) {
+  if (num_seats > UINT16_MAX || reserve_space(batch, 7 + 8 * num_seats)) {
+    return 1;
+  }
+
+  for (size_t i = 0; i < num_seats; i++) {
+    if (xs[i] > UINT32_MAX || ys[i] > UINT32_MAX) {
+      return 1;
+    }
+  }
+
+  put_u8(batch, BATCH_OP_RESERVE);
+  put_u32(batch, event_id);
+  put_u16(batch, num_seats);
+  for (size_t i = 0; i < num_seats; i++) {
+    put_u32(batch, xs[i]);
+    put_u32(batch, ys[i]);
+  }
+  batch->num_ops++;
+  return 0;
+}
+
+int batch_add_show(Batch *batch, unsigned int event_id) {
+  if (reserve_space(batch, 5)) {
+    return 1;
+  }
+
+  put_u8(batch, BATCH_OP_SHOW);
+  put_u32(batch, event_id);
+  batch->num_ops++;
+  return 0;
+}
+
+int batch_add_list(Batch *batch) {
+  if (reserve_space(batch, 1)) {
+    return 1;
+  }
+
+  put_u8(batch, BATCH_OP_LIST);
+  batch->num_ops++;
+  return 0;
+}
+
+int batch_next(const char *data, size_t len, size_t *offset, BatchOp *op, size_t *xs, size_t *ys, size_t max_seats) {
+  size_t pos = *offset;
+  if (pos >= len) {
+    return 1;
+  }
+
+  op->op = (unsigned char)data[pos++];
+  op->event_id = 0;
+  op->num_rows = 0;
+  op->num_cols = 0;
+  op->num_seats = 0;
+
+  switch (op->op) {
+    case BATCH_OP_CREATE:
+      if (len - pos < 12) return 1;
+      op->event_id = get_u32(data + pos);
+      op->num_rows = get_u32(data + pos + 4);
+      op->num_cols = get_u32(data + pos + 8);
+      pos += 12;
+      break;
+
+    case BATCH_OP_RESERVE:
+      if (len - pos < 6) return 1;
+      op->event_id = get_u32(data + pos);
+      op->num_seats = get_u16(data + pos + 4);
+      pos += 6;
+      if (op->num_seats > max_seats || len - pos < 8 * op->num_seats) return 1;
+      for (size_t i = 0; i < op->num_seats; i++) {
+        if (xs) xs[i] = get_u32(data + pos);
+        if (ys) ys[i] = get_u32(data + pos + 4);
+        pos += 8;
+      }
+      break;
+
+    case BATCH_OP_SHOW:
+      if (len - pos < 4) return 1;
+      op->event_id = get_u32(data + pos);
+      pos += 4;
+      break;
+
+    case BATCH_OP_LIST:
+      break;
+
+    default:
+      return 1;
+  }
+
+  *offset = pos;
+  return 0;
+}
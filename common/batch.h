@@ -0,0 +1,75 @@
+#ifndef COMMON_BATCH_H
+#define COMMON_BATCH_H
+
+#include <stddef.h>
+
+// A batch is a compact list of operations sent in a single BATCH request.
+// Every operation starts with a 1-byte opcode (the same codes used by individual requests)
+// followed by little-endian fixed-width fields:
+//   CREATE  : u32 event_id, u32 num_rows, u32 num_cols
+//   RESERVE : u32 event_id, u16 num_seats, num_seats x (u32 x, u32 y)
+//   SHOW    : u32 event_id
+//   LIST    : (no fields)
+// The server answers with an int status for the whole batch and, if it is 0, one response per
+// operation in order, each laid out exactly like the response to the individual request.
+
+#define BATCH_OP_CREATE 3
+#define BATCH_OP_RESERVE 4
+#define BATCH_OP_SHOW 5
+#define BATCH_OP_LIST 6
+
+typedef struct {
+  char *data;      // Encoded operations
+  size_t len;      // Bytes used in data
+  size_t cap;      // Bytes allocated for data
+  size_t num_ops;  // Number of operations encoded
+} Batch;
+
+typedef struct {
+  int op;
+  unsigned int event_id;
+  size_t num_rows;
+  size_t num_cols;
+  size_t num_seats;
+} BatchOp;
+
+/// Initializes an empty batch.
+/// @param batch Batch to initialize.
+void batch_init(Batch *batch);
+
+/// Frees the memory held by a batch.
+/// @param batch Batch to free.
+void batch_free(Batch *batch);
+
+/// Removes every operation from a batch, keeping its memory.
+/// @param batch Batch to clear.
+void batch_clear(Batch *batch);
+
+/// Appends a CREATE operation.
+/// @return 0 if the operation was appended, 1 otherwise.
+int batch_add_create(Batch *batch, unsigned int event_id, size_t num_rows, size_t num_cols);
+
+/// Appends a RESERVE operation.
+/// @return 0 if the operation was appended, 1 otherwise.
+int batch_add_reserve(Batch *batch, unsigned int event_id, size_t num_seats, const size_t *xs, const size_t *ys);
+
+/// Appends a SHOW operation.
+/// @return 0 if the operation was appended, 1 otherwise.
+int batch_add_show(Batch *batch, unsigned int event_id);
+
+/// Appends a LIST operation.
+/// @return 0 if the operation was appended, 1 otherwise.
+int batch_add_list(Batch *batch);
+
+/// Decodes the operation at the given offset.
+/// @param data Encoded operations.
+/// @param len Number of bytes in data.
+/// @param offset Offset of the operation, advanced past it on success.
+/// @param op Decoded operation.
+/// @param xs Array of at least max_seats rows, filled for RESERVE operations. May be NULL.
+/// @param ys Array of at least max_seats columns, filled for RESERVE operations. May be NULL.
+/// @param max_seats Capacity of xs and ys.
+/// @return 0 if an operation was decoded, 1 if it is malformed or truncated.
+int batch_next(const char *data, size_t len, size_t *offset, BatchOp *op, size_t *xs, size_t *ys, size_t max_seats);
+
+#endif  // COMMON_BATCH_H
@@ -2,5 +2,10 @@
 #define STATE_ACCESS_DELAY_US 500000  // 500ms
 #define MAX_JOB_FILE_NAME_SIZE 256
 #define MAX_SESSION_COUNT 8
+#define SESSION_ID_BUSY 0xFFFFFFFFu  // Sent in place of a session id when the server turns a client away
 #define MAX_BUFFER_SIZE 40  // Size of a named pipe name
-                            // One command is 2 names and an integer
\ No newline at end of file
+                            // One command is 2 names and an integer
+#define MAX_BATCH_SIZE (1 << 20)  // Bytes of encoded operations in a single BATCH request
+#define PROTOCOL_V1 1  // Fixed-width fields, spoken by clients that never send a VERSION request
+#define PROTOCOL_V2 2  // CREATE dimensions and RESERVE seats as varints, see common/varint.h
+#define PROTOCOL_VERSION PROTOCOL_V2  // Newest wire format this build speaks
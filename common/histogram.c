@@ -0,0 +1,69 @@
+#include "histogram.h"
+
+#include <string.h>
+
+void histogram_init(Histogram *histogram) {
+  memset(histogram, 0, sizeof(Histogram));
+  histogram->min = UINT64_MAX;
+}
+
+unsigned int histogram_bucket(uint64_t value) {
+  if (value < HISTOGRAM_SUB_BUCKETS) {
+    return (unsigned int)value;
+  }
+
+  // Position of the highest set bit decides the magnitude, the next bits the linear sub-bucket
+  unsigned int magnitude = 63 - (unsigned int)__builtin_clzll(value);
+  unsigned int shift = magnitude - HISTOGRAM_SUB_BUCKET_BITS;
+  unsigned int sub_bucket = (unsigned int)(value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1);
+  return (shift + 1) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t histogram_bucket_limit(unsigned int bucket) {
+  if (bucket < HISTOGRAM_SUB_BUCKETS) {
+    return bucket;
+  }
+
+  unsigned int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+  uint64_t sub_bucket = bucket % HISTOGRAM_SUB_BUCKETS;
+  return ((HISTOGRAM_SUB_BUCKETS + sub_bucket + 1) << shift) - 1;
+}
+
+void histogram_record(Histogram *histogram, uint64_t value) {
+  histogram->counts[histogram_bucket(value)]++;
+  histogram->count++;
+  histogram->sum += value;
+  if (value < histogram->min) histogram->min = value;
+  if (value > histogram->max) histogram->max = value;
+}
+
+void histogram_merge(Histogram *into, const Histogram *from) {
+  for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    into->counts[i] += from->counts[i];
+  }
+  into->count += from->count;
+  into->sum += from->sum;
+  if (from->min < into->min) into->min = from->min;
+  if (from->max > into->max) into->max = from->max;
+}
+
+uint64_t histogram_percentile(const Histogram *histogram, double percentile) {
+  if (histogram->count == 0) {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->count + 0.5);
+  if (rank == 0) rank = 1;
+  if (rank > histogram->count) rank = histogram->count;
+
+  uint64_t seen = 0;
+  for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen >= rank) {
+      uint64_t limit = histogram_bucket_limit(i);
+      return limit < histogram->max ? limit : histogram->max;
+    }
+  }
+
+  return histogram->max;
+}
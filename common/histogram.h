@@ -0,0 +1,51 @@
+#ifndef COMMON_HISTOGRAM_H
+#define COMMON_HISTOGRAM_H
+
+#include <stdint.h>
+
+// Log-linear latency histogram in the style of HdrHistogram: values are grouped by their
+// power of two and each power of two is split into HISTOGRAM_SUB_BUCKETS linear buckets,
+// so any recorded value is reported with a relative error below 1/HISTOGRAM_SUB_BUCKETS.
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+  uint64_t counts[HISTOGRAM_BUCKETS];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+} Histogram;
+
+/// Resets a histogram to hold no values.
+/// @param histogram Histogram to reset.
+void histogram_init(Histogram *histogram);
+
+/// Records a single value.
+/// @param histogram Histogram to record into.
+/// @param value Value to record, usually a latency in nanoseconds.
+void histogram_record(Histogram *histogram, uint64_t value);
+
+/// Adds every value recorded in one histogram to another.
+/// @param into Histogram to add to.
+/// @param from Histogram to add from.
+void histogram_merge(Histogram *into, const Histogram *from);
+
+/// Gets the value at the given percentile.
+/// @param histogram Histogram to query.
+/// @param percentile Percentile in [0, 100].
+/// @return Upper bound of the bucket holding the percentile, 0 if the histogram is empty.
+uint64_t histogram_percentile(const Histogram *histogram, double percentile);
+
+/// Gets the bucket a value is recorded in.
+/// @param value Value to look up.
+/// @return Index into Histogram::counts.
+unsigned int histogram_bucket(uint64_t value);
+
+/// Gets the largest value recorded in a bucket.
+/// @param bucket Index into Histogram::counts.
+/// @return Upper bound of the bucket.
+uint64_t histogram_bucket_limit(unsigned int bucket);
+
+#endif  // COMMON_HISTOGRAM_H
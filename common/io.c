@@ -1,8 +1,11 @@
 #include "io.h"
 
+#include <errno.h>
 #include <limits.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 int parse_uint(int fd, unsigned int *value, char *next) {
@@ -77,3 +80,115 @@ int print_str(int fd, const char *str) {
 
   return 0;
 }
+
+int read_all(int fd, void *buffer, size_t len) {
+  char *bytes = buffer;
+  while (len > 0) {
+    ssize_t read_bytes = read(fd, bytes, len);
+    if (read_bytes == -1 && errno == EINTR) {
+      continue;
+    }
+    if (read_bytes <= 0) {
+      return 1;
+    }
+
+    bytes += read_bytes;
+    len -= (size_t)read_bytes;
+  }
+
+  return 0;
+}
+
+static long long now_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int read_all_timeout(int fd, void *buffer, size_t len, int timeout_ms) {
+  if (timeout_ms <= 0) return read_all(fd, buffer, len);
+
+  char *bytes = buffer;
+  long long deadline = now_ms() + timeout_ms;
+  while (len > 0) {
+    long long remaining = deadline - now_ms();
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int ready = remaining > 0 ? poll(&pfd, 1, (int)remaining) : 0;
+    if (ready == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ready == 0) {
+      errno = ETIMEDOUT;
+      return 1;
+    }
+    if (ready == -1) {
+      return 1;
+    }
+
+    ssize_t read_bytes = read(fd, bytes, len);
+    if (read_bytes == -1 && errno == EINTR) {
+      continue;
+    }
+    if (read_bytes <= 0) {
+      return 1;
+    }
+
+    bytes += read_bytes;
+    len -= (size_t)read_bytes;
+  }
+
+  return 0;
+}
+
+int write_all(int fd, const void *buffer, size_t len) {
+  const char *bytes = buffer;
+  while (len > 0) {
+    ssize_t written = write(fd, bytes, len);
+    if (written == -1 && errno == EINTR) {
+      continue;
+    }
+    if (written == -1) {
+      return 1;
+    }
+
+    bytes += written;
+    len -= (size_t)written;
+  }
+
+  return 0;
+}
+
+int write_all_timeout(int fd, const void *buffer, size_t len, int timeout_ms) {
+  if (timeout_ms <= 0) return write_all(fd, buffer, len);
+
+  const char *bytes = buffer;
+  long long deadline = now_ms() + timeout_ms;
+  while (len > 0) {
+    ssize_t written = write(fd, bytes, len);
+    if (written == -1 && errno == EINTR) {
+      continue;
+    }
+    if (written == -1 && errno == EAGAIN) {
+      // Full pipe: wait for the reader to make room
+      long long remaining = deadline - now_ms();
+      struct pollfd pfd = {fd, POLLOUT, 0};
+      int ready = remaining > 0 ? poll(&pfd, 1, (int)remaining) : 0;
+      if (ready == 0) {
+        errno = ETIMEDOUT;
+        return 1;
+      }
+      if (ready == -1 && errno != EINTR) {
+        return 1;
+      }
+      continue;
+    }
+    if (written == -1) {
+      return 1;
+    }
+
+    bytes += written;
+    len -= (size_t)written;
+  }
+
+  return 0;
+}
@@ -1,6 +1,8 @@
 #ifndef COMMON_IO_H
 #define COMMON_IO_H
 
+#include <stddef.h>
+
 /// Parses an unsigned integer from the given file descriptor.
 /// @param fd The file descriptor to read from.
 /// @param value Pointer to the variable to store the value in.
@@ -20,4 +22,35 @@ int print_uint(int fd, unsigned int value);
 /// @return 0 if the string was written successfully, 1 otherwise.
 int print_str(int fd, const char *str);
 
+/// Reads exactly len bytes from the given file descriptor, retrying on short reads.
+/// @param fd The file descriptor to read from.
+/// @param buffer The buffer to store the bytes in.
+/// @param len Number of bytes to read.
+/// @return 0 if all bytes were read, 1 on error or end of file.
+int read_all(int fd, void *buffer, size_t len);
+
+/// Reads exactly len bytes from the given file descriptor, giving up if they don't all arrive in time.
+/// @param fd The file descriptor to read from.
+/// @param buffer The buffer to store the bytes in.
+/// @param len Number of bytes to read.
+/// @param timeout_ms Time allowed for the whole read, 0 or less waits forever like read_all().
+/// @return 0 if all bytes were read, 1 on error, end of file or timeout (with errno set to ETIMEDOUT).
+int read_all_timeout(int fd, void *buffer, size_t len, int timeout_ms);
+
+/// Writes exactly len bytes to the given file descriptor, retrying on short writes.
+/// @param fd The file descriptor to write to.
+/// @param buffer The bytes to write.
+/// @param len Number of bytes to write.
+/// @return 0 if all bytes were written, 1 otherwise.
+int write_all(int fd, const void *buffer, size_t len);
+
+/// Writes exactly len bytes to the given non-blocking file descriptor, giving up if the reader
+/// doesn't make room for them in time.
+/// @param fd The file descriptor to write to, with O_NONBLOCK set.
+/// @param buffer The bytes to write.
+/// @param len Number of bytes to write.
+/// @param timeout_ms Time allowed for the whole write, 0 or less retries forever like write_all().
+/// @return 0 if all bytes were written, 1 on error or timeout (with errno set to ETIMEDOUT).
+int write_all_timeout(int fd, const void *buffer, size_t len, int timeout_ms);
+
 #endif  // COMMON_IO_H
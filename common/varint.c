@@ -0,0 +1,28 @@
+#include "varint.h"
+
+size_t varint_encode(char *buffer, size_t value) {
+  size_t len = 0;
+  while (value >= 0x80) {
+    buffer[len++] = (char)((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  buffer[len++] = (char)value;
+  return len;
+}
+
+int varint_decode(const char *data, size_t len, size_t *offset, size_t *value) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  size_t result = 0;
+  for (unsigned int shift = 0, i = 0; *offset + i < len && i < VARINT_MAX_BYTES; shift += 7, i++) {
+    size_t byte = bytes[*offset + i];
+    // The last byte of a 64-bit value only has room for its top bit
+    if (shift == 63 && byte > 1) return 1;
+    result |= (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *offset += i + 1;
+      *value = result;
+      return 0;
+    }
+  }
+  return 1;
+}
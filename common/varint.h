@@ -0,0 +1,25 @@
+#ifndef COMMON_VARINT_H
+#define COMMON_VARINT_H
+
+#include <stddef.h>
+
+// LEB128 varints: 7 bits of the value per byte, least significant first, with the top bit set on
+// every byte but the last. Seat coordinates and venue sizes below 128 take a single byte.
+
+#define VARINT_MAX_BYTES 10  // Longest encoding of a 64-bit value
+
+/// Encodes a value.
+/// @param buffer Buffer with room for at least VARINT_MAX_BYTES bytes.
+/// @param value Value to encode.
+/// @return Number of bytes written.
+size_t varint_encode(char *buffer, size_t value);
+
+/// Decodes a value.
+/// @param data Encoded bytes.
+/// @param len Number of bytes in data.
+/// @param offset Position of the varint in data, advanced past it.
+/// @param value Pointer to store the value in.
+/// @return 0 if a value was decoded, 1 if the varint is truncated or too long for a size_t.
+int varint_decode(const char *data, size_t len, size_t *offset, size_t *value);
+
+#endif  // COMMON_VARINT_H
@@ -0,0 +1,90 @@
+#include "admission.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common/constants.h"
+#include "log.h"
+#include "stats.h"
+
+typedef struct {
+  int fd;
+  uint64_t sent_at;
+} BusyResponse;
+
+// Only used by the accept loop, so none of this is shared between threads
+static unsigned int max_sessions = DEFAULT_MAX_SESSIONS;
+static unsigned int max_pending = DEFAULT_MAX_PENDING;
+static const char* priority_prefix = NULL;
+static BusyResponse lingering[ADMISSION_MAX_LINGER];
+static size_t num_lingering = 0;
+static unsigned long rejected = 0;
+
+/// Closes the busy responses that were read by their client or waited too long.
+static void reap_lingering(void) {
+  uint64_t now = stats_now();
+  for (size_t i = num_lingering; i > 0; i--) {
+    BusyResponse* busy = &lingering[i - 1];
+    // The pipe is also open for reading on our side, so POLLIN means the id is still unread
+    struct pollfd pfd = {busy->fd, POLLIN, 0};
+    int unread = poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+    if (unread && now - busy->sent_at < (uint64_t)ADMISSION_LINGER_MS * 1000000) continue;
+    close(busy->fd);
+    *busy = lingering[--num_lingering];
+  }
+}
+
+void admission_init(unsigned int sessions, unsigned int pending, const char* prefix) {
+  max_sessions = sessions;
+  max_pending = pending;
+  priority_prefix = prefix;
+}
+
+enum AdmissionDecision admission_decide(const char* requests_path, unsigned int active, unsigned int pending) {
+  reap_lingering();
+  if (priority_prefix && strncmp(requests_path, priority_prefix, strlen(priority_prefix)) == 0) {
+    return ADMIT_PRIORITY;
+  }
+  if (active >= max_sessions || pending >= max_pending) return REJECT;
+  return ADMIT;
+}
+
+void admission_reject(const char* responses_path) {
+  rejected++;
+  log_msg(LOG_WARN, "Server busy, rejected a connection (%lu so far)\n", rejected);
+
+  // Opening a FIFO for both reading and writing never waits for the other end on Linux, and
+  // keeping it open holds the id in the pipe until the client gets around to opening it
+  int fd = open(responses_path, O_RDWR | O_NONBLOCK);
+  if (fd == -1) {
+    log_msg(LOG_ERROR, "Failed to open response pipe %s\n", responses_path);
+    return;
+  }
+  unsigned int busy = SESSION_ID_BUSY;
+  if (write(fd, &busy, sizeof(unsigned int)) != sizeof(unsigned int)) {
+    log_msg(LOG_ERROR, "Failed to write busy response\n");
+    close(fd);
+    return;
+  }
+
+  if (num_lingering == ADMISSION_MAX_LINGER) {
+    size_t oldest = 0;
+    for (size_t i = 1; i < num_lingering; i++) {
+      if (lingering[i].sent_at < lingering[oldest].sent_at) oldest = i;
+    }
+    close(lingering[oldest].fd);
+    lingering[oldest] = lingering[--num_lingering];
+  }
+  lingering[num_lingering].fd = fd;
+  lingering[num_lingering].sent_at = stats_now();
+  num_lingering++;
+}
+
+void admission_stop(void) {
+  while (num_lingering > 0) {
+    close(lingering[--num_lingering].fd);
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef SERVER_ADMISSION_H
+#define SERVER_ADMISSION_H
+
+#define DEFAULT_MAX_SESSIONS 256  // Open sessions before new clients are turned away
+#define DEFAULT_MAX_PENDING 32    // Sessions waiting for their client to open the pipes
+#define ADMISSION_LINGER_MS 5000  // How long a busy response is kept for a client that never reads it
+#define ADMISSION_MAX_LINGER 64   // Busy responses kept at once, the oldest is dropped first
+
+enum AdmissionDecision {
+  ADMIT,           // Within the limits
+  ADMIT_PRIORITY,  // From a priority client, admitted regardless of the limits
+  REJECT,          // Over a limit, the client gets SESSION_ID_BUSY
+};
+
+/// Sets the limits new sessions are checked against. Must be called before any other function.
+/// @param max_sessions Open sessions, including those still being opened.
+/// @param max_pending Sessions whose pipes are still being opened by a worker.
+/// @param priority_prefix Clients whose request pipe path starts with this prefix bypass the
+///                        limits and have their requests served ahead of other sessions. NULL
+///                        disables priority.
+void admission_init(unsigned int max_sessions, unsigned int max_pending, const char* priority_prefix);
+
+/// Decides whether a connection request is admitted.
+/// @param requests_path Request pipe path sent by the client.
+/// @param active Sessions currently open or being opened.
+/// @param pending Sessions currently being opened.
+/// @return The decision, see enum AdmissionDecision.
+enum AdmissionDecision admission_decide(const char* requests_path, unsigned int active, unsigned int pending);
+
+/// Turns a client away by sending SESSION_ID_BUSY in place of its session id. Never blocks: the
+/// response pipe is kept open until the client reads it, or for ADMISSION_LINGER_MS.
+/// @param responses_path Response pipe path sent by the client.
+void admission_reject(const char* responses_path);
+
+/// Closes every busy response still waiting for its client.
+void admission_stop(void);
+
+#endif  // SERVER_ADMISSION_H
@@ -0,0 +1,121 @@
+#include "batch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/batch.h"
+#include "common/constants.h"
+#include "common/io.h"
+#include "operations.h"
+#include "stats.h"
+
+#define BATCH_FLUSH_SIZE (64 * 1024)  // Responses are written once this many bytes are pending
+
+typedef struct {
+  int fd;
+  char* data;
+  size_t len;
+  size_t cap;
+  int failed;
+} ResponseBuffer;
+
+static void write_responses(ResponseBuffer* out, const void* bytes, size_t len) {
+  uint64_t start = stats_now();
+  if (write_all(out->fd, bytes, len) != 0) out->failed = 1;
+  stats_record(STAT_IO_WRITE, stats_now() - start);
+}
+
+static void flush_responses(ResponseBuffer* out) {
+  if (!out->failed && out->len > 0) write_responses(out, out->data, out->len);
+  out->len = 0;
+}
+
+static void append_response(ResponseBuffer* out, const void* bytes, size_t len) {
+  if (out->failed) return;
+
+  if (out->len + len > out->cap) {
+    flush_responses(out);
+    // Large payloads (a big SHOW) skip the buffer instead of growing it
+    if (len > out->cap) {
+      write_responses(out, bytes, len);
+      return;
+    }
+  }
+  memcpy(out->data + out->len, bytes, len);
+  out->len += len;
+}
+
+int execute_batch(int responses, const char* data, size_t len, size_t num_ops) {
+  size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+  BatchOp op;
+
+  // Validate the whole batch first, so a malformed one has no partial effects
+  size_t offset = 0, count = 0;
+  while (offset < len) {
+    if (batch_next(data, len, &offset, &op, NULL, NULL, MAX_RESERVATION_SIZE) != 0) break;
+    count++;
+  }
+  int status = offset != len || count != num_ops;
+  if (status != 0) {
+    return write_all(responses, &status, sizeof(int));
+  }
+
+  ResponseBuffer out = {responses, malloc(BATCH_FLUSH_SIZE), 0, BATCH_FLUSH_SIZE, 0};
+  if (!out.data) {
+    out.cap = 0;
+  }
+  append_response(&out, &status, sizeof(int));
+
+  offset = 0;
+  for (size_t i = 0; i < num_ops && !out.failed; i++) {
+    batch_next(data, len, &offset, &op, xs, ys, MAX_RESERVATION_SIZE);
+    int ret_val = 0;
+    switch (op.op) {
+      case BATCH_OP_CREATE:
+        ret_val = ems_create(op.event_id, op.num_rows, op.num_cols);
+        append_response(&out, &ret_val, sizeof(int));
+        break;
+
+      case BATCH_OP_RESERVE:
+        ret_val = ems_reserve(op.event_id, op.num_seats, xs, ys);
+        append_response(&out, &ret_val, sizeof(int));
+        break;
+
+      case BATCH_OP_SHOW: {
+        size_t num_rows, num_cols;
+        unsigned int* seats;
+        ret_val = ems_show(op.event_id, &num_rows, &num_cols, &seats);
+        append_response(&out, &ret_val, sizeof(int));
+        if (ret_val == 0) {
+          append_response(&out, &num_rows, sizeof(size_t));
+          append_response(&out, &num_cols, sizeof(size_t));
+          append_response(&out, seats, sizeof(unsigned int) * num_rows * num_cols);
+        }
+        break;
+      }
+
+      case BATCH_OP_LIST: {
+        size_t num_events;
+        unsigned int* event_ids = NULL;
+        size_t* occupancy = NULL;
+        ret_val = ems_list_events(&num_events, &event_ids, &occupancy);
+        append_response(&out, &ret_val, sizeof(int));
+        if (ret_val == 0) {
+          append_response(&out, &num_events, sizeof(size_t));
+          if (num_events > 0) {
+            append_response(&out, event_ids, sizeof(unsigned int) * num_events);
+            append_response(&out, occupancy, sizeof(size_t) * 2 * num_events);
+            free(event_ids);
+            free(occupancy);
+          }
+        }
+        break;
+      }
+    }
+    if (ret_val != 0) stats_record_error();
+  }
+
+  flush_responses(&out);
+  free(out.data);
+  return out.failed;
+}
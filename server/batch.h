@@ -0,0 +1,16 @@
+#ifndef SERVER_BATCH_H
+#define SERVER_BATCH_H
+
+#include <stddef.h>
+
+/// Validates and runs a batch of operations, streaming the responses to the given pipe.
+/// Writes an int status first: 1 if the batch is malformed (nothing is executed), 0 otherwise,
+/// followed by one response per operation in order.
+/// @param responses File descriptor of the response pipe.
+/// @param data Encoded operations, see common/batch.h.
+/// @param len Number of bytes in data.
+/// @param num_ops Number of operations announced by the client.
+/// @return 0 if every response was written, 1 if writing to the pipe failed.
+int execute_batch(int responses, const char* data, size_t len, size_t num_ops);
+
+#endif  // SERVER_BATCH_H
@@ -0,0 +1,153 @@
+#include "dump.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common/io.h"
+#include "log.h"
+#include "operations.h"
+
+typedef struct {
+  int fd;
+  int failed;
+  int binary;
+  size_t num_events;
+  size_t len;
+  char* data;
+} DumpBuffer;
+
+static pthread_t dump_thread;
+static atomic_int dump_running = 0;
+static const char* dump_path = NULL;
+static int dump_binary = 0;
+
+static void flush_dump(DumpBuffer* out) {
+  if (!out->failed && out->len > 0 && write_all(out->fd, out->data, out->len) != 0) {
+    out->failed = 1;
+  }
+  out->len = 0;
+}
+
+static void append_bytes(DumpBuffer* out, const void* bytes, size_t len) {
+  while (len > 0) {
+    if (out->len == DUMP_BUFFER_SIZE) flush_dump(out);
+    size_t chunk = DUMP_BUFFER_SIZE - out->len < len ? DUMP_BUFFER_SIZE - out->len : len;
+    memcpy(out->data + out->len, bytes, chunk);
+    out->len += chunk;
+    bytes = (const char*)bytes + chunk;
+    len -= chunk;
+  }
+}
+
+/// Appends the decimal digits of a number, without going through printf.
+static void append_uint(DumpBuffer* out, size_t value) {
+  char digits[24];
+  size_t i = sizeof(digits);
+  do {
+    digits[--i] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+  append_bytes(out, digits + i, sizeof(digits) - i);
+}
+
+static int dump_event(unsigned int event_id, size_t num_rows, size_t num_cols, const unsigned int* seats, void* arg) {
+  DumpBuffer* out = arg;
+  out->num_events++;
+
+  if (out->binary) {
+    append_bytes(out, &event_id, sizeof(unsigned int));
+    append_bytes(out, &num_rows, sizeof(size_t));
+    append_bytes(out, &num_cols, sizeof(size_t));
+    append_bytes(out, seats, sizeof(unsigned int) * num_rows * num_cols);
+    return out->failed;
+  }
+
+  append_bytes(out, "Event ID: ", 10);
+  append_uint(out, event_id);
+  append_bytes(out, "\n", 1);
+  for (size_t i = 0; i < num_rows; i++) {
+    // A full row is formatted in place when it fits, which is the common case
+    if (DUMP_BUFFER_SIZE - out->len < num_cols * 11 + 1) flush_dump(out);
+    for (size_t j = 0; j < num_cols; j++) {
+      append_uint(out, seats[i * num_cols + j]);
+      if (j < num_cols - 1) append_bytes(out, " ", 1);
+    }
+    append_bytes(out, "\n", 1);
+  }
+  append_bytes(out, "\n", 1);
+  return out->failed;
+}
+
+/// Writes one dump of the whole state.
+static void write_dump(void) {
+  DumpBuffer out = {STDOUT_FILENO, 0, dump_binary, 0, 0, malloc(DUMP_BUFFER_SIZE)};
+  if (!out.data) {
+    log_msg(LOG_ERROR, "Failed to allocate dump buffer\n");
+    return;
+  }
+  if (dump_path) {
+    out.fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    if (out.fd == -1) {
+      log_msg(LOG_ERROR, "Failed to open dump file %s\n", dump_path);
+      free(out.data);
+      return;
+    }
+  }
+
+  if (dump_binary) {
+    append_bytes(&out, DUMP_MAGIC, strlen(DUMP_MAGIC));
+  } else {
+    const char* header = "Displaying all event information...\n";
+    append_bytes(&out, header, strlen(header));
+  }
+  int ret = ems_snapshot_events(dump_event, &out);
+  flush_dump(&out);
+
+  if (ret != 0 || out.failed) {
+    log_msg(LOG_ERROR, "Failed to dump events\n");
+  } else {
+    log_msg(LOG_INFO, "Dumped %zu events\n", out.num_events);
+  }
+  if (dump_path) close(out.fd);
+  free(out.data);
+}
+
+static void* dump_thread_main(void* arg) {
+  (void)arg;
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+
+  while (atomic_load(&dump_running)) {
+    int sign;
+    if (sigwait(&set, &sign) != 0) continue;
+    if (!atomic_load(&dump_running)) break;  // Woken up by dump_stop()
+    log_msg(LOG_INFO, "Received SIGUSR1. Listing all events...\n");
+    write_dump();
+  }
+  return NULL;
+}
+
+int dump_start(const char* path, int binary) {
+  dump_path = path;
+  dump_binary = binary;
+  atomic_store(&dump_running, 1);
+  if (pthread_create(&dump_thread, NULL, dump_thread_main, NULL) != 0) {
+    atomic_store(&dump_running, 0);
+    fprintf(stderr, "Failed to create dump thread\n");
+    return 1;
+  }
+  return 0;
+}
+
+void dump_stop(void) {
+  if (!atomic_exchange(&dump_running, 0)) return;
+  pthread_kill(dump_thread, SIGUSR1);
+  pthread_join(dump_thread, NULL);
+}
@@ -0,0 +1,19 @@
+#ifndef SERVER_DUMP_H
+#define SERVER_DUMP_H
+
+#define DUMP_BUFFER_SIZE (1 << 20)  // Output is written in chunks of this size
+#define DUMP_MAGIC "EMSDUMP1"       // First bytes of a binary dump
+
+/// Starts the thread that dumps the whole state every time the process receives SIGUSR1.
+/// SIGUSR1 must be blocked in every thread before this is called, the dump thread waits for it
+/// with sigwait() so no signal handler is involved.
+/// @param path File to write each dump to, truncating it first. NULL writes to stdout.
+/// @param binary If set, events are written as the magic followed by, for each event, its id,
+///               rows and columns and the seats, using the same types as the SHOW response.
+/// @return 0 if the thread was started, 1 otherwise.
+int dump_start(const char* path, int binary);
+
+/// Stops the dump thread, waiting for a dump in progress to finish.
+void dump_stop(void);
+
+#endif  // SERVER_DUMP_H
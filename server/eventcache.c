@@ -0,0 +1,66 @@
+#include "eventcache.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef struct {
+  _Alignas(64) _Atomic(struct Event*) events[EVENT_CACHE_WAYS];
+  atomic_uchar referenced[EVENT_CACHE_WAYS];  // Set on every hit, cleared as the hand sweeps past
+  unsigned int hand;                          // Next way to consider for eviction, protected by insert_mutex
+} CacheSet;
+
+static CacheSet sets[EVENT_CACHE_SETS];
+// Inserts only happen after a miss, which already paid for the costly state access, so a single
+// lock for them is never the bottleneck. Lookups take no lock at all.
+static pthread_mutex_t insert_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static CacheSet* set_of(unsigned int event_id) {
+  // Fibonacci hashing, so clustered ids spread over the sets
+  return &sets[((event_id * 2654435761u) >> 16) & (EVENT_CACHE_SETS - 1)];
+}
+
+struct Event* event_cache_lookup(unsigned int event_id) {
+  CacheSet* set = set_of(event_id);
+  for (size_t i = 0; i < EVENT_CACHE_WAYS; i++) {
+    struct Event* event = atomic_load_explicit(&set->events[i], memory_order_acquire);
+    if (event && event->id == event_id) {
+      // Skip the store when the bit is already set, so hot entries don't bounce between cores
+      if (!atomic_load_explicit(&set->referenced[i], memory_order_relaxed)) {
+        atomic_store_explicit(&set->referenced[i], 1, memory_order_relaxed);
+      }
+      return event;
+    }
+  }
+  return NULL;
+}
+
+void event_cache_insert(struct Event* event) {
+  CacheSet* set = set_of(event->id);
+  pthread_mutex_lock(&insert_mutex);
+  for (size_t i = 0; i < EVENT_CACHE_WAYS; i++) {
+    // Two threads may miss on the same event at once, only one entry is kept
+    if (atomic_load_explicit(&set->events[i], memory_order_relaxed) == event) {
+      pthread_mutex_unlock(&insert_mutex);
+      return;
+    }
+  }
+  while (atomic_exchange_explicit(&set->referenced[set->hand], 0, memory_order_relaxed)) {
+    set->hand = (set->hand + 1) % EVENT_CACHE_WAYS;
+  }
+  atomic_store_explicit(&set->events[set->hand], event, memory_order_release);
+  set->hand = (set->hand + 1) % EVENT_CACHE_WAYS;
+  pthread_mutex_unlock(&insert_mutex);
+}
+
+void event_cache_clear(void) {
+  pthread_mutex_lock(&insert_mutex);
+  for (size_t s = 0; s < EVENT_CACHE_SETS; s++) {
+    for (size_t i = 0; i < EVENT_CACHE_WAYS; i++) {
+      atomic_store_explicit(&sets[s].events[i], NULL, memory_order_relaxed);
+      atomic_store_explicit(&sets[s].referenced[i], 0, memory_order_relaxed);
+    }
+    sets[s].hand = 0;
+  }
+  pthread_mutex_unlock(&insert_mutex);
+}
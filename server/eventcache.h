@@ -0,0 +1,25 @@
+#ifndef SERVER_EVENT_CACHE_H
+#define SERVER_EVENT_CACHE_H
+
+#include "eventlist.h"
+
+#define EVENT_CACHE_SETS 64  // Must be a power of two
+#define EVENT_CACHE_WAYS 4   // Entries per set, replaced in CLOCK order
+
+/// Looks up an event among the recently used ones, without going through the event list.
+/// @note Must be called with the event list locked, for reading or writing.
+/// @param event_id Event id.
+/// @return Pointer to the event if it is cached, NULL otherwise.
+struct Event* event_cache_lookup(unsigned int event_id);
+
+/// Caches an event, evicting the least recently referenced entry of its set if needed.
+/// Only existing events are cached, so an entry can't go stale until the list is freed.
+/// @note Must be called with the event list locked, for reading or writing.
+/// @param event Event to cache.
+void event_cache_insert(struct Event* event);
+
+/// Forgets every cached event.
+/// @note Must be called with the event list locked for writing, before its events are freed.
+void event_cache_clear(void);
+
+#endif  // SERVER_EVENT_CACHE_H
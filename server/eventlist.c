@@ -1,7 +1,11 @@
+#define _GNU_SOURCE  // MADV_HUGEPAGE
 #include "eventlist.h"
 
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 struct EventList* create_list() {
   struct EventList* list = (struct EventList*)malloc(sizeof(struct EventList));
@@ -10,65 +14,188 @@ struct EventList* create_list() {
     free(list);
     return NULL;
   }
-  list->head = NULL;
-  list->tail = NULL;
+  list->events = NULL;
+  list->num_events = 0;
+  list->capacity = 0;
+  list->index = calloc(EVENT_INDEX_MIN_SLOTS, sizeof(struct Event*));
+  list->index_capacity = EVENT_INDEX_MIN_SLOTS;
+  list->slabs = NULL;
+  if (!list->index) {
+    pthread_rwlock_destroy(&list->rwl);
+    free(list);
+    return NULL;
+  }
   return list;
 }
 
-int append_to_list(struct EventList* list, struct Event* event) {
-  if (!list) return 1;
+static size_t index_slot(unsigned int event_id, size_t capacity) {
+  // Fibonacci hashing, so clustered ids spread over the index
+  return (size_t)(event_id * 2654435761u) & (capacity - 1);
+}
+
+static void index_insert(struct Event** index, size_t capacity, struct Event* event) {
+  size_t slot = index_slot(event->id, capacity);
+  while (index[slot]) slot = (slot + 1) & (capacity - 1);
+  index[slot] = event;
+}
 
-  struct ListNode* new_node = (struct ListNode*)malloc(sizeof(struct ListNode));
-  if (!new_node) return 1;
+struct Event* alloc_event(struct EventList* list) {
+  if (!list) return NULL;
+  if (!list->slabs || list->slabs->used == EVENT_SLAB_SIZE) {
+    struct EventSlab* slab;
+    if (posix_memalign((void**)&slab, CACHE_LINE_SIZE, sizeof(struct EventSlab)) != 0) return NULL;
+    slab->next = list->slabs;
+    slab->used = 0;
+    list->slabs = slab;
+  }
+  struct Event* event = &list->slabs->events[list->slabs->used];
+  memset(event, 0, sizeof(struct Event));
+  return event;
+}
 
-  new_node->event = event;
-  new_node->next = NULL;
+int append_to_list(struct EventList* list, struct Event* event) {
+  if (!list || !list->slabs || event != &list->slabs->events[list->slabs->used]) return 1;
+
+  if (list->num_events == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : EVENT_SLAB_SIZE;
+    struct Event** events = realloc(list->events, sizeof(struct Event*) * capacity);
+    if (!events) return 1;
+    list->events = events;
+    list->capacity = capacity;
+  }
 
-  if (list->head == NULL) {
-    list->head = new_node;
-    list->tail = new_node;
-  } else {
-    list->tail->next = new_node;
-    list->tail = new_node;
+  if (2 * (list->num_events + 1) > list->index_capacity) {
+    size_t capacity = list->index_capacity * 2;
+    struct Event** index = calloc(capacity, sizeof(struct Event*));
+    if (!index) return 1;
+    for (size_t i = 0; i < list->num_events; i++) index_insert(index, capacity, list->events[i]);
+    free(list->index);
+    list->index = index;
+    list->index_capacity = capacity;
   }
 
+  index_insert(list->index, list->index_capacity, event);
+  list->events[list->num_events++] = event;
+  list->slabs->used++;
   return 0;
 }
 
+void* alloc_seats(size_t size) {
+  size_t alignment = size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : CACHE_LINE_SIZE;
+  size = (size + alignment - 1) / alignment * alignment;
+  if (size == 0) size = alignment;
+
+  void* seats;
+  if (posix_memalign(&seats, alignment, size) != 0) return NULL;
+#ifdef MADV_HUGEPAGE
+  // Only a hint, the seats work the same if the kernel can't back them with huge pages
+  if (alignment == HUGE_PAGE_SIZE) madvise(seats, size, MADV_HUGEPAGE);
+#endif
+  memset(seats, 0, size);
+  return seats;
+}
+
 static void free_event(struct Event* event) {
   if (!event) return;
   free(event->data);
-  free(event);
+  free(event->row_occupied);
+  free(atomic_load(&event->combining));
+  while (event->waitlist) {
+    struct WaitEntry* entry = event->waitlist;
+    event->waitlist = entry->next;
+    free(entry);
+  }
 }
 
-void free_list(struct EventList* list) {
-  if (!list) return;
+int alloc_events(struct EventList* list, size_t count, struct Event** events) {
+  if (!list) return 1;
+
+  // Slabs are linked up front, newest first, and only pushed onto the list once all of them exist
+  struct EventSlab* slabs = NULL;
+  struct EventSlab* oldest = NULL;
+  for (size_t i = 0; i < count; i += EVENT_SLAB_SIZE) {
+    struct EventSlab* slab;
+    if (posix_memalign((void**)&slab, CACHE_LINE_SIZE, sizeof(struct EventSlab)) != 0) {
+      while (slabs) {
+        slab = slabs;
+        slabs = slab->next;
+        free(slab);
+      }
+      return 1;
+    }
+    slab->next = slabs;
+    slab->used = count - i < EVENT_SLAB_SIZE ? count - i : EVENT_SLAB_SIZE;
+    memset(slab->events, 0, sizeof(struct Event) * slab->used);
+    for (size_t j = 0; j < slab->used; j++) events[i + j] = &slab->events[j];
+    if (!oldest) oldest = slab;
+    slabs = slab;
+  }
+  if (oldest) {
+    oldest->next = list->slabs;
+    list->slabs = slabs;
+  }
+  return 0;
+}
 
-  struct ListNode* current = list->head;
-  while (current) {
-    struct ListNode* temp = current;
-    current = current->next;
+int append_events(struct EventList* list, struct Event** events, size_t count, size_t* left_out) {
+  if (!list) return 1;
 
-    free_event(temp->event);
-    free(temp);
+  size_t num_events = list->num_events + count;
+  if (num_events > list->capacity) {
+    size_t capacity = list->capacity ? list->capacity : EVENT_SLAB_SIZE;
+    while (capacity < num_events) capacity *= 2;
+    struct Event** grown = realloc(list->events, sizeof(struct Event*) * capacity);
+    if (!grown) return 1;
+    list->events = grown;
+    list->capacity = capacity;
   }
 
-  free(list);
+  if (2 * num_events > list->index_capacity) {
+    size_t capacity = list->index_capacity;
+    while (2 * num_events > capacity) capacity *= 2;
+    struct Event** index = calloc(capacity, sizeof(struct Event*));
+    if (!index) return 1;
+    for (size_t i = 0; i < list->num_events; i++) index_insert(index, capacity, list->events[i]);
+    free(list->index);
+    list->index = index;
+    list->index_capacity = capacity;
+  }
+
+  *left_out = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (!events[i]) continue;
+    if (get_event(list, events[i]->id)) {
+      free_event(events[i]);
+      events[i] = NULL;
+      (*left_out)++;
+      continue;
+    }
+    index_insert(list->index, list->index_capacity, events[i]);
+    list->events[list->num_events++] = events[i];
+  }
+  return 0;
 }
 
-struct Event* get_event(struct EventList* list, unsigned int event_id, struct ListNode* from, struct ListNode* to) {
-  if (!list || !from || !to) return NULL;
-  struct ListNode* current = from;
+void free_list(struct EventList* list) {
+  if (!list) return;
 
-  while (1) {
-    if (current->event->id == event_id) {
-      return current->event;
-    }
+  for (size_t i = 0; i < list->num_events; i++) free_event(list->events[i]);
+  while (list->slabs) {
+    struct EventSlab* slab = list->slabs;
+    list->slabs = slab->next;
+    free(slab);
+  }
+  free(list->events);
+  free(list->index);
+  pthread_rwlock_destroy(&list->rwl);
+  free(list);
+}
 
-    if (current == to) {
-      return NULL;
-    }
+struct Event* get_event(struct EventList* list, unsigned int event_id) {
+  if (!list) return NULL;
 
-    current = current->next;
+  for (size_t slot = index_slot(event_id, list->index_capacity);; slot = (slot + 1) & (list->index_capacity - 1)) {
+    struct Event* event = list->index[slot];
+    if (!event || event->id == event_id) return event;
   }
 }
@@ -2,52 +2,123 @@
 #define SERVER_EVENT_LIST_H
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
 
+#define COMBINE_SLOTS 32            // Reservations that can wait on a hot event at once
+#define CACHE_LINE_SIZE 64          // Alignment of event headers and of the fields reservations write
+#define EVENT_SLAB_SIZE 64          // Event headers allocated at once
+#define EVENT_INDEX_MIN_SLOTS 64    // Initial slots of the event index, a power of two
+#define HUGE_PAGE_SIZE (2ul << 20)  // Seat arrays this large are aligned for transparent huge pages
+
+struct ReserveRequest;
+struct Subscriber;
+
+// Reservations published by threads waiting on a hot event, applied by whoever holds its mutex
+struct CombineSlots {
+  _Atomic(struct ReserveRequest*) requests[COMBINE_SLOTS];
+};
+
+// A request for any num_seats seats of an event, queued until that many are free, see ems_waitlist()
+struct WaitEntry {
+  struct WaitEntry* next;
+  struct Subscriber* subscriber;  // Notified with the seats once they are reserved
+  size_t num_seats;
+};
+
 struct Event {
-  unsigned int id;            /// Event id
-  unsigned int reservations;  /// Number of reservations for the event.
+  // Set at creation and read by every operation on the event, apart from what reservations write
+  _Alignas(CACHE_LINE_SIZE) unsigned int id;  /// Event id
+  size_t cols;                                 /// Number of columns.
+  size_t rows;                                 /// Number of rows.
+  unsigned int* data;                          /// Array of size rows * cols with the reservations for each seat.
+  size_t* row_occupied;                        /// Taken seats of every row, written like data.
+  _Atomic(struct CombineSlots*) combining;     /// Set once the event is hot, NULL before.
 
-  size_t cols;  /// Number of columns.
-  size_t rows;  /// Number of rows.
+  // Written by every reservation, on a cache line of their own
+  _Alignas(CACHE_LINE_SIZE) pthread_mutex_t mutex;  // Mutex to protect the event
+  unsigned int reservations;                         /// Number of reservations for the event.
+  unsigned int version;                              /// Incremented on every change to the seats.
+  atomic_uint seq;         /// Odd while the seats are being written, lets readers copy them without the mutex.
+  atomic_uint contended;   /// Reservations that found the mutex taken.
+  atomic_size_t occupied;  /// Taken seats of the whole event, written under the mutex.
 
-  unsigned int* data;     /// Array of size rows * cols with the reservations for each seat.
-  pthread_mutex_t mutex;  // Mutex to protect the event
+  // Only touched by waitlisted requests
+  _Alignas(CACHE_LINE_SIZE) struct WaitEntry* waitlist;  /// Oldest waitlisted request, protected by the mutex.
+  struct WaitEntry* waitlist_tail;                        /// Newest waitlisted request.
+  size_t waitlist_len;                                    /// Waitlisted requests.
 };
 
-struct ListNode {
-  struct Event* event;
-  struct ListNode* next;
+// Event headers, allocated EVENT_SLAB_SIZE at a time so neighbours share pages instead of malloc headers
+struct EventSlab {
+  struct EventSlab* next;  // Previously filled slab
+  size_t used;             // Events handed out
+  struct Event events[EVENT_SLAB_SIZE];
 };
 
-// Linked list structure
+// Event store: headers live in slabs, found by id through an open addressing index
 struct EventList {
-  struct ListNode* head;  // Head of the list
-  struct ListNode* tail;  // Tail of the list
-  pthread_rwlock_t rwl;   // Mutex to protect the list
+  struct Event** events;    // Every event, in creation order
+  size_t num_events;        // Events in the list
+  size_t capacity;          // Room in events
+  struct Event** index;     // Events by id, linear probing, NULL marks a free slot
+  size_t index_capacity;    // Slots of index, a power of two kept at least twice num_events
+  struct EventSlab* slabs;  // Newest slab first
+  pthread_rwlock_t rwl;     // Mutex to protect the list
 };
 
 /// Creates a new event list.
 /// @return Newly created event list, NULL on failure
 struct EventList* create_list();
 
-/// Appends a new node to the list.
+/// Gets room for a new event. It only becomes part of the list once appended, until then the same
+/// slot is handed out again.
+/// @note The list must be locked for writing.
+/// @param list Event list the event will be appended to.
+/// @return Zeroed event, NULL on failure.
+struct Event* alloc_event(struct EventList* list);
+
+/// Appends a new event to the list.
 /// @param list Event list to be modified.
-/// @param data Event to be stored in the new node.
-/// @return 0 if the node was appended successfully, 1 otherwise.
-int append_to_list(struct EventList* list, struct Event* data);
+/// @param event Event returned by the last alloc_event() call.
+/// @return 0 if the event was appended successfully, 1 otherwise.
+int append_to_list(struct EventList* list, struct Event* event);
+
+/// Gets room for many new events at once, for bulk loading. Unlike alloc_event(), the slots are
+/// taken right away, so they can be filled in by several threads at once without the list lock.
+/// @note The list must be locked for writing.
+/// @param list Event list the events will be appended to.
+/// @param count Number of events.
+/// @param events Array of count pointers to store the zeroed events in.
+/// @return 0 on success, 1 on failure, with no slots taken.
+int alloc_events(struct EventList* list, size_t count, struct Event** events);
 
-/// Removes a node from the list.
+/// Appends events returned by alloc_events() to the list, growing it only once. Slots left unused
+/// are simply never part of the list, they are freed with it.
+/// @note The list must be locked for writing.
 /// @param list Event list to be modified.
-/// @return 0 if the node was removed successfully, 1 otherwise.
+/// @param events Events to append, in order. NULL entries are skipped, and events whose id is
+///               already in the list, or earlier in the array, are left out: their seats are
+///               freed and their entry set to NULL.
+/// @param count Number of entries.
+/// @param left_out Pointer to store the number of events left out in.
+/// @return 0 if the events were appended, 1 otherwise, with none of them appended.
+int append_events(struct EventList* list, struct Event** events, size_t count, size_t* left_out);
+
+/// Allocates a zeroed seat array. Arrays of at least HUGE_PAGE_SIZE are aligned to it, so the
+/// kernel can back them with huge pages, smaller ones to a cache line.
+/// @param size Size in bytes.
+/// @return The array, to be freed with free(), NULL on failure.
+void* alloc_seats(size_t size);
+
+/// Frees the list and every event in it.
+/// @param list Event list to be freed.
 void free_list(struct EventList* list);
 
 /// Retrieves an event in the list.
 /// @param list Event list to be searched
 /// @param event_id Event id.
-/// @param from First node to be searched.
-/// @param to Last node to be searched.
 /// @return Pointer to the event if found, NULL otherwise.
-struct Event* get_event(struct EventList* list, unsigned int event_id, struct ListNode* from, struct ListNode* to);
+struct Event* get_event(struct EventList* list, unsigned int event_id);
 
 #endif  // SERVER_EVENT_LIST_H
@@ -0,0 +1,192 @@
+#include "holds.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "stats.h"
+#include "timerwheel.h"
+
+typedef struct Hold {
+  TimerNode timer;    // First member, so expired timers can be cast back to their hold
+  struct Hold* next;  // Next hold in the same bucket
+  unsigned int id;
+  unsigned int event_id;
+  unsigned int reservation_id;
+  size_t num_seats;
+  size_t* xs;  // Both stored right after the hold
+  size_t* ys;
+} Hold;
+
+// A single mutex covers the index and the wheel, so a hold is either confirmed or expired, never both
+static pthread_mutex_t holds_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t holds_changed = PTHREAD_COND_INITIALIZER;
+static pthread_t expiry_thread;
+static int running = 0;
+static HoldExpiry expire_hold = NULL;
+static TimerWheel wheel;
+static uint64_t wake_tick = UINT64_MAX;  // Tick the expiry thread sleeps until
+static Hold* buckets[HOLD_BUCKETS];
+static unsigned int next_hold_id = 1;
+static unsigned long num_expired = 0;
+static unsigned long num_confirmed = 0;
+
+static uint64_t current_tick(void) { return stats_now() / ((uint64_t)HOLD_TICK_MS * 1000000); }
+
+/// Finds the link pointing to a hold in the index.
+/// @return Pointer to the link, which holds NULL if the hold does not exist.
+static Hold** find_hold(unsigned int hold_id) {
+  Hold** link = &buckets[hold_id & (HOLD_BUCKETS - 1)];
+  while (*link && (*link)->id != hold_id) link = &(*link)->next;
+  return link;
+}
+
+static void* holds_expiry_thread(void* arg) {
+  (void)arg;
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGUSR1);
+  sigaddset(&set, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  pthread_mutex_lock(&holds_mutex);
+  while (running) {
+    TimerNode expired;
+    timer_list_init(&expired);
+    timer_wheel_advance(&wheel, current_tick(), &expired);
+    // Unlinked from the index first, so a racing CONFIRM fails instead of confirming freed seats
+    for (TimerNode* timer = expired.next; timer != &expired; timer = timer->next) {
+      Hold** link = find_hold(((Hold*)timer)->id);
+      *link = (*link)->next;
+    }
+
+    if (expired.next != &expired) {
+      // The seats are given back without the holds lock, the event lock is taken for that
+      pthread_mutex_unlock(&holds_mutex);
+      while (expired.next != &expired) {
+        Hold* hold = (Hold*)expired.next;
+        expired.next = hold->timer.next;
+        log_msg(LOG_DEBUG, "Hold %u on event %u expired\n", hold->id, hold->event_id);
+        expire_hold(hold->event_id, hold->reservation_id, hold->num_seats, hold->xs, hold->ys);
+        free(hold);
+        num_expired++;  // Only touched by this thread
+      }
+      pthread_mutex_lock(&holds_mutex);
+      continue;
+    }
+
+    wake_tick = timer_wheel_next(&wheel);
+    if (wake_tick == UINT64_MAX) {
+      pthread_cond_wait(&holds_changed, &holds_mutex);
+      continue;
+    }
+    uint64_t wait_ns = (wake_tick - wheel.now) * HOLD_TICK_MS * 1000000;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)(wait_ns / 1000000000);
+    deadline.tv_nsec += (long)(wait_ns % 1000000000);
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&holds_changed, &holds_mutex, &deadline);
+  }
+  pthread_mutex_unlock(&holds_mutex);
+  return NULL;
+}
+
+int holds_start(HoldExpiry expire) {
+  expire_hold = expire;
+  timer_wheel_init(&wheel, current_tick());
+  wake_tick = UINT64_MAX;
+  running = 1;
+  if (pthread_create(&expiry_thread, NULL, holds_expiry_thread, NULL) != 0) {
+    running = 0;
+    return 1;
+  }
+  return 0;
+}
+
+void holds_stop(void) {
+  pthread_mutex_lock(&holds_mutex);
+  if (!running) {
+    pthread_mutex_unlock(&holds_mutex);
+    return;
+  }
+  running = 0;
+  pthread_cond_signal(&holds_changed);
+  pthread_mutex_unlock(&holds_mutex);
+  pthread_join(expiry_thread, NULL);
+
+  size_t outstanding = 0;
+  for (size_t i = 0; i < HOLD_BUCKETS; i++) {
+    while (buckets[i]) {
+      Hold* hold = buckets[i];
+      buckets[i] = hold->next;
+      free(hold);
+      outstanding++;
+    }
+  }
+  log_msg(LOG_INFO, "Holds: %lu confirmed, %lu expired, %zu outstanding\n", num_confirmed, num_expired,
+          outstanding);
+}
+
+int holds_add(unsigned int event_id, unsigned int reservation_id, size_t num_seats, size_t* xs, size_t* ys,
+              unsigned int ttl_s, unsigned int* hold_id) {
+  if (ttl_s == 0 || ttl_s > HOLD_MAX_TTL_S) return 1;
+
+  Hold* hold = malloc(sizeof(Hold) + 2 * num_seats * sizeof(size_t));
+  if (hold == NULL) {
+    log_msg(LOG_ERROR, "Failed to allocate memory for hold\n");
+    return 1;
+  }
+  hold->event_id = event_id;
+  hold->reservation_id = reservation_id;
+  hold->num_seats = num_seats;
+  hold->xs = (size_t*)(hold + 1);
+  hold->ys = hold->xs + num_seats;
+  memcpy(hold->xs, xs, num_seats * sizeof(size_t));
+  memcpy(hold->ys, ys, num_seats * sizeof(size_t));
+  uint64_t now = current_tick();
+  hold->timer.expires = now + (uint64_t)ttl_s * 1000 / HOLD_TICK_MS;
+
+  pthread_mutex_lock(&holds_mutex);
+  if (!running) {
+    pthread_mutex_unlock(&holds_mutex);
+    free(hold);
+    return 1;
+  }
+  // Skips 0 and ids still in use once the counter wraps around
+  do {
+    hold->id = next_hold_id++;
+  } while (hold->id == 0 || *find_hold(hold->id) != NULL);
+  Hold** bucket = &buckets[hold->id & (HOLD_BUCKETS - 1)];
+  hold->next = *bucket;
+  *bucket = hold;
+  timer_wheel_add(&wheel, &hold->timer, now);
+  if (hold->timer.expires < wake_tick) pthread_cond_signal(&holds_changed);
+  *hold_id = hold->id;
+  pthread_mutex_unlock(&holds_mutex);
+  return 0;
+}
+
+int holds_confirm(unsigned int hold_id) {
+  pthread_mutex_lock(&holds_mutex);
+  Hold** link = find_hold(hold_id);
+  Hold* hold = *link;
+  if (hold == NULL) {
+    pthread_mutex_unlock(&holds_mutex);
+    return 1;
+  }
+  *link = hold->next;
+  timer_wheel_cancel(&wheel, &hold->timer);
+  num_confirmed++;
+  pthread_mutex_unlock(&holds_mutex);
+  free(hold);
+  return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef SERVER_HOLDS_H
+#define SERVER_HOLDS_H
+
+#include <stddef.h>
+
+#define HOLD_TICK_MS 10            // Resolution of hold expiries
+#define HOLD_MAX_TTL_S 86400       // Longest a hold may last
+#define HOLD_BUCKETS 4096          // Buckets of the hold id index, must be a power of two
+
+/// Gives the seats of an expired hold back. Called from the expiry thread, with no lock held.
+/// @param event_id Event the seats belong to.
+/// @param reservation_id Reservation the seats were held under.
+/// @param num_seats Number of seats.
+/// @param xs Rows of the seats.
+/// @param ys Columns of the seats.
+typedef void (*HoldExpiry)(unsigned int event_id, unsigned int reservation_id, size_t num_seats, size_t* xs,
+                           size_t* ys);
+
+/// Starts the thread that expires holds.
+/// @param expire Function the seats of every expired hold are handed to.
+/// @return 0 if the thread was started, 1 otherwise.
+int holds_start(HoldExpiry expire);
+
+/// Stops the expiry thread and forgets every outstanding hold, without expiring them.
+void holds_stop(void);
+
+/// Starts timing a hold on seats that are already reserved.
+/// @param event_id Event the seats belong to.
+/// @param reservation_id Reservation the seats are held under.
+/// @param num_seats Number of seats.
+/// @param xs Rows of the seats, copied.
+/// @param ys Columns of the seats, copied.
+/// @param ttl_s Seconds until the hold expires, at most HOLD_MAX_TTL_S.
+/// @param hold_id Pointer to store the id of the new hold in. Ids are never 0.
+/// @return 0 if the hold was added, 1 otherwise.
+int holds_add(unsigned int event_id, unsigned int reservation_id, size_t num_seats, size_t* xs, size_t* ys,
+              unsigned int ttl_s, unsigned int* hold_id);
+
+/// Makes a hold permanent, so its seats stay reserved.
+/// @param hold_id Id of the hold.
+/// @return 0 if the hold was confirmed, 1 if it does not exist or already expired.
+int holds_confirm(unsigned int hold_id);
+
+#endif  // SERVER_HOLDS_H
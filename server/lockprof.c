@@ -0,0 +1,218 @@
+#include "lockprof.h"
+
+#ifdef LOCK_PROFILE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "common/histogram.h"
+#include "stats.h"
+
+// Counters shared by every thread that takes a lock of the class (or event), so they are
+// only ever updated with atomic read-modify-write operations
+typedef struct {
+  uint64_t acquisitions;
+  uint64_t contended;  // Acquisitions that could not be granted immediately
+  Histogram wait;      // Time from asking for the lock to getting it
+  Histogram hold;      // Time from getting the lock to releasing it
+} LockProfile;
+
+typedef struct {
+  unsigned int key;  // Event ID + 1, 0 while the slot is free
+  LockProfile profile;
+} EventProfile;
+
+static const char* class_names[LOCK_NUM_CLASSES] = {"event_list->rwl", "Event::mutex"};
+
+static LockProfile classes[LOCK_NUM_CLASSES];
+static EventProfile events[LOCKPROF_MAX_EVENTS];
+
+// A thread holds at most one lock of each class at a time, see operations.c
+static _Thread_local uint64_t acquired_at[LOCK_NUM_CLASSES];
+
+static void record(Histogram* histogram, uint64_t value) {
+  __atomic_fetch_add(&histogram->counts[histogram_bucket(value)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+  uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+  while (value > max &&
+         !__atomic_compare_exchange_n(&histogram->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+/// Finds the profile of an event, claiming a free slot on first use.
+/// @return The event's profile, NULL if every slot is taken by other events.
+static LockProfile* event_profile(unsigned int event_id) {
+  unsigned int key = event_id + 1;
+  if (key == 0) return NULL;
+
+  for (unsigned int i = 0; i < LOCKPROF_MAX_EVENTS; i++) {
+    EventProfile* slot = &events[(event_id + i) % LOCKPROF_MAX_EVENTS];
+    unsigned int current = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+    if (current == 0) {
+      unsigned int expected = 0;
+      if (__atomic_compare_exchange_n(&slot->key, &expected, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return &slot->profile;
+      }
+      current = expected;
+    }
+    if (current == key) return &slot->profile;
+  }
+  return NULL;
+}
+
+static void record_acquire(enum LockClass lock_class, LockProfile* event, int contended, uint64_t start) {
+  uint64_t now = stats_now();
+  acquired_at[lock_class] = now;
+
+  LockProfile* profiles[2] = {&classes[lock_class], event};
+  for (int i = 0; i < 2; i++) {
+    if (!profiles[i]) continue;
+    __atomic_fetch_add(&profiles[i]->acquisitions, 1, __ATOMIC_RELAXED);
+    if (contended) __atomic_fetch_add(&profiles[i]->contended, 1, __ATOMIC_RELAXED);
+    record(&profiles[i]->wait, now - start);
+  }
+}
+
+static void record_release(enum LockClass lock_class, LockProfile* event) {
+  uint64_t held = stats_now() - acquired_at[lock_class];
+  record(&classes[lock_class].hold, held);
+  if (event) record(&event->hold, held);
+}
+
+int lockprof_rdlock(pthread_rwlock_t* lock) {
+  uint64_t start = stats_now();
+  int contended = 0;
+  int ret = pthread_rwlock_tryrdlock(lock);
+  if (ret == EBUSY) {
+    contended = 1;
+    ret = pthread_rwlock_rdlock(lock);
+  }
+  if (ret == 0) record_acquire(LOCK_CLASS_LIST, NULL, contended, start);
+  return ret;
+}
+
+int lockprof_wrlock(pthread_rwlock_t* lock) {
+  uint64_t start = stats_now();
+  int contended = 0;
+  int ret = pthread_rwlock_trywrlock(lock);
+  if (ret == EBUSY) {
+    contended = 1;
+    ret = pthread_rwlock_wrlock(lock);
+  }
+  if (ret == 0) record_acquire(LOCK_CLASS_LIST, NULL, contended, start);
+  return ret;
+}
+
+int lockprof_rwunlock(pthread_rwlock_t* lock) {
+  record_release(LOCK_CLASS_LIST, NULL);
+  return pthread_rwlock_unlock(lock);
+}
+
+int lockprof_lock(pthread_mutex_t* mutex, unsigned int event_id) {
+  uint64_t start = stats_now();
+  int contended = 0;
+  int ret = pthread_mutex_trylock(mutex);
+  if (ret == EBUSY) {
+    contended = 1;
+    ret = pthread_mutex_lock(mutex);
+  }
+  if (ret == 0) record_acquire(LOCK_CLASS_EVENT, event_profile(event_id), contended, start);
+  return ret;
+}
+
+int lockprof_trylock(pthread_mutex_t* mutex, unsigned int event_id) {
+  uint64_t start = stats_now();
+  int ret = pthread_mutex_trylock(mutex);
+  if (ret == 0) record_acquire(LOCK_CLASS_EVENT, event_profile(event_id), 0, start);
+  return ret;
+}
+
+int lockprof_unlock(pthread_mutex_t* mutex, unsigned int event_id) {
+  record_release(LOCK_CLASS_EVENT, event_profile(event_id));
+  return pthread_mutex_unlock(mutex);
+}
+
+static void copy_histogram(Histogram* into, Histogram* from) {
+  histogram_init(into);
+  for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    into->counts[i] = __atomic_load_n(&from->counts[i], __ATOMIC_RELAXED);
+  }
+  into->count = __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+  into->sum = __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+  into->max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+}
+
+/// Copies a shared profile, so percentiles are computed on values that no longer change.
+static void copy_profile(LockProfile* into, LockProfile* from) {
+  into->acquisitions = __atomic_load_n(&from->acquisitions, __ATOMIC_RELAXED);
+  into->contended = __atomic_load_n(&from->contended, __ATOMIC_RELAXED);
+  copy_histogram(&into->wait, &from->wait);
+  copy_histogram(&into->hold, &from->hold);
+}
+
+static void print_profile(FILE* out, const char* name, LockProfile* profile) {
+  double contended = profile->acquisitions ? 100.0 * (double)profile->contended / (double)profile->acquisitions : 0;
+  fprintf(out, "%-18s %12llu %12llu %7.2f%% %12llu %12llu %12llu %12llu %12llu %12llu\n", name,
+          (unsigned long long)profile->acquisitions, (unsigned long long)profile->contended, contended,
+          (unsigned long long)profile->wait.sum, (unsigned long long)histogram_percentile(&profile->wait, 50),
+          (unsigned long long)histogram_percentile(&profile->wait, 99), (unsigned long long)profile->wait.max,
+          (unsigned long long)histogram_percentile(&profile->hold, 50),
+          (unsigned long long)histogram_percentile(&profile->hold, 99));
+}
+
+static int compare_wait(const void* a, const void* b) {
+  const EventProfile* x = a;
+  const EventProfile* y = b;
+  if (x->profile.wait.sum != y->profile.wait.sum) return x->profile.wait.sum < y->profile.wait.sum ? 1 : -1;
+  return 0;
+}
+
+void lockprof_report(FILE* out, size_t top_n) {
+  // Snapshots are large, so they live on the heap rather than on a worker's stack
+  LockProfile* snapshot = malloc(sizeof(LockProfile));
+  EventProfile* hot = malloc(sizeof(EventProfile) * LOCKPROF_MAX_EVENTS);
+  if (!snapshot || !hot) {
+    free(snapshot);
+    free(hot);
+    return;
+  }
+
+  fprintf(out, "\nLock contention (times in ns)\n");
+  fprintf(out, "%-18s %12s %12s %8s %12s %12s %12s %12s %12s %12s\n", "lock", "acquired", "contended", "%",
+          "wait_total", "wait_p50", "wait_p99", "wait_max", "hold_p50", "hold_p99");
+  for (int i = 0; i < LOCK_NUM_CLASSES; i++) {
+    copy_profile(snapshot, &classes[i]);
+    print_profile(out, class_names[i], snapshot);
+  }
+
+  size_t num_hot = 0;
+  for (unsigned int i = 0; i < LOCKPROF_MAX_EVENTS; i++) {
+    unsigned int key = __atomic_load_n(&events[i].key, __ATOMIC_ACQUIRE);
+    if (key == 0) continue;
+    hot[num_hot].key = key;
+    copy_profile(&hot[num_hot].profile, &events[i].profile);
+    num_hot++;
+  }
+  qsort(hot, num_hot, sizeof(EventProfile), compare_wait);
+
+  for (size_t i = 0; i < num_hot && i < top_n; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "event %u", hot[i].key - 1);
+    print_profile(out, name, &hot[i].profile);
+  }
+  fflush(out);
+
+  free(snapshot);
+  free(hot);
+}
+
+#else
+
+void lockprof_report(FILE* out, size_t top_n) {
+  (void)top_n;
+  fprintf(out, "Lock profiling is disabled, rebuild with `make LOCK_PROFILE=1`\n");
+}
+
+#endif  // LOCK_PROFILE
@@ -0,0 +1,64 @@
+#ifndef SERVER_LOCKPROF_H
+#define SERVER_LOCKPROF_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Lock contention profiling for the event list rwlock and the event mutexes, built in with
+// `make LOCK_PROFILE=1`. Without it the wrappers below are the plain pthread calls.
+
+#define LOCKPROF_MAX_EVENTS 64  // Events tracked individually, later ones only count towards their class
+#define LOCKPROF_TOP_N 10       // Events listed in a report
+
+enum LockClass {
+  LOCK_CLASS_LIST,   // event_list->rwl
+  LOCK_CLASS_EVENT,  // Event::mutex
+  LOCK_NUM_CLASSES,
+};
+
+#ifdef LOCK_PROFILE
+
+/// Locks the event list for reading, recording whether the lock was contended and how long it took.
+int lockprof_rdlock(pthread_rwlock_t* lock);
+
+/// Locks the event list for writing, recording whether the lock was contended and how long it took.
+int lockprof_wrlock(pthread_rwlock_t* lock);
+
+/// Unlocks the event list, recording how long it was held by the calling thread.
+int lockprof_rwunlock(pthread_rwlock_t* lock);
+
+/// Locks an event mutex, recording contention for its class and for the event.
+/// @param mutex Mutex of the event.
+/// @param event_id ID of the event the mutex belongs to.
+int lockprof_lock(pthread_mutex_t* mutex, unsigned int event_id);
+
+/// Tries to lock an event mutex without waiting, recording the acquisition if it succeeds.
+/// @param mutex Mutex of the event.
+/// @param event_id ID of the event the mutex belongs to.
+/// @return 0 if the mutex was locked, EBUSY if it is taken.
+int lockprof_trylock(pthread_mutex_t* mutex, unsigned int event_id);
+
+/// Unlocks an event mutex, recording how long it was held.
+/// @param mutex Mutex of the event.
+/// @param event_id ID of the event the mutex belongs to.
+int lockprof_unlock(pthread_mutex_t* mutex, unsigned int event_id);
+
+#else
+
+#define lockprof_rdlock(lock) pthread_rwlock_rdlock(lock)
+#define lockprof_wrlock(lock) pthread_rwlock_wrlock(lock)
+#define lockprof_rwunlock(lock) pthread_rwlock_unlock(lock)
+#define lockprof_lock(mutex, event_id) ((void)(event_id), pthread_mutex_lock(mutex))
+#define lockprof_trylock(mutex, event_id) ((void)(event_id), pthread_mutex_trylock(mutex))
+#define lockprof_unlock(mutex, event_id) ((void)(event_id), pthread_mutex_unlock(mutex))
+
+#endif  // LOCK_PROFILE
+
+/// Prints acquisitions, contention, wait and hold times per lock class, followed by the events
+/// with the most time spent waiting. Only prints a notice when built without LOCK_PROFILE.
+/// @param out Stream to print to.
+/// @param top_n Maximum number of events to list.
+void lockprof_report(FILE* out, size_t top_n);
+
+#endif  // SERVER_LOCKPROF_H
@@ -0,0 +1,274 @@
+#include "log.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common/io.h"
+
+typedef struct {
+  enum LogLevel level;
+  unsigned int len;
+  struct timespec time;  // When the message was logged, the writer merges the rings in this order
+  char text[LOG_RECORD_SIZE];
+} LogRecord;
+
+typedef struct {
+  const char* format;  // Call site, NULL while the slot is unused
+  time_t second;       // Second the counter below belongs to
+  unsigned int count;
+  unsigned int suppressed;
+} RateLimit;
+
+// Single producer (the owning thread), single consumer (the writer) ring
+typedef struct LogRing {
+  struct LogRing* next;
+  atomic_int owned;     // Cleared when the owning thread exits, so another thread can take the ring over
+  atomic_size_t head;   // Next record to write, only advanced by the owner
+  atomic_size_t tail;   // Next record to drain, only advanced by the writer
+  atomic_size_t dropped;
+  RateLimit limits[LOG_RATE_LIMIT_SLOTS];
+  LogRecord records[LOG_RING_SIZE];
+} LogRing;
+
+static const char* level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+static LogRing* rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;  // Never taken by a thread after its first message
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local LogRing* ring = NULL;
+
+static atomic_int min_level = LOG_DEBUG;
+static int log_fd = -1;
+static pthread_t writer_thread;
+static int writer_running = 0;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_stop = PTHREAD_COND_INITIALIZER;
+
+static void release_ring(void* arg) {
+  LogRing* owned = arg;
+  atomic_store(&owned->owned, 0);
+}
+
+static void create_ring_key(void) { pthread_key_create(&ring_key, release_ring); }
+
+/// Gets the calling thread's ring, reusing the ring of a finished thread when possible.
+static LogRing* get_ring(void) {
+  if (ring) return ring;
+
+  pthread_once(&ring_key_once, create_ring_key);
+  pthread_mutex_lock(&rings_mutex);
+  for (LogRing* current = rings; current; current = current->next) {
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&current->owned, &expected, 1)) {
+      ring = current;
+      break;
+    }
+  }
+  if (!ring) {
+    ring = calloc(1, sizeof(LogRing));
+    if (ring) {
+      atomic_init(&ring->owned, 1);
+      ring->next = rings;
+      rings = ring;
+    }
+  }
+  pthread_mutex_unlock(&rings_mutex);
+
+  if (ring) pthread_setspecific(ring_key, ring);
+  return ring;
+}
+
+/// Applies the per call site rate limit.
+/// @return Number of messages suppressed since the call site was last allowed, -1 if this one is suppressed.
+static int rate_limit(LogRing* own, const char* format) {
+  time_t now = time(NULL);
+  RateLimit* limit = &own->limits[((size_t)format >> 3) % LOG_RATE_LIMIT_SLOTS];
+  if (limit->format != format || limit->second != now) {
+    int suppressed = limit->format == format ? (int)limit->suppressed : 0;
+    limit->format = format;
+    limit->second = now;
+    limit->count = 1;
+    limit->suppressed = 0;
+    return suppressed;
+  }
+  if (limit->count >= LOG_RATE_LIMIT) {
+    limit->suppressed++;
+    return -1;
+  }
+  limit->count++;
+  return 0;
+}
+
+void log_msg(enum LogLevel level, const char* format, ...) {
+  if ((int)level < atomic_load_explicit(&min_level, memory_order_relaxed)) return;
+
+  LogRing* own = get_ring();
+  if (!own) return;
+
+  int suppressed = rate_limit(own, format);
+  if (suppressed < 0) return;
+
+  size_t head = atomic_load_explicit(&own->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&own->tail, memory_order_acquire) >= LOG_RING_SIZE) {
+    atomic_fetch_add_explicit(&own->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  LogRecord* record = &own->records[head & (LOG_RING_SIZE - 1)];
+  record->level = level;
+  clock_gettime(CLOCK_REALTIME, &record->time);
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(record->text, LOG_RECORD_SIZE, format, args);
+  va_end(args);
+  if (len < 0) return;
+  if (len >= LOG_RECORD_SIZE) len = LOG_RECORD_SIZE - 1;
+  if (suppressed > 0) {
+    int extra = snprintf(record->text + len, LOG_RECORD_SIZE - (size_t)len, " (%d similar suppressed)", suppressed);
+    if (extra > 0) len = len + extra < LOG_RECORD_SIZE ? len + extra : LOG_RECORD_SIZE - 1;
+  }
+  record->len = (unsigned int)len;
+  atomic_store_explicit(&own->head, head + 1, memory_order_release);
+}
+
+static int earlier(const struct timespec* a, const struct timespec* b) {
+  return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/// Appends one record to the output buffer.
+/// @return Number of bytes appended.
+static size_t format_record(char* out, size_t cap, const LogRecord* record) {
+  struct tm local;
+  localtime_r(&record->time.tv_sec, &local);
+  int written = snprintf(out, cap, "%02d:%02d:%02d.%06ld [%s] %.*s", local.tm_hour, local.tm_min, local.tm_sec,
+                         record->time.tv_nsec / 1000, level_names[record->level], (int)record->len, record->text);
+  if (written <= 0) return 0;
+  size_t len = (size_t)written < cap ? (size_t)written : cap - 1;
+  // Messages carry their own newline like the printf calls they replaced, add one if missing
+  if (out[len - 1] != '\n' && len + 1 < cap) out[len++] = '\n';
+  return len;
+}
+
+/// Moves every pending record into the output buffer, merging the rings by time, and writes it.
+static void drain(char* buffer, size_t cap) {
+  LogRing* pending[LOG_MAX_RINGS];
+  size_t ends[LOG_MAX_RINGS];
+  size_t num_pending = 0, len = 0;
+
+  pthread_mutex_lock(&rings_mutex);
+  for (LogRing* current = rings; current && num_pending < LOG_MAX_RINGS; current = current->next) {
+    pending[num_pending] = current;
+    ends[num_pending] = atomic_load_explicit(&current->head, memory_order_acquire);
+    num_pending++;
+  }
+  pthread_mutex_unlock(&rings_mutex);
+
+  while (1) {
+    LogRecord* next = NULL;
+    size_t from = 0;
+    for (size_t i = 0; i < num_pending; i++) {
+      size_t tail = atomic_load_explicit(&pending[i]->tail, memory_order_relaxed);
+      if (tail == ends[i]) continue;
+      LogRecord* record = &pending[i]->records[tail & (LOG_RING_SIZE - 1)];
+      if (!next || earlier(&record->time, &next->time)) {
+        next = record;
+        from = i;
+      }
+    }
+    if (!next) break;
+
+    // Room for the timestamp, the level, the text and a newline
+    if (cap - len < LOG_RECORD_SIZE + 64) {
+      write_all(log_fd, buffer, len);
+      len = 0;
+    }
+    len += format_record(buffer + len, cap - len, next);
+    atomic_fetch_add_explicit(&pending[from]->tail, 1, memory_order_release);
+  }
+
+  for (size_t i = 0; i < num_pending; i++) {
+    size_t dropped = atomic_exchange_explicit(&pending[i]->dropped, 0, memory_order_relaxed);
+    if (dropped > 0 && cap - len > 64) {
+      int written = snprintf(buffer + len, cap - len, "[WARN] %zu log messages dropped\n", dropped);
+      if (written > 0) len += (size_t)written;
+    }
+  }
+
+  if (len > 0) write_all(log_fd, buffer, len);
+}
+
+static void* log_writer(void* arg) {
+  (void)arg;
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  sigaddset(&set, SIGUSR2);
+  sigaddset(&set, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  size_t cap = (size_t)LOG_RING_SIZE * (LOG_RECORD_SIZE + 64);
+  char* buffer = malloc(cap);
+  if (!buffer) return NULL;
+
+  pthread_mutex_lock(&writer_mutex);
+  while (writer_running) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += LOG_FLUSH_INTERVAL_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&writer_stop, &writer_mutex, &deadline);
+    pthread_mutex_unlock(&writer_mutex);
+    drain(buffer, cap);
+    pthread_mutex_lock(&writer_mutex);
+  }
+  pthread_mutex_unlock(&writer_mutex);
+
+  free(buffer);
+  return NULL;
+}
+
+int log_start(int fd, enum LogLevel level) {
+  log_fd = fd;
+  atomic_store(&min_level, level);
+  writer_running = 1;
+  if (pthread_create(&writer_thread, NULL, log_writer, NULL) != 0) {
+    writer_running = 0;
+    fprintf(stderr, "Failed to start log writer\n");
+    return 1;
+  }
+  return 0;
+}
+
+void log_stop(void) {
+  pthread_mutex_lock(&writer_mutex);
+  if (!writer_running) {
+    pthread_mutex_unlock(&writer_mutex);
+    return;
+  }
+  writer_running = 0;
+  pthread_cond_signal(&writer_stop);
+  pthread_mutex_unlock(&writer_mutex);
+  // The writer drains once more after being told to stop
+  pthread_join(writer_thread, NULL);
+}
+
+int log_parse_level(const char* name, enum LogLevel* level) {
+  const char* names[] = {"debug", "info", "warn", "error"};
+  for (int i = 0; i < 4; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      *level = (enum LogLevel)i;
+      return 0;
+    }
+  }
+  return 1;
+}
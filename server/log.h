@@ -0,0 +1,43 @@
+#ifndef SERVER_LOG_H
+#define SERVER_LOG_H
+
+// Asynchronous logging. Each thread formats its messages into its own ring buffer, which a
+// background writer drains, so logging never takes a lock or makes a syscall on a request
+// thread. Messages are dropped (and counted) if a ring is full.
+
+#define LOG_RECORD_SIZE 256       // Longest message kept, longer ones are truncated
+#define LOG_RING_SIZE 128         // Records buffered per thread, must be a power of two
+#define LOG_FLUSH_INTERVAL_MS 20  // How often the writer drains the rings
+#define LOG_RATE_LIMIT 20         // Messages per second allowed from a single call site, per thread
+#define LOG_RATE_LIMIT_SLOTS 32   // Call sites tracked per thread for rate limiting
+#define LOG_MAX_RINGS 256         // Threads drained by the writer
+
+enum LogLevel {
+  LOG_DEBUG,
+  LOG_INFO,
+  LOG_WARN,
+  LOG_ERROR,
+};
+
+/// Starts the writer thread. Messages logged before this are buffered, up to LOG_RING_SIZE per thread.
+/// @param fd File descriptor to write to.
+/// @param level Messages below this level are discarded without being formatted.
+/// @return 0 if the writer was started, 1 otherwise.
+int log_start(int fd, enum LogLevel level);
+
+/// Writes every pending message and stops the writer thread.
+void log_stop(void);
+
+/// Parses a level name (debug, info, warn or error).
+/// @param name Name to parse.
+/// @param level Pointer to the variable to store the level in.
+/// @return 0 if the name is valid, 1 otherwise.
+int log_parse_level(const char* name, enum LogLevel* level);
+
+/// Logs a message. Never blocks: the message is dropped if the calling thread's ring is full or
+/// if its call site has already logged LOG_RATE_LIMIT messages in the current second.
+/// @param level Severity of the message.
+/// @param format printf-style format, also used to identify the call site.
+void log_msg(enum LogLevel level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif  // SERVER_LOG_H
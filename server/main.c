@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,16 +12,31 @@
 
 #include "common/constants.h"
 #include "common/io.h"
+#include "common/varint.h"
+#include "admission.h"
+#include "batch.h"
+#include "dump.h"
+#include "lockprof.h"
+#include "log.h"
 #include "operations.h"
+#include "poller.h"
+#include "pool.h"
+#include "preload.h"
 #include "session.h"
+#include "stats.h"
+#include "subscriptions.h"
+#include "uring.h"
 
-int session_worker(Session* session);
-void list_all_info();
+enum SessionStatus session_worker(Session* session);
 
-SessionQueue* queue = NULL;
-unsigned int active_sessions = 0;
+WorkerPool* pool = NULL;
+Poller* poller = NULL;
+atomic_uint active_sessions = 0;
+atomic_uint pending_sessions = 0;  // Admitted sessions whose pipes are not open yet
+int request_timeout_ms = DEFAULT_REQUEST_TIMEOUT_MS;
+int zero_copy_show = 0;  // SHOW splices the seats into the response pipe instead of writing them
 volatile sig_atomic_t server_running = 1;
-volatile sig_atomic_t list_all = 0;  // Flag to trigger list all events
+volatile sig_atomic_t lock_report = 0;  // Flag to trigger the lock contention report
 
 // Handler for SIGINT
 void sigint_handler(int sign) {
@@ -28,58 +44,237 @@ void sigint_handler(int sign) {
     fprintf(stderr, "Received unexpected signal %d\n", sign);
     return;
   }
-  server_running = 0;
-  pthread_mutex_lock(&queue->mutex);
-  queue->shutdown = 1;
-  pthread_mutex_unlock(&queue->mutex);
-  pthread_cond_broadcast(&queue->empty);
+  server_running = 0;  // The accept loop stops and shuts the pool down
   fprintf(stderr, "\nReceived SIGINT. Terminating...\n");
 }
-// Handler for SIGUSR1
-void sigusr1_handler(int sign) {
-  if (sign != SIGUSR1) {
+/// Queues part of a response, see session_write().
+/// @return Number of bytes queued or written, -1 on failure.
+static ssize_t write_response(Session* session, const void* buf, size_t len) {
+  return session_write(session, buf, len) == 0 ? (ssize_t)len : -1;
+}
+
+/// Reads part of a request, failing if the request isn't complete by the deadline.
+/// @param deadline Instant the whole request must have arrived by, see stats_now(). Ignored if
+///                 request_timeout_ms is 0.
+/// @return 0 if all bytes were read, 1 otherwise.
+static int read_request(Session* session, void* buffer, size_t len, uint64_t deadline) {
+  if (request_timeout_ms == 0) return session_read(session, buffer, len, 0);
+  uint64_t now = stats_now();
+  int remaining_ms = now < deadline ? (int)((deadline - now + 999999) / 1000000) : 1;
+  if (session_read(session, buffer, len, remaining_ms) == 0) return 0;
+  if (errno == ETIMEDOUT) log_msg(LOG_WARN, "Request not complete after %d ms\n", request_timeout_ms);
+  return 1;
+}
+
+/// Reads a varint of a request, see common/varint.h.
+/// @return 0 if the varint was read, 1 otherwise.
+static int read_varint(Session* session, size_t* value, uint64_t deadline) {
+  char bytes[VARINT_MAX_BYTES];
+  for (size_t len = 1; len <= VARINT_MAX_BYTES; len++) {
+    if (read_request(session, &bytes[len - 1], 1, deadline) != 0) return 1;
+    if (!(bytes[len - 1] & 0x80)) {
+      size_t offset = 0;
+      return varint_decode(bytes, len, &offset, value);
+    }
+  }
+  return 1;
+}
+
+/// Reads the seats of a RESERVE sent with PROTOCOL_V2: a varint seat count and a varint byte count,
+/// followed by that many bytes of varint row and column pairs. Decoded in place, without allocating.
+/// @param num_seats Pointer to store the number of seats in, at most MAX_RESERVATION_SIZE.
+/// @param xs Array of MAX_RESERVATION_SIZE rows.
+/// @param ys Array of MAX_RESERVATION_SIZE columns.
+/// @return 0 if the seats were read, 1 if the request is malformed or incomplete.
+static int read_packed_seats(Session* session, size_t* num_seats, size_t* xs, size_t* ys, uint64_t deadline) {
+  char packed[2 * VARINT_MAX_BYTES * MAX_RESERVATION_SIZE];
+  size_t len;
+  if (read_varint(session, num_seats, deadline) != 0 || read_varint(session, &len, deadline) != 0) return 1;
+  if (*num_seats > MAX_RESERVATION_SIZE || len > 2 * VARINT_MAX_BYTES * *num_seats) return 1;
+  if (read_request(session, packed, len, deadline) != 0) return 1;
+
+  size_t offset = 0;
+  for (size_t i = 0; i < *num_seats; i++) {
+    if (varint_decode(packed, len, &offset, &xs[i]) != 0 || varint_decode(packed, len, &offset, &ys[i]) != 0) {
+      return 1;
+    }
+  }
+  return offset != len;
+}
+
+// Handler for SIGUSR2
+void sigusr2_handler(int sign) {
+  if (sign != SIGUSR2) {
     fprintf(stderr, "Received unexpected signal %d\n", sign);
     return;
   }
-  printf("\nReceived SIGUSR1. Listing all events...\n");
-  list_all = 1;
+  lock_report = 1;
 }
 
-void* session_thread(void* arg) {
-  (void)arg;
-  sigset_t set;
-  sigemptyset(&set);
-  sigaddset(&set, SIGUSR1);
-  pthread_sigmask(SIG_BLOCK, &set, NULL);
-  while (server_running) {
-    Session* session = dequeue_session(queue);
-    if (!session) {
-      if (server_running == 1) {
-        fprintf(stderr, "Failed to dequeue session\n");
-      }
-      break;
-    }
-    if (session_worker(session) != 0) {
-      fprintf(stderr, "Session Error\n");
-    }
-    fprintf(stderr, "Session %d terminated.\n", session->id);
-    destroy_session(session);
-    active_sessions--;
+/// Prints the lock contention report requested with SIGUSR2.
+static void report_locks(void) {
+  lockprof_report(stdout, LOCKPROF_TOP_N);
+  signal(SIGUSR2, sigusr2_handler);
+  lock_report = 0;
+}
+
+/// Serves one unit of work for a session on a pool worker: opens a newly registered session or
+/// serves the request the poller saw arrive, then hands the session back to the poller.
+static void serve_session(Session* session) {
+  enum SessionStatus status;
+  if (session->requests_fd == -1) {
+    status = open_session(session, request_timeout_ms) == 0 ? SESSION_OPEN : SESSION_FAILED;
+    atomic_fetch_sub(&pending_sessions, 1);
+  } else {
+    status = session_worker(session);
+  }
+
+  // Responses are gathered while serving, a request is only done once they are all written
+  if (status != SESSION_FAILED && session_flush(session) != 0) status = SESSION_FAILED;
+  // A request read ahead with the last one is already here, the poller would wait for it in vain
+  if (status == SESSION_OPEN && server_running &&
+      (session_has_input(session) ? pool_submit(pool, session) : poller_add(poller, session)) == 0) {
+    return;
   }
-  return NULL;
+  if (status == SESSION_FAILED) log_msg(LOG_ERROR, "Session Error\n");
+  log_msg(LOG_INFO, "Session %d terminated after %.1fs.\n", session->id,
+          (double)(stats_now() - session->created_at) / 1e9);
+  destroy_session(session);
+  atomic_fetch_sub(&active_sessions, 1);
+}
+
+/// Closes a session the poller found idle for too long, freeing its slot for other clients.
+static void reap_session(Session* session) {
+  uint64_t now = stats_now();
+  log_msg(LOG_INFO, "Session %d reaped after %.1fs idle, %.1fs in total.\n", session->id,
+          (double)(now - session->idle_since) / 1e9, (double)(now - session->created_at) / 1e9);
+  destroy_session(session);
+  atomic_fetch_sub(&active_sessions, 1);
+}
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [-w min_workers] [-W max_workers] [-P] [-c max_sessions] [-q max_pending] [-p priority_prefix]\n"
+          "          [-I idle_timeout_s] [-R request_timeout_ms] [-s stats_file] [-i interval_s] [-B] [-l log_level]\n"
+          "          [-d dump_file] [-D] [-Z] [-U] [-E event_manifest] <pipe_path> [delay]\n",
+          program);
 }
 
 int main(int argc, char* argv[]) {
   printf("Server started with PID %d\n", getpid());
-  if (argc < 2 || argc > 3) {
-    fprintf(stderr, "Usage: %s\n <pipe_path> [delay]\n", argv[0]);
+  char* stats_path = NULL;
+  unsigned long int stats_interval_s = 10;
+  int stats_binary = 0;
+  enum LogLevel log_level = LOG_INFO;
+  char* dump_path = NULL;
+  int dump_binary = 0;
+  int use_uring = 0;
+  char* manifest_path = NULL;
+  unsigned long int min_workers = DEFAULT_MIN_WORKERS;
+  unsigned long int max_workers = DEFAULT_MAX_WORKERS;
+  int pin_workers = 0;
+  unsigned long int max_sessions = DEFAULT_MAX_SESSIONS;
+  unsigned long int max_pending = DEFAULT_MAX_PENDING;
+  char* priority_prefix = NULL;
+  unsigned long int idle_timeout_s = DEFAULT_IDLE_TIMEOUT_S;
+  char* endptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "w:W:Pc:q:p:I:R:s:i:Bl:d:DZUE:")) != -1) {
+    switch (opt) {
+      case 'w':
+      case 'W': {
+        unsigned long int workers = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || workers == 0 || workers > UINT_MAX) {
+          fprintf(stderr, "Invalid number of workers\n");
+          return 1;
+        }
+        *(opt == 'w' ? &min_workers : &max_workers) = workers;
+        break;
+      }
+      case 'P':
+        pin_workers = 1;
+        break;
+      case 'c':
+      case 'q': {
+        unsigned long int limit = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || limit == 0 || limit > UINT_MAX) {
+          fprintf(stderr, "Invalid session limit\n");
+          return 1;
+        }
+        *(opt == 'c' ? &max_sessions : &max_pending) = limit;
+        break;
+      }
+      case 'p':
+        priority_prefix = optarg;
+        break;
+      case 'I':
+        idle_timeout_s = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || idle_timeout_s > INT_MAX / 1000) {
+          fprintf(stderr, "Invalid idle timeout\n");
+          return 1;
+        }
+        break;
+      case 'R': {
+        unsigned long int timeout_ms = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || timeout_ms > INT_MAX) {
+          fprintf(stderr, "Invalid request timeout\n");
+          return 1;
+        }
+        request_timeout_ms = (int)timeout_ms;
+        break;
+      }
+      case 's':
+        stats_path = optarg;
+        break;
+      case 'i':
+        stats_interval_s = strtoul(optarg, &endptr, 10);
+        if (*endptr != '\0' || stats_interval_s == 0 || stats_interval_s > UINT_MAX) {
+          fprintf(stderr, "Invalid stats interval\n");
+          return 1;
+        }
+        break;
+      case 'B':
+        stats_binary = 1;
+        break;
+      case 'l':
+        if (log_parse_level(optarg, &log_level)) {
+          fprintf(stderr, "Invalid log level, expected debug, info, warn or error\n");
+          return 1;
+        }
+        break;
+      case 'd':
+        dump_path = optarg;
+        break;
+      case 'D':
+        dump_binary = 1;
+        break;
+      case 'Z':
+        zero_copy_show = 1;
+        break;
+      case 'U':
+        use_uring = 1;
+        break;
+      case 'E':
+        manifest_path = optarg;
+        break;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  if (argc - optind < 1 || argc - optind > 2) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  char* pipe_path = argv[optind];
+  if (min_workers > max_workers) {
+    fprintf(stderr, "The minimum number of workers can not be above the maximum\n");
     return 1;
   }
 
-  char* endptr;
   unsigned int state_access_delay_us = STATE_ACCESS_DELAY_US;
-  if (argc == 3) {
-    unsigned long int delay = strtoul(argv[2], &endptr, 10);
+  if (argc - optind == 2) {
+    unsigned long int delay = strtoul(argv[optind + 1], &endptr, 10);
 
     if (*endptr != '\0' || delay > UINT_MAX) {
       fprintf(stderr, "Invalid delay value or value too large\n");
@@ -88,59 +283,86 @@ int main(int argc, char* argv[]) {
     state_access_delay_us = (unsigned int)delay;
   }
 
+  // SIGUSR1 is only ever received by the dump thread, through sigwait(), so it must be blocked
+  // before any thread is created
+  sigset_t dump_set;
+  sigemptyset(&dump_set);
+  sigaddset(&dump_set, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &dump_set, NULL);
+
+  if (log_start(STDERR_FILENO, log_level)) {
+    return 1;
+  }
+  if (use_uring && uring_enable() != 0) {
+    log_msg(LOG_WARN, "io_uring is unavailable, sessions use blocking I/O\n");
+  }
   if (ems_init(state_access_delay_us)) {
     fprintf(stderr, "Failed to initialize EMS\n");
     return 1;
   }
+  // Bulk provisioning, done before the first session so it never waits on the list lock
+  if (manifest_path && preload_events(manifest_path)) {
+    log_stop();  // The log says what was wrong with the manifest
+    fprintf(stderr, "Failed to preload events from %s\n", manifest_path);
+    return 1;
+  }
+  if (stats_path && stats_start_dump(stats_path, (unsigned int)stats_interval_s, stats_binary)) {
+    return 1;
+  }
+  if (dump_start(dump_path, dump_binary)) {
+    return 1;
+  }
+  admission_init((unsigned int)max_sessions, (unsigned int)max_pending, priority_prefix);
 
-  mkfifo(argv[1], 0640);  // Create named pipe for connection requests
+  mkfifo(pipe_path, 0640);  // Create named pipe for connection requests
   if (errno == EEXIST) {
     fprintf(stderr, "Named pipe already exists.\n");
   } else if (errno != 0) {
     perror("Error creating named pipe");
     return 1;
   }
-  // Create array of pointers to sessions
-  pthread_t worker_threads[MAX_SESSIONS];
-  queue = create_session_queue();
-  if (!queue) {
-    fprintf(stderr, "Failed to create session queue\n");
+  // Sessions are served one request at a time: the poller hands a session to the pool when a
+  // request arrives, and the worker hands it back once the response is written
+  pool = create_pool((unsigned int)min_workers, (unsigned int)max_workers, pin_workers, serve_session);
+  if (!pool) {
+    fprintf(stderr, "Failed to create worker pool\n");
     return 1;
   }
-  for (int i = 0; i < MAX_SESSIONS; i++) {
-    int create = pthread_create(&worker_threads[i], NULL, session_thread, NULL);
-    if (create != 0) {
-      fprintf(stderr, "Failed to create worker thread\n");
-      return 1;
-    }
+  poller = create_poller(pool, (int)idle_timeout_s * 1000, reap_session);
+  if (!poller) {
+    fprintf(stderr, "Failed to create session poller\n");
+    return 1;
   }
 
   signal(SIGINT, sigint_handler);
   signal(SIGPIPE, SIG_IGN);  // Ignore SIGPIPE for client disconnect handling
-  signal(SIGUSR1, sigusr1_handler);
+  signal(SIGUSR2, sigusr2_handler);
 
-  int register_fd;
+  // The registration pipe stays open for the whole run: closing it between requests would
+  // discard registrations that concurrent clients already wrote into it
+  int register_fd = -1;
+  unsigned int next_session_id = 0;
   while (server_running) {
-    if (list_all) list_all_info();
-    if (server_running == 0) break;  // In case signal comes in during list_all_info
-    while (server_running) {
-      register_fd = open(argv[1], O_RDWR);
-      if (register_fd == -1) {
-        if (errno == EINTR) {
-          printf("Interrupted by signal\n");
-          if (list_all) list_all_info();
-          continue;  // Retry or terminate via signal
-        }
-        fprintf(stderr, "Failed to open named pipe\n");
-        return 1;
+    register_fd = open(pipe_path, O_RDWR);
+    if (register_fd == -1) {
+      if (errno == EINTR) {
+        log_msg(LOG_INFO, "Interrupted by signal\n");
+        if (lock_report) report_locks();
+        continue;  // Retry or terminate via signal
       }
-      break;
+      log_msg(LOG_ERROR, "Failed to open named pipe\n");
+      return 1;
     }
+    break;
+  }
+  while (server_running) {
+    if (lock_report) report_locks();
+    if (server_running == 0) break;  // In case signal comes in during report_locks
     // Process connection request
     int code = 0;
     char req_pipe_path[MAX_BUFFER_SIZE] = {0};
     char resp_pipe_path[MAX_BUFFER_SIZE] = {0};
-    printf("Waiting for connection request...\n");
+    log_msg(LOG_INFO, "Waiting for connection request...\n");
     ssize_t bytesRead = read(register_fd, &code, sizeof(int));
     // Checking for connection request OPCODE
     if (bytesRead == 0) {
@@ -151,271 +373,469 @@ int main(int argc, char* argv[]) {
       if (errno == EINTR) {  // since reading call is blocking, USR1 might interrupt
         continue;
       }
-      fprintf(stderr, "Failed to read connection request\n");
+      log_msg(LOG_ERROR, "Failed to read connection request\n");
       break;
     }
-    printf("Connection request received with code %d. %d connections already active\n", code, active_sessions);
+    log_msg(LOG_INFO, "Connection request received with code %d. %u connections already active\n", code,
+            atomic_load(&active_sessions));
     if (code != 1) {
-      fprintf(stderr, "Invalid connection request\n");
+      log_msg(LOG_ERROR, "Invalid connection request\n");
       continue;
     }
-    bytesRead = read(register_fd, req_pipe_path, MAX_BUFFER_SIZE);
-    if (bytesRead == -1) {
-      fprintf(stderr, "Failed to read request pipe path\n");
+    if (read_all(register_fd, req_pipe_path, MAX_BUFFER_SIZE) != 0) {
+      log_msg(LOG_ERROR, "Failed to read request pipe path\n");
       break;
     }
-    printf("Request pipe path: %s\n", req_pipe_path);
-    bytesRead = read(register_fd, resp_pipe_path, MAX_BUFFER_SIZE);
-    if (bytesRead == -1) {
-      fprintf(stderr, "Failed to read response pipe path\n");
+    log_msg(LOG_INFO, "Request pipe path: %s\n", req_pipe_path);
+    if (read_all(register_fd, resp_pipe_path, MAX_BUFFER_SIZE) != 0) {
+      log_msg(LOG_ERROR, "Failed to read response pipe path\n");
       break;
     }
-    printf("Response pipe path: %s\n", resp_pipe_path);
+    log_msg(LOG_INFO, "Response pipe path: %s\n", resp_pipe_path);
+    // Turning clients away keeps the server responsive when it can't take on more sessions
+    enum AdmissionDecision decision =
+        admission_decide(req_pipe_path, atomic_load(&active_sessions), atomic_load(&pending_sessions));
+    if (decision == REJECT) {
+      admission_reject(resp_pipe_path);
+      continue;
+    }
     // Creates session
-    Session* session = create_session(active_sessions, req_pipe_path, resp_pipe_path);
-    active_sessions++;
+    Session* session = create_session(next_session_id++, req_pipe_path, resp_pipe_path);
     if (!session) {
-      fprintf(stderr, "Failed to create session\n");
+      log_msg(LOG_ERROR, "Failed to create session\n");
       break;
     }
-    printf("Session %d created", session->id);
-    if (active_sessions > MAX_SESSIONS) {
-      printf(". Waiting for earlier sessions to finish...");
-    }
-    printf("\n\n");
-    // Queues session
-    if (enqueue_session(queue, session) != 0) {
-      fprintf(stderr, "Failed to enqueue session\n");
+    session->priority = decision == ADMIT_PRIORITY;
+    atomic_fetch_add(&active_sessions, 1);
+    atomic_fetch_add(&pending_sessions, 1);
+    log_msg(LOG_INFO, "Session %d created\n", session->id);
+    // Opening the pipes blocks until the client opens them, so it is done on a worker
+    if (pool_submit(pool, session) != 0) {
+      log_msg(LOG_ERROR, "Failed to queue session\n");
       destroy_session(session);
       break;
     }
-
-    close(register_fd);
   }
-  close(register_fd);
-  printf("\nServer terminating.\n");
+  if (register_fd != -1) close(register_fd);
+  log_msg(LOG_INFO, "Server terminating.\n");
 
-  // Wait for all worker threads to terminate
-  for (int i = 0; i < MAX_SESSIONS; i++) {
-    pthread_join(worker_threads[i], NULL);
-  }
-  destroy_session_queue(queue);
-  unlink(argv[1]);
+  // Workers finish the request they are serving and the sessions they return are closed
+  destroy_pool(pool);
+  destroy_poller(poller);
+  admission_stop();
+  stats_stop_dump();
+  dump_stop();
+#ifdef LOCK_PROFILE
+  lockprof_report(stdout, LOCKPROF_TOP_N);
+#endif
+  unlink(pipe_path);
   ems_terminate();
+  log_stop();
   return 0;
 }
 
-void list_all_info() {
-  size_t num_events, num_rows, num_cols;
-  unsigned int *event_ids, *data;
-  int ret_val = ems_list_events(&num_events, &event_ids);
-  if (ret_val == 0 && num_events > 0) {
-    printf("Displaying all event information...\n");
-    printf("Number of events: %zu\n", num_events);
-    for (size_t i = 0; i < num_events; i++) {
-      printf("Event ID: %u\n", event_ids[i]);
-      ems_show(event_ids[i], &num_rows, &num_cols, &data);
-      for (size_t j = 0; j < num_rows; j++) {
-        for (size_t k = 0; k < num_cols; k++) {
-          printf("%d", data[(j)*num_cols + (k)]);
-          if (k < num_cols - 1) printf(" ");
-        }
-        printf("\n");
-      }
-      printf("\n");
-    }
-    free(event_ids);
+enum SessionStatus session_worker(Session* session) {
+  int responses = session->responses_fd;
+  int opcode;
+  // The poller only hands the session over once a request started arriving, so the whole
+  // request has request_timeout_ms from here
+  uint64_t deadline = stats_now() + (uint64_t)request_timeout_ms * 1000000;
+  if (read_request(session, &opcode, sizeof(int), deadline) != 0 || opcode < 2) {
+    log_msg(LOG_ERROR, "Failed to read opcode (%d)\n", session->id);
+    return SESSION_FAILED;
   }
-  signal(SIGUSR1, sigusr1_handler);
-  list_all = 0;
-}
 
-int session_worker(Session* session) {
-  int requests;
-  int responses;
-  responses = open(session->responses, O_WRONLY);
-  if (responses == -1) {
-    fprintf(stderr, "Failed to open response pipe\n");
-    return 1;
-  }
-  write(responses, &session->id, sizeof(unsigned int));
-  requests = open(session->requests, O_RDONLY);
-  if (requests == -1) {
-    fprintf(stderr, "Failed to open request pipe\n");
-    return 1;
-  }
-
-  while (server_running) {
-    // char buffer[MAX_BUFFER_SIZE] = {0};
-    int opcode;
-    ssize_t bytesRead = read(requests, &opcode, sizeof(int));
-    if (bytesRead == -1 || opcode < 2) {
-      fprintf(stderr, "Failed to read opcode (%d)\n", session->id);
-      return 1;
-    }
+  stats_set_opcode(opcode);
+  uint64_t start = stats_now();
+  stats_record(STAT_QUEUE_WAIT, start - session->enqueued_at);
 
-    switch (opcode) {
-      case 2: {
-        close(requests);
-        close(responses);
-        return 0;
-      }
-      case 3: {
-        unsigned int event_id;
-        size_t num_rows, num_columns;
-        int ret_val;
-        if (read(requests, &event_id, sizeof(unsigned int)) != sizeof(unsigned int)) {
-          fprintf(stderr, "Failed to read event id (%d)\n", session->id);
-          return 1;
-        }
-        if (read(requests, &num_rows, sizeof(size_t)) != sizeof(size_t)) {
-          fprintf(stderr, "Failed to read num rows (%d)\n", session->id);
-          return 1;
+  switch (opcode) {
+    case 2:
+      return SESSION_CLOSED;
+    case 3: {
+      unsigned int event_id;
+      size_t num_rows, num_columns;
+      int ret_val;
+      if (read_request(session, &event_id, sizeof(unsigned int), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read event id (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      if (session->protocol >= PROTOCOL_V2) {
+        if (read_varint(session, &num_rows, deadline) != 0 || read_varint(session, &num_columns, deadline) != 0) {
+          log_msg(LOG_ERROR, "Failed to read event size (%d)\n", session->id);
+          return SESSION_FAILED;
         }
-        if (read(requests, &num_columns, sizeof(size_t)) != sizeof(size_t)) {
-          fprintf(stderr, "Failed to read num columns (%d)\n", session->id);
-          return 1;
+      } else if (read_request(session, &num_rows, sizeof(size_t), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read num rows (%d)\n", session->id);
+        return SESSION_FAILED;
+      } else if (read_request(session, &num_columns, sizeof(size_t), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read num columns (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      ret_val = ems_create(event_id, num_rows, num_columns);
+      if (ret_val != 0) stats_record_error();
+      if (write_response(session, &ret_val, sizeof(int)) != sizeof(int)) {
+        log_msg(LOG_ERROR, "Failed to write response (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      break;
+    }
+    case 4: {
+      unsigned int event_id;
+      size_t num_seats;
+      size_t* xs;
+      size_t* ys;
+      int ret_val;
+      if (read_request(session, &event_id, sizeof(unsigned int), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read event id (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      if (session->protocol >= PROTOCOL_V2) {
+        size_t packed_xs[MAX_RESERVATION_SIZE], packed_ys[MAX_RESERVATION_SIZE];
+        if (read_packed_seats(session, &num_seats, packed_xs, packed_ys, deadline) != 0) {
+          log_msg(LOG_ERROR, "Failed to read seats (%d)\n", session->id);
+          return SESSION_FAILED;
         }
-        ret_val = ems_create(event_id, num_rows, num_columns);
-        if (write(responses, &ret_val, sizeof(int)) != sizeof(int)) {
-          fprintf(stderr, "Failed to write response (%d)\n", session->id);
-          return 1;
+        ret_val = ems_reserve(event_id, num_seats, packed_xs, packed_ys);
+        if (ret_val != 0) stats_record_error();
+        if (write_response(session, &ret_val, sizeof(int)) != sizeof(int)) {
+          log_msg(LOG_ERROR, "Failed to write response (%d)\n", session->id);
+          return SESSION_FAILED;
         }
         break;
       }
-      case 4: {
-        unsigned int event_id;
-        size_t num_seats;
-        size_t* xs;
-        size_t* ys;
-        int ret_val;
-        if (read(requests, &event_id, sizeof(unsigned int)) != sizeof(unsigned int)) {
-          fprintf(stderr, "Failed to read event id (%d)\n", session->id);
-          close(requests);
-          close(responses);
-          return 1;
-        }
-        if (read(requests, &num_seats, sizeof(size_t)) != sizeof(size_t)) {
-          fprintf(stderr, "Failed to read num seats (%d)\n", session->id);
-          close(requests);
-          close(responses);
-          return 1;
-        }
-        xs = malloc(sizeof(size_t) * num_seats);
-        if (!xs) {
-          fprintf(stderr, "Failed to allocate memory for xs (%d)\n", session->id);
-          close(requests);
-          close(responses);
-          return 1;
-        }
-        ys = malloc(sizeof(size_t) * num_seats);
-        if (!ys) {
-          fprintf(stderr, "Failed to allocate memory for ys (%d)\n", session->id);
-          close(requests);
-          close(responses);
-          return 1;
-        }
-        if (read(requests, xs, sizeof(size_t) * num_seats) != (ssize_t)(sizeof(size_t) * num_seats)) {
-          fprintf(stderr, "Failed to read xs (%d)\n", session->id);
-          free(xs);
-          free(ys);
-          close(requests);
-          close(responses);
-          return 1;
-        }
-        if (read(requests, ys, sizeof(size_t) * num_seats) != (ssize_t)(sizeof(size_t) * num_seats)) {
-          fprintf(stderr, "Failed to read ys (%d)\n", session->id);
-          free(xs);
-          free(ys);
-          close(requests);
-          close(responses);
-          return 1;
-        }
-        ret_val = ems_reserve(event_id, num_seats, xs, ys);
-        if (write(responses, &ret_val, sizeof(int)) != sizeof(int)) {
-          fprintf(stderr, "Failed to write response (%d)\n", session->id);
-          free(xs);
-          free(ys);
-          close(requests);
-          close(responses);
-          return 1;
-        }
+      if (read_request(session, &num_seats, sizeof(size_t), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read num seats (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      xs = malloc(sizeof(size_t) * num_seats);
+      if (!xs) {
+        log_msg(LOG_ERROR, "Failed to allocate memory for xs (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      ys = malloc(sizeof(size_t) * num_seats);
+      if (!ys) {
+        log_msg(LOG_ERROR, "Failed to allocate memory for ys (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      if (read_request(session, xs, sizeof(size_t) * num_seats, deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read xs (%d)\n", session->id);
         free(xs);
         free(ys);
-        break;
+        return SESSION_FAILED;
       }
-      case 5: {
-        unsigned int event_id;
-        int ret_val;
-        size_t num_rows, num_columns;
-        unsigned int* seats;
-        if (read(requests, &event_id, sizeof(unsigned int)) != sizeof(unsigned int)) {
-          fprintf(stderr, "Failed to read event id (%d)\n", session->id);
-          close(requests);
-          close(responses);
-          return 1;
-        }
+      if (read_request(session, ys, sizeof(size_t) * num_seats, deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read ys (%d)\n", session->id);
+        free(xs);
+        free(ys);
+        return SESSION_FAILED;
+      }
+      ret_val = ems_reserve(event_id, num_seats, xs, ys);
+      if (ret_val != 0) stats_record_error();
+      if (write_response(session, &ret_val, sizeof(int)) != sizeof(int)) {
+        log_msg(LOG_ERROR, "Failed to write response (%d)\n", session->id);
+        free(xs);
+        free(ys);
+        return SESSION_FAILED;
+      }
+      free(xs);
+      free(ys);
+      break;
+    }
+    case 5: {
+      unsigned int event_id;
+      int ret_val;
+      size_t num_rows, num_columns;
+      unsigned int* seats = NULL;
+      if (read_request(session, &event_id, sizeof(unsigned int), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read event id (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      if (zero_copy_show) {
+        ret_val = ems_show_snapshot(event_id, &num_rows, &num_columns, &session->snapshot);
+      } else {
         ret_val = ems_show(event_id, &num_rows, &num_columns, &seats);
-        write(responses, &ret_val, sizeof(int));
-        if (ret_val == 0) {
-          if (write(responses, &num_rows, sizeof(size_t)) != sizeof(size_t)) {
-            fprintf(stderr, "Failed to write num rows (%d)\n", session->id);
-            close(requests);
-            close(responses);
-            return 1;
-          }
-          if (write(responses, &num_columns, sizeof(size_t)) != sizeof(size_t)) {
-            fprintf(stderr, "Failed to write num columns (%d)\n", session->id);
-            close(requests);
-            close(responses);
-            return 1;
+      }
+      if (ret_val != 0) stats_record_error();
+      write_response(session, &ret_val, sizeof(int));
+      if (ret_val == 0) {
+        if (write_response(session, &num_rows, sizeof(size_t)) != sizeof(size_t)) {
+          log_msg(LOG_ERROR, "Failed to write num rows (%d)\n", session->id);
+          return SESSION_FAILED;
+        }
+        if (write_response(session, &num_columns, sizeof(size_t)) != sizeof(size_t)) {
+          log_msg(LOG_ERROR, "Failed to write num columns (%d)\n", session->id);
+          return SESSION_FAILED;
+        }
+        if (zero_copy_show) {
+          // The seats bypass the queued response, which must reach the pipe before them
+          if (session_flush(session) != 0) {
+            log_msg(LOG_ERROR, "Failed to write seats header (%d)\n", session->id);
+            return SESSION_FAILED;
           }
-          if (write(responses, seats, sizeof(unsigned int) * num_rows * num_columns) !=
-              (ssize_t)(sizeof(unsigned int) * num_rows * num_columns)) {
-            fprintf(stderr, "Failed to write seats (%d)\n", session->id);
-            close(requests);
-            close(responses);
-            return 1;
+          uint64_t send_start = stats_now();
+          int failed = snapshot_send(&session->snapshot, responses, num_rows * num_columns);
+          stats_record(STAT_IO_WRITE, stats_now() - send_start);
+          if (failed) {
+            log_msg(LOG_ERROR, "Failed to send seats (%d)\n", session->id);
+            return SESSION_FAILED;
           }
+        } else if (write_response(session, seats, sizeof(unsigned int) * num_rows * num_columns) !=
+                   (ssize_t)(sizeof(unsigned int) * num_rows * num_columns)) {
+          log_msg(LOG_ERROR, "Failed to write seats (%d)\n", session->id);
+          return SESSION_FAILED;
         }
-        break;
       }
-      case 6: {
-        int ret_val;
-        size_t num_events;
-        unsigned int* event_ids;
-        ret_val = ems_list_events(&num_events, &event_ids);  // This function allocates memory for event_ids
-        write(responses, &ret_val, sizeof(int));
-        if (ret_val == 0) {  // If it returns 1 or num_events == 0, then there was no allocation
-          if (write(responses, &num_events, sizeof(size_t)) != sizeof(size_t)) {
-            fprintf(stderr, "Failed to write num events (%d)\n", session->id);
-            if (event_ids) {
-              free(event_ids);
-            }
-            close(requests);
-            close(responses);
-            return 1;
-          }
-          if (write(responses, event_ids, sizeof(unsigned int) * num_events) !=
-              (ssize_t)(sizeof(unsigned int) * num_events)) {
-            fprintf(stderr, "Failed to write event ids (%d)\n", session->id);
-            if (event_ids) {
-              free(event_ids);
-            }
-            close(requests);
-            close(responses);
-            return 1;
-          }
-          if (event_ids) {
-            free(event_ids);
-          }
+      break;
+    }
+    case 6: {
+      int ret_val;
+      size_t num_events;
+      unsigned int* event_ids = NULL;
+      size_t* occupancy = NULL;
+      // This function allocates memory for event_ids and occupancy
+      ret_val = ems_list_events(&num_events, &event_ids, &occupancy);
+      if (ret_val != 0) stats_record_error();
+      write_response(session, &ret_val, sizeof(int));
+      if (ret_val == 0) {  // If it returns 1 or num_events == 0, then there was no allocation
+        if (write_response(session, &num_events, sizeof(size_t)) != sizeof(size_t)) {
+          log_msg(LOG_ERROR, "Failed to write num events (%d)\n", session->id);
+          free(event_ids);
+          free(occupancy);
+          return SESSION_FAILED;
         }
-        break;
+        if (write_response(session, event_ids, sizeof(unsigned int) * num_events) !=
+                (ssize_t)(sizeof(unsigned int) * num_events) ||
+            write_response(session, occupancy, sizeof(size_t) * 2 * num_events) !=
+                (ssize_t)(sizeof(size_t) * 2 * num_events)) {
+          log_msg(LOG_ERROR, "Failed to write event ids (%d)\n", session->id);
+          free(event_ids);
+          free(occupancy);
+          return SESSION_FAILED;
+        }
+        free(event_ids);
+        free(occupancy);
+      }
+      break;
+    }
+    case 7: {
+      unsigned int event_id;
+      char notify_pipe_path[MAX_BUFFER_SIZE] = {0};
+      int ret_val = 0;
+      if (read_request(session, &event_id, sizeof(unsigned int), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read event id (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      if (read_request(session, notify_pipe_path, MAX_BUFFER_SIZE, deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read notification pipe path (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      notify_pipe_path[MAX_BUFFER_SIZE - 1] = '\0';
+      // The first subscription decides the notification pipe for the whole session
+      if (!session->subscriber) {
+        session->subscriber = create_subscriber(notify_pipe_path);
+      }
+      ret_val = subscribe_event(session->subscriber, event_id);
+      if (ret_val != 0) stats_record_error();
+      if (write_response(session, &ret_val, sizeof(int)) != sizeof(int)) {
+        log_msg(LOG_ERROR, "Failed to write response (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      break;
+    }
+    case 8: {
+      unsigned int event_id;
+      int ret_val;
+      if (read_request(session, &event_id, sizeof(unsigned int), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read event id (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      ret_val = unsubscribe_event(session->subscriber, event_id);
+      if (ret_val != 0) stats_record_error();
+      if (write_response(session, &ret_val, sizeof(int)) != sizeof(int)) {
+        log_msg(LOG_ERROR, "Failed to write response (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      break;
+    }
+    case 9: {
+      size_t num_ops, len;
+      char* ops;
+      if (read_request(session, &num_ops, sizeof(size_t), deadline) != 0 ||
+          read_request(session, &len, sizeof(size_t), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read batch header (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      if (len > MAX_BATCH_SIZE) {
+        log_msg(LOG_ERROR, "Batch too large (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      ops = malloc(len + 1);
+      if (!ops) {
+        log_msg(LOG_ERROR, "Failed to allocate memory for batch (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      if (read_request(session, ops, len, deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read batch (%d)\n", session->id);
+        free(ops);
+        return SESSION_FAILED;
+      }
+      if (session_flush(session) != 0 || execute_batch(responses, ops, len, num_ops) != 0) {
+        log_msg(LOG_ERROR, "Failed to write batch responses (%d)\n", session->id);
+        free(ops);
+        return SESSION_FAILED;
+      }
+      free(ops);
+      break;
+    }
+    case 10: {
+      int ret_val = 0;
+      size_t len;
+      char* csv = stats_csv(&len);
+      if (!csv) ret_val = 1;
+      if (write_response(session, &ret_val, sizeof(int)) != sizeof(int)) {
+        log_msg(LOG_ERROR, "Failed to write response (%d)\n", session->id);
+        free(csv);
+        return SESSION_FAILED;
+      }
+      if (ret_val == 0) {
+        size_t header_len = strlen(STATS_CSV_HEADER);
+        size_t total_len = header_len + len;
+        if (write_response(session, &total_len, sizeof(size_t)) != sizeof(size_t) ||
+            write_response(session, STATS_CSV_HEADER, header_len) != (ssize_t)header_len ||
+            write_response(session, csv, len) != (ssize_t)len) {
+          log_msg(LOG_ERROR, "Failed to write stats (%d)\n", session->id);
+          free(csv);
+          return SESSION_FAILED;
+        }
+      }
+      free(csv);
+      break;
+    }
+    case 11: {
+      unsigned int event_id, ttl_s, hold_id = 0;
+      size_t num_seats;
+      int ret_val;
+      if (read_request(session, &event_id, sizeof(unsigned int), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read event id (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      if (read_request(session, &num_seats, sizeof(size_t), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read num seats (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      // The rest of the request can't be skipped reliably, so an invalid size ends the session
+      if (num_seats == 0 || num_seats > MAX_RESERVATION_SIZE) {
+        log_msg(LOG_ERROR, "Invalid num seats %zu (%d)\n", num_seats, session->id);
+        return SESSION_FAILED;
       }
+      size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+      if (read_request(session, xs, sizeof(size_t) * num_seats, deadline) != 0 ||
+          read_request(session, ys, sizeof(size_t) * num_seats, deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read seats (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      if (read_request(session, &ttl_s, sizeof(unsigned int), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read hold duration (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      ret_val = ems_hold(event_id, num_seats, xs, ys, ttl_s, &hold_id);
+      if (ret_val != 0) stats_record_error();
+      if (write_response(session, &ret_val, sizeof(int)) != sizeof(int) ||
+          (ret_val == 0 && write_response(session, &hold_id, sizeof(unsigned int)) != sizeof(unsigned int))) {
+        log_msg(LOG_ERROR, "Failed to write response (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      break;
+    }
+    case 12: {
+      unsigned int hold_id;
+      if (read_request(session, &hold_id, sizeof(unsigned int), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read hold id (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      int ret_val = ems_confirm(hold_id);
+      if (ret_val != 0) stats_record_error();
+      if (write_response(session, &ret_val, sizeof(int)) != sizeof(int)) {
+        log_msg(LOG_ERROR, "Failed to write response (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      break;
+    }
+    case 13: {
+      unsigned int event_id;
+      size_t num_seats;
+      char notify_pipe_path[MAX_BUFFER_SIZE] = {0};
+      if (read_request(session, &event_id, sizeof(unsigned int), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read event id (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      if (read_request(session, &num_seats, sizeof(size_t), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read num seats (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      if (read_request(session, notify_pipe_path, MAX_BUFFER_SIZE, deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read notification pipe path (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      notify_pipe_path[MAX_BUFFER_SIZE - 1] = '\0';
+      // Fulfilled requests arrive on the same pipe as subscriptions
+      if (!session->subscriber) {
+        session->subscriber = create_subscriber(notify_pipe_path);
+      }
+      session->waitlisted = 1;
+      int ret_val = ems_waitlist(event_id, num_seats, session->subscriber);
+      if (ret_val != 0) stats_record_error();
+      if (write_response(session, &ret_val, sizeof(int)) != sizeof(int)) {
+        log_msg(LOG_ERROR, "Failed to write response (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      break;
+    }
+    case 14: {
+      unsigned int event_id;
+      size_t num_rows, num_cols, occupied;
+      size_t* row_occupied = NULL;
+      if (read_request(session, &event_id, sizeof(unsigned int), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read event id (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      int ret_val = ems_event_stats(event_id, &num_rows, &num_cols, &occupied, &row_occupied);
+      if (ret_val != 0) stats_record_error();
+      if (write_response(session, &ret_val, sizeof(int)) != sizeof(int)) {
+        log_msg(LOG_ERROR, "Failed to write response (%d)\n", session->id);
+        free(row_occupied);
+        return SESSION_FAILED;
+      }
+      if (ret_val == 0) {
+        size_t header[3] = {num_rows, num_cols, occupied};
+        if (write_response(session, header, sizeof(header)) != sizeof(header) ||
+            write_response(session, row_occupied, sizeof(size_t) * num_rows) != (ssize_t)(sizeof(size_t) * num_rows)) {
+          log_msg(LOG_ERROR, "Failed to write event stats (%d)\n", session->id);
+          free(row_occupied);
+          return SESSION_FAILED;
+        }
+        free(row_occupied);
+      }
+      break;
+    }
+    case 15: {
+      unsigned int version;
+      if (read_request(session, &version, sizeof(unsigned int), deadline) != 0) {
+        log_msg(LOG_ERROR, "Failed to read protocol version (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      // Both sides speak every version up to their newest, so the older of the two is used
+      session->protocol = version < PROTOCOL_V1 ? PROTOCOL_V1 : version > PROTOCOL_VERSION ? PROTOCOL_VERSION : version;
+      int ret_val = 0;
+      if (write_response(session, &ret_val, sizeof(int)) != sizeof(int) ||
+          write_response(session, &session->protocol, sizeof(unsigned int)) != sizeof(unsigned int)) {
+        log_msg(LOG_ERROR, "Failed to write response (%d)\n", session->id);
+        return SESSION_FAILED;
+      }
+      break;
     }
   }
-  // Only reachable if interrupted mid session
-  if (requests != -1) close(requests);
-  if (responses != -1) close(responses);
-  return 0;
+  stats_record(STAT_SERVICE, stats_now() - start);
+  return SESSION_OPEN;
 }
\ No newline at end of file
@@ -1,4 +1,7 @@
+#include <errno.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,22 +9,119 @@
 #include <unistd.h>
 
 #include "common/io.h"
+#include "eventcache.h"
 #include "eventlist.h"
+#include "holds.h"
+#include "lockprof.h"
+#include "log.h"
+#include "operations.h"
+#include "stats.h"
+#include "subscriptions.h"
 
 static struct EventList* event_list = NULL;
 static unsigned int state_access_delay_us = 0;
 
+// Each thread copies the seats it shows into its own buffer, reused across calls
+static _Thread_local unsigned int* show_buffer = NULL;
+static _Thread_local size_t show_capacity = 0;
+static pthread_key_t show_buffer_key;
+static pthread_once_t show_buffer_once = PTHREAD_ONCE_INIT;
+
+static void create_show_buffer_key(void) { pthread_key_create(&show_buffer_key, free); }
+
+// Combining slot the calling thread published to last, it is usually free again by the next time
+static _Thread_local size_t combine_slot = 0;
+
 /// Gets the event with the given ID from the state.
 /// @note Will wait to simulate a real system accessing a costly memory resource.
 /// @param event_id The ID of the event to get.
-/// @param from First node to be searched.
-/// @param to Last node to be searched.
 /// @return Pointer to the event if found, NULL otherwise.
-static struct Event* get_event_with_delay(unsigned int event_id, struct ListNode* from, struct ListNode* to) {
+static struct Event* get_event_with_delay(unsigned int event_id) {
+  uint64_t start = stats_now();
   struct timespec delay = {0, state_access_delay_us * 1000};
   nanosleep(&delay, NULL);  // Should not be removed
 
-  return get_event(event_list, event_id, from, to);
+  struct Event* event = get_event(event_list, event_id);
+  stats_record(STAT_STATE_ACCESS, stats_now() - start);
+  return event;
+}
+
+/// Gets the event with the given ID, from the hot event cache if possible.
+/// @note The event list must be locked.
+/// @param event_id The ID of the event to get.
+/// @return Pointer to the event if found, NULL otherwise.
+static struct Event* find_event(unsigned int event_id) {
+  uint64_t start = stats_now();
+  struct Event* event = event_cache_lookup(event_id);
+  if (event) {
+    stats_record(STAT_CACHE_HIT, stats_now() - start);
+    return event;
+  }
+
+  event = get_event_with_delay(event_id);
+  if (event) event_cache_insert(event);
+  return event;
+}
+
+/// Locks the event list for reading, recording how long the lock took to acquire.
+/// @return 0 if the lock was acquired, an error number otherwise.
+static int lock_list_read(void) {
+  uint64_t start = stats_now();
+  int ret = lockprof_rdlock(&event_list->rwl);
+  stats_record(STAT_LOCK_WAIT, stats_now() - start);
+  return ret;
+}
+
+/// Locks the event list for writing, recording how long the lock took to acquire.
+/// @return 0 if the lock was acquired, an error number otherwise.
+static int lock_list_write(void) {
+  uint64_t start = stats_now();
+  int ret = lockprof_wrlock(&event_list->rwl);
+  stats_record(STAT_LOCK_WAIT, stats_now() - start);
+  return ret;
+}
+
+/// Locks an event, recording how long the lock took to acquire.
+/// @return 0 if the lock was acquired, an error number otherwise.
+static int lock_event(struct Event* event) {
+  uint64_t start = stats_now();
+  int ret = lockprof_lock(&event->mutex, event->id);
+  stats_record(STAT_LOCK_WAIT, stats_now() - start);
+  return ret;
+}
+
+/// Copies part of an event written under its mutex, without taking it unless reservations keep
+/// changing it.
+/// @param event Event to copy from.
+/// @param copy Buffer of at least len bytes.
+/// @param source Seats or counters of the event.
+/// @param len Bytes to copy.
+/// @return 0 if a consistent copy was made, 1 otherwise.
+static int read_consistent(struct Event* event, void* copy, const void* source, size_t len) {
+  for (int attempt = 0; attempt < SHOW_OPTIMISTIC_RETRIES; attempt++) {
+    unsigned int before = atomic_load_explicit(&event->seq, memory_order_acquire);
+    if (before & 1) continue;  // A reservation is half way through
+    memcpy(copy, source, len);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&event->seq, memory_order_relaxed) == before) return 0;
+  }
+
+  // Under constant writes, give up on optimism rather than starve
+  if (lock_event(event) != 0) {
+    log_msg(LOG_ERROR, "Error locking mutex\n");
+    return 1;
+  }
+  memcpy(copy, source, len);
+  lockprof_unlock(&event->mutex, event->id);
+  return 0;
+}
+
+/// Copies an event's seats, see read_consistent().
+/// @param event Event to copy.
+/// @param seats Array of at least rows * cols seats.
+/// @return 0 if a consistent copy was made, 1 otherwise.
+static int read_seats(struct Event* event, unsigned int* seats) {
+  return read_consistent(event, seats, event->data, sizeof(unsigned int) * event->rows * event->cols);
 }
 
 /// Gets the index of a seat.
@@ -32,6 +132,232 @@ static struct Event* get_event_with_delay(unsigned int event_id, struct ListNode
 /// @return Index of the seat.
 static size_t seat_index(struct Event* event, size_t row, size_t col) { return (row - 1) * event->cols + col - 1; }
 
+/// Assigns a seat to a reservation, keeping the occupancy counts up to date. Must be called between
+/// begin_write() and end_write().
+static void take_seat(struct Event* event, size_t index, unsigned int reservation_id) {
+  if (event->data[index] == 0) {
+    event->row_occupied[index / event->cols]++;
+    atomic_store_explicit(&event->occupied, atomic_load_explicit(&event->occupied, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+  }
+  event->data[index] = reservation_id;
+}
+
+/// Frees a taken seat, see take_seat().
+static void free_seat(struct Event* event, size_t index) {
+  event->data[index] = 0;
+  event->row_occupied[index / event->cols]--;
+  atomic_store_explicit(&event->occupied, atomic_load_explicit(&event->occupied, memory_order_relaxed) - 1,
+                        memory_order_relaxed);
+}
+
+/// Marks the seats of an event as being written, so optimistic readers retry. Must be called with
+/// the event mutex held.
+static void begin_write(struct Event* event) {
+  unsigned int seq = atomic_load_explicit(&event->seq, memory_order_relaxed);
+  atomic_store_explicit(&event->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+/// Publishes the seats written since begin_write().
+static void end_write(struct Event* event) {
+  atomic_store_explicit(&event->seq, atomic_load_explicit(&event->seq, memory_order_relaxed) + 1,
+                        memory_order_release);
+}
+
+/// Reserves seats if they are all valid and free. Must be called between begin_write() and end_write().
+/// @param reservation_id Pointer to store the id of the new reservation in.
+/// @param version Pointer to store the event version after the reservation in.
+/// @return 0 if the seats were reserved, 1 otherwise.
+static int apply_reservation(struct Event* event, size_t num_seats, size_t* xs, size_t* ys,
+                             unsigned int* reservation_id, unsigned int* version) {
+  for (size_t i = 0; i < num_seats; i++) {
+    if (xs[i] <= 0 || xs[i] > event->rows || ys[i] <= 0 || ys[i] > event->cols) {
+      log_msg(LOG_DEBUG, "Seat out of bounds\n");
+      return 1;
+    }
+  }
+
+  for (size_t i = 0; i < num_seats; i++) {
+    if (event->data[seat_index(event, xs[i], ys[i])] != 0) {
+      log_msg(LOG_DEBUG, "Seat already reserved\n");
+      return 1;
+    }
+  }
+
+  *reservation_id = ++event->reservations;
+  for (size_t i = 0; i < num_seats; i++) {
+    take_seat(event, seat_index(event, xs[i], ys[i]), *reservation_id);
+  }
+  *version = ++event->version;
+  return 0;
+}
+
+// A reservation waiting for the combiner of a hot event. Lives on the waiting thread's stack.
+struct ReserveRequest {
+  size_t num_seats;
+  size_t* xs;
+  size_t* ys;
+  unsigned int reservation_id;
+  unsigned int version;
+  atomic_int status;  // RESERVE_PENDING until a combiner applied it, then 0 or 1
+};
+
+#define RESERVE_PENDING -1
+
+/// Turns on flat combining for an event whose mutex keeps being contended.
+static void start_combining(struct Event* event) {
+  struct CombineSlots* slots = calloc(1, sizeof(struct CombineSlots));
+  if (slots == NULL) return;  // Reservations keep queueing on the mutex
+  struct CombineSlots* expected = NULL;
+  if (!atomic_compare_exchange_strong(&event->combining, &expected, slots)) {
+    free(slots);
+    return;
+  }
+  log_msg(LOG_INFO, "Event %u is hot, combining its reservations\n", event->id);
+}
+
+/// Applies every reservation published on a hot event, in one pass under the mutex the caller holds,
+/// and publishes the ones that succeeded. Must be called between begin_write() and end_write().
+static void combine_reservations(struct Event* event, struct CombineSlots* slots) {
+  for (size_t i = 0; i < COMBINE_SLOTS; i++) {
+    struct ReserveRequest* request = atomic_exchange_explicit(&slots->requests[i], NULL, memory_order_acquire);
+    if (request == NULL) continue;
+    int ret = apply_reservation(event, request->num_seats, request->xs, request->ys, &request->reservation_id,
+                                &request->version);
+    if (ret == 0) {
+      publish_reservation(event->id, request->version, request->reservation_id, request->num_seats, request->xs,
+                          request->ys);
+    }
+    // The request may go out of scope as soon as its status is set
+    atomic_store_explicit(&request->status, ret, memory_order_release);
+  }
+}
+
+/// Reserves seats on a hot event: the request is published to the event's slots and applied by
+/// whichever thread holds the mutex next, possibly this one, together with the other waiting requests.
+/// @return 0 if the seats were reserved, 1 otherwise.
+static int reserve_combining(struct Event* event, struct CombineSlots* slots, size_t num_seats, size_t* xs,
+                             size_t* ys) {
+  struct ReserveRequest request = {num_seats, xs, ys, 0, 0, RESERVE_PENDING};
+  uint64_t start = stats_now();
+
+  size_t slot = 0;
+  for (; slot < COMBINE_SLOTS; slot++) {
+    struct ReserveRequest* expected = NULL;
+    if (atomic_compare_exchange_strong_explicit(&slots->requests[(combine_slot + slot) % COMBINE_SLOTS], &expected,
+                                                &request, memory_order_release, memory_order_relaxed)) {
+      break;
+    }
+  }
+
+  if (slot == COMBINE_SLOTS) {
+    // Every slot is taken, wait for the mutex like any other reservation
+    if (lock_event(event) != 0) {
+      log_msg(LOG_ERROR, "Error locking mutex\n");
+      return 1;
+    }
+    begin_write(event);
+    int ret = apply_reservation(event, num_seats, xs, ys, &request.reservation_id, &request.version);
+    if (ret == 0) publish_reservation(event->id, request.version, request.reservation_id, num_seats, xs, ys);
+    combine_reservations(event, slots);
+    end_write(event);
+    lockprof_unlock(&event->mutex, event->id);
+    atomic_store_explicit(&request.status, ret, memory_order_relaxed);
+  } else {
+    combine_slot = (combine_slot + slot) % COMBINE_SLOTS;
+    while (atomic_load_explicit(&request.status, memory_order_acquire) == RESERVE_PENDING) {
+      if (lockprof_trylock(&event->mutex, event->id) == 0) {
+        begin_write(event);
+        combine_reservations(event, slots);
+        end_write(event);
+        lockprof_unlock(&event->mutex, event->id);
+      } else {
+        sched_yield();
+      }
+    }
+    stats_record(STAT_LOCK_WAIT, stats_now() - start);
+  }
+
+  // Already published by whichever thread applied it
+  return atomic_load_explicit(&request.status, memory_order_relaxed);
+}
+
+/// Reserves seats for the waitlisted requests, oldest first, for as long as the oldest one fits. A
+/// request is never skipped, so a large one can't be starved by the smaller ones behind it.
+/// Must be called between begin_write() and end_write().
+static void serve_waitlist(struct Event* event) {
+  if (event->waitlist == NULL) return;
+
+  size_t num_free = event->rows * event->cols - atomic_load_explicit(&event->occupied, memory_order_relaxed);
+  size_t next_seat = 0;  // Every seat before it is taken
+  while (event->waitlist && event->waitlist->num_seats <= num_free) {
+    struct WaitEntry* entry = event->waitlist;
+    size_t* xs = malloc(2 * entry->num_seats * sizeof(size_t));
+    if (xs == NULL) {
+      log_msg(LOG_ERROR, "Error allocating memory for waitlisted seats\n");
+      return;  // Tried again on the next release
+    }
+    size_t* ys = xs + entry->num_seats;
+
+    unsigned int reservation_id = ++event->reservations;
+    for (size_t i = 0; i < entry->num_seats; next_seat++) {
+      if (next_seat % event->cols == 0 && event->row_occupied[next_seat / event->cols] == event->cols) {
+        next_seat += event->cols - 1;  // Full row
+        continue;
+      }
+      if (event->data[next_seat] != 0) continue;
+      take_seat(event, next_seat, reservation_id);
+      xs[i] = next_seat / event->cols + 1;
+      ys[i] = next_seat % event->cols + 1;
+      i++;
+    }
+    unsigned int version = ++event->version;
+    num_free -= entry->num_seats;
+
+    event->waitlist = entry->next;
+    if (event->waitlist == NULL) event->waitlist_tail = NULL;
+    event->waitlist_len--;
+    // Both only queue records, they never wait on a pipe. Staying under the mutex is what keeps the
+    // subscriber alive, see ems_waitlist_cancel()
+    if (notify_subscriber(entry->subscriber, NOTIFY_WAITLISTED, event->id, version, reservation_id,
+                          entry->num_seats, xs, ys) != 0) {
+      log_msg(LOG_ERROR, "Failed to notify waitlisted reservation %u\n", reservation_id);
+    }
+    publish_reservation(event->id, version, reservation_id, entry->num_seats, xs, ys);
+    free(xs);
+    free(entry);
+  }
+}
+
+/// Gives the seats of an expired hold back, under the event's mutex like any reservation. Seats
+/// no longer under the hold's reservation, such as after ems_clear_event(), are left alone.
+static void release_hold(unsigned int event_id, unsigned int reservation_id, size_t num_seats, size_t* xs,
+                         size_t* ys) {
+  if (lock_list_read() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
+    return;
+  }
+  struct Event* event = find_event(event_id);
+  lockprof_rwunlock(&event_list->rwl);
+  if (event == NULL) return;
+
+  if (lock_event(event) != 0) {
+    log_msg(LOG_ERROR, "Error locking mutex\n");
+    return;
+  }
+  begin_write(event);
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t index = seat_index(event, xs[i], ys[i]);
+    if (event->data[index] == reservation_id) free_seat(event, index);
+  }
+  // Published under the mutex, so subscribers see the release before the waitlist takes the seats
+  publish_release(event_id, ++event->version, reservation_id, num_seats, xs, ys);
+  serve_waitlist(event);
+  end_write(event);
+  lockprof_unlock(&event->mutex, event->id);
+}
+
 volatile sig_atomic_t terminate_ems = 0;
 
 // Handles SIGTERM
@@ -57,8 +383,15 @@ int ems_init(unsigned int delay_us) {
 
   event_list = create_list();
   state_access_delay_us = delay_us;
+  if (event_list == NULL) return 1;
 
-  return event_list == NULL;
+  if (holds_start(release_hold) != 0) {
+    fprintf(stderr, "Error starting the hold expiry thread\n");
+    free_list(event_list);
+    event_list = NULL;
+    return 1;
+  }
+  return 0;
 }
 
 int ems_terminate() {
@@ -67,210 +400,608 @@ int ems_terminate() {
   }
 
   if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
+    log_msg(LOG_ERROR, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_wrlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+  // Expiries look events up, so they must be over before the list goes away
+  holds_stop();
+
+  if (lock_list_write() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
     return 1;
   }
 
+  event_cache_clear();
+  // The lock lives inside the list, so it must be released before the list is freed
+  lockprof_rwunlock(&event_list->rwl);
   free_list(event_list);
-  pthread_rwlock_unlock(&event_list->rwl);
+  event_list = NULL;
+  return 0;
+}
+
+/// Sets up a new event with free seats.
+/// @return 0 if the event was set up, 1 otherwise, with nothing left allocated.
+static int init_event(struct Event* event, unsigned int event_id, size_t num_rows, size_t num_cols) {
+  event->id = event_id;
+  event->rows = num_rows;
+  event->cols = num_cols;
+  event->reservations = 0;
+  event->version = 0;
+  event->waitlist = NULL;
+  event->waitlist_tail = NULL;
+  event->waitlist_len = 0;
+  atomic_init(&event->occupied, 0);
+  atomic_init(&event->seq, 0);
+  atomic_init(&event->contended, 0);
+  atomic_init(&event->combining, NULL);
+  if (pthread_mutex_init(&event->mutex, NULL) != 0) return 1;
+  event->data = alloc_seats(sizeof(unsigned int) * num_rows * num_cols);
+  event->row_occupied = calloc(num_rows, sizeof(size_t));
+
+  if (event->data == NULL || event->row_occupied == NULL) {
+    log_msg(LOG_ERROR, "Error allocating memory for event data\n");
+    free(event->data);
+    free(event->row_occupied);
+    pthread_mutex_destroy(&event->mutex);
+    return 1;
+  }
   return 0;
 }
 
 int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
   if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
+    log_msg(LOG_ERROR, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_wrlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+  if (lock_list_write() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
     return 1;
   }
 
-  if (get_event_with_delay(event_id, event_list->head, event_list->tail) != NULL) {
-    fprintf(stderr, "Event already exists\n");
-    pthread_rwlock_unlock(&event_list->rwl);
+  if (find_event(event_id) != NULL) {
+    log_msg(LOG_DEBUG, "Event already exists\n");
+    lockprof_rwunlock(&event_list->rwl);
     return 1;
   }
 
-  struct Event* event = malloc(sizeof(struct Event));
+  struct Event* event = alloc_event(event_list);
 
   if (event == NULL) {
-    fprintf(stderr, "Error allocating memory for event\n");
-    pthread_rwlock_unlock(&event_list->rwl);
+    log_msg(LOG_ERROR, "Error allocating memory for event\n");
+    lockprof_rwunlock(&event_list->rwl);
     return 1;
   }
 
-  event->id = event_id;
-  event->rows = num_rows;
-  event->cols = num_cols;
-  event->reservations = 0;
-  if (pthread_mutex_init(&event->mutex, NULL) != 0) {
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event);
+  // Until it is appended, the slot is simply handed out again
+  if (init_event(event, event_id, num_rows, num_cols) != 0) {
+    lockprof_rwunlock(&event_list->rwl);
     return 1;
   }
-  event->data = calloc(num_rows * num_cols, sizeof(unsigned int));
 
-  if (event->data == NULL) {
-    fprintf(stderr, "Error allocating memory for event data\n");
-    pthread_rwlock_unlock(&event_list->rwl);
-    free(event);
+  if (append_to_list(event_list, event) != 0) {
+    log_msg(LOG_ERROR, "Error appending event to list\n");
+    lockprof_rwunlock(&event_list->rwl);
+    free(event->data);
+    free(event->row_occupied);
     return 1;
   }
+  event_cache_insert(event);  // New events tend to be used right away
 
-  if (append_to_list(event_list, event) != 0) {
-    fprintf(stderr, "Error appending event to list\n");
-    pthread_rwlock_unlock(&event_list->rwl);
+  lockprof_rwunlock(&event_list->rwl);
+  return 0;
+}
+
+struct Event** ems_preload_begin(size_t num_events) {
+  if (event_list == NULL) {
+    log_msg(LOG_ERROR, "EMS state must be initialized\n");
+    return NULL;
+  }
+
+  struct Event** events = malloc(sizeof(struct Event*) * (num_events + 1));
+  if (events == NULL) {
+    log_msg(LOG_ERROR, "Error allocating memory for preloaded events\n");
+    return NULL;
+  }
+  if (lock_list_write() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
+    free(events);
+    return NULL;
+  }
+  int failed = alloc_events(event_list, num_events, events);
+  lockprof_rwunlock(&event_list->rwl);
+  if (failed) {
+    log_msg(LOG_ERROR, "Error allocating memory for preloaded events\n");
+    free(events);
+    return NULL;
+  }
+  return events;
+}
+
+int ems_preload_event(struct Event* event, unsigned int event_id, size_t num_rows, size_t num_cols, size_t num_seats,
+                      size_t* xs, size_t* ys) {
+  if (num_rows == 0 || num_cols == 0 || num_rows > SIZE_MAX / sizeof(unsigned int) / num_cols) return 1;
+  if (init_event(event, event_id, num_rows, num_cols) != 0) return 1;
+  if (num_seats == 0) return 0;
+
+  // Nobody else can see the event yet, so the seats are taken without its mutex
+  unsigned int reservation_id, version;
+  if (apply_reservation(event, num_seats, xs, ys, &reservation_id, &version) != 0) {
     free(event->data);
-    free(event);
+    free(event->row_occupied);
+    pthread_mutex_destroy(&event->mutex);
     return 1;
   }
-
-  pthread_rwlock_unlock(&event_list->rwl);
   return 0;
 }
 
+int ems_preload_end(struct Event** events, size_t num_events, size_t* num_created) {
+  *num_created = 0;
+  if (lock_list_write() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
+    free(events);
+    return 1;
+  }
+  size_t left_out;
+  int ret = append_events(event_list, events, num_events, &left_out);
+  lockprof_rwunlock(&event_list->rwl);
+  if (ret != 0) {
+    log_msg(LOG_ERROR, "Error appending preloaded events to list\n");
+    for (size_t i = 0; i < num_events; i++) {
+      if (events[i] == NULL) continue;
+      free(events[i]->data);
+      free(events[i]->row_occupied);
+    }
+  } else {
+    for (size_t i = 0; i < num_events; i++) *num_created += events[i] != NULL;
+    if (left_out > 0) log_msg(LOG_WARN, "%zu preloaded events already existed and were left out\n", left_out);
+  }
+  free(events);
+  return ret;
+}
+
 int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
   if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
+    log_msg(LOG_ERROR, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+  if (lock_list_read() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
     return 1;
   }
 
-  struct Event* event = get_event_with_delay(event_id, event_list->head, event_list->tail);
+  struct Event* event = find_event(event_id);
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  lockprof_rwunlock(&event_list->rwl);
 
   if (event == NULL) {
-    fprintf(stderr, "Event not found\n");
+    log_msg(LOG_DEBUG, "Event not found\n");
     return 1;
   }
 
-  if (pthread_mutex_lock(&event->mutex) != 0) {
-    fprintf(stderr, "Error locking mutex\n");
+  struct CombineSlots* slots = atomic_load_explicit(&event->combining, memory_order_acquire);
+  if (slots) return reserve_combining(event, slots, num_seats, xs, ys);
+
+  int ret = lockprof_trylock(&event->mutex, event->id);
+  if (ret == 0) stats_record(STAT_LOCK_WAIT, 0);
+  if (ret == EBUSY) {
+    if (atomic_fetch_add_explicit(&event->contended, 1, memory_order_relaxed) + 1 == COMBINE_THRESHOLD) {
+      start_combining(event);
+    }
+    ret = lock_event(event);
+  }
+  if (ret != 0) {
+    log_msg(LOG_ERROR, "Error locking mutex\n");
     return 1;
   }
 
-  for (size_t i = 0; i < num_seats; i++) {
-    if (xs[i] <= 0 || xs[i] > event->rows || ys[i] <= 0 || ys[i] > event->cols) {
-      fprintf(stderr, "Seat out of bounds\n");
-      pthread_mutex_unlock(&event->mutex);
-      return 1;
-    }
+  unsigned int reservation_id, version;
+  begin_write(event);
+  ret = apply_reservation(event, num_seats, xs, ys, &reservation_id, &version);
+  // Published under the mutex, like every other change, so subscribers see versions in order.
+  // Publishing only queues records, it never waits on a subscriber's pipe
+  if (ret == 0) publish_reservation(event_id, version, reservation_id, num_seats, xs, ys);
+  // The event may have turned hot while this thread waited for the mutex
+  slots = atomic_load_explicit(&event->combining, memory_order_acquire);
+  if (slots) combine_reservations(event, slots);
+  end_write(event);
+  lockprof_unlock(&event->mutex, event->id);
+  return ret != 0;
+}
+
+int ems_hold(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys, unsigned int ttl_s,
+             unsigned int* hold_id) {
+  if (event_list == NULL) {
+    log_msg(LOG_ERROR, "EMS state must be initialized\n");
+    return 1;
   }
 
-  for (size_t i = 0; i < event->rows * event->cols; i++) {
-    for (size_t j = 0; j < num_seats; j++) {
-      if (seat_index(event, xs[j], ys[j]) != i) {
-        continue;
-      }
+  if (ttl_s == 0 || ttl_s > HOLD_MAX_TTL_S) {
+    log_msg(LOG_DEBUG, "Invalid hold duration\n");
+    return 1;
+  }
 
-      if (event->data[i] != 0) {
-        fprintf(stderr, "Seat already reserved\n");
-        pthread_mutex_unlock(&event->mutex);
-        return 1;
-      }
+  if (lock_list_read() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
+    return 1;
+  }
+  struct Event* event = find_event(event_id);
+  lockprof_rwunlock(&event_list->rwl);
 
-      break;
-    }
+  if (event == NULL) {
+    log_msg(LOG_DEBUG, "Event not found\n");
+    return 1;
+  }
+
+  // Holds are rare next to plain reservations, so they always queue on the mutex
+  if (lock_event(event) != 0) {
+    log_msg(LOG_ERROR, "Error locking mutex\n");
+    return 1;
+  }
+  unsigned int reservation_id, version;
+  begin_write(event);
+  int ret = apply_reservation(event, num_seats, xs, ys, &reservation_id, &version);
+  // Published under the mutex, and so before the timer is armed: subscribers never see a short hold
+  // released before it was reserved, nor its version after a later change
+  if (ret == 0) publish_reservation(event_id, version, reservation_id, num_seats, xs, ys);
+  struct CombineSlots* slots = atomic_load_explicit(&event->combining, memory_order_acquire);
+  if (slots) combine_reservations(event, slots);
+  end_write(event);
+  lockprof_unlock(&event->mutex, event->id);
+  if (ret != 0) return 1;
+
+  if (holds_add(event_id, reservation_id, num_seats, xs, ys, ttl_s, hold_id) != 0) {
+    // Without a timer the seats would stay taken forever. Subscribers see them released again
+    release_hold(event_id, reservation_id, num_seats, xs, ys);
+    return 1;
   }
+  return 0;
+}
 
-  unsigned int reservation_id = ++event->reservations;
+int ems_confirm(unsigned int hold_id) { return holds_confirm(hold_id); }
 
-  for (size_t i = 0; i < num_seats; i++) {
-    event->data[seat_index(event, xs[i], ys[i])] = reservation_id;
+int ems_waitlist(unsigned int event_id, size_t num_seats, struct Subscriber* subscriber) {
+  if (event_list == NULL) {
+    log_msg(LOG_ERROR, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  if (subscriber == NULL) return 1;
+
+  if (lock_list_read() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
+    return 1;
+  }
+  struct Event* event = find_event(event_id);
+  lockprof_rwunlock(&event_list->rwl);
+
+  if (event == NULL) {
+    log_msg(LOG_DEBUG, "Event not found\n");
+    return 1;
+  }
+  if (num_seats == 0 || num_seats > event->rows * event->cols) {
+    log_msg(LOG_DEBUG, "Invalid number of seats\n");
+    return 1;
+  }
+
+  struct WaitEntry* entry = malloc(sizeof(struct WaitEntry));
+  if (entry == NULL) {
+    log_msg(LOG_ERROR, "Error allocating memory for waitlist entry\n");
+    return 1;
   }
+  entry->next = NULL;
+  entry->subscriber = subscriber;
+  entry->num_seats = num_seats;
 
-  pthread_mutex_unlock(&event->mutex);
+  if (lock_event(event) != 0) {
+    log_msg(LOG_ERROR, "Error locking mutex\n");
+    free(entry);
+    return 1;
+  }
+  if (event->waitlist_len >= WAITLIST_MAX_PENDING) {
+    lockprof_unlock(&event->mutex, event->id);
+    log_msg(LOG_DEBUG, "Waitlist full\n");
+    free(entry);
+    return 1;
+  }
+  if (event->waitlist_tail) {
+    event->waitlist_tail->next = entry;
+  } else {
+    event->waitlist = entry;
+  }
+  event->waitlist_tail = entry;
+  event->waitlist_len++;
+
+  // Only served right away when nobody else is waiting, the rest is up to releases
+  if (event->waitlist == entry) {
+    begin_write(event);
+    serve_waitlist(event);
+    end_write(event);
+  }
+  lockprof_unlock(&event->mutex, event->id);
   return 0;
 }
 
+void ems_waitlist_cancel(struct Subscriber* subscriber) {
+  if (event_list == NULL || subscriber == NULL) return;
+
+  if (lock_list_read() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
+    return;
+  }
+  for (size_t i = 0; i < event_list->num_events; i++) {
+    struct Event* event = event_list->events[i];
+    if (lock_event(event) != 0) {
+      log_msg(LOG_ERROR, "Error locking mutex\n");
+      continue;
+    }
+    struct WaitEntry* head = event->waitlist;
+    struct WaitEntry* last = NULL;
+    for (struct WaitEntry** link = &event->waitlist; *link;) {
+      struct WaitEntry* entry = *link;
+      if (entry->subscriber == subscriber) {
+        *link = entry->next;
+        event->waitlist_len--;
+        free(entry);
+      } else {
+        last = entry;
+        link = &entry->next;
+      }
+    }
+    event->waitlist_tail = last;
+    // The requests behind a cancelled one may fit already
+    if (event->waitlist && event->waitlist != head) {
+      begin_write(event);
+      serve_waitlist(event);
+      end_write(event);
+    }
+    lockprof_unlock(&event->mutex, event->id);
+  }
+  lockprof_rwunlock(&event_list->rwl);
+}
+
 int ems_show(unsigned int event_id, size_t* num_rows, size_t* num_cols, unsigned int** data) {
   if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
+    log_msg(LOG_ERROR, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+  if (lock_list_read() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
     return 1;
   }
 
-  struct Event* event = get_event_with_delay(event_id, event_list->head, event_list->tail);
+  struct Event* event = find_event(event_id);
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  lockprof_rwunlock(&event_list->rwl);
 
   if (event == NULL) {
-    fprintf(stderr, "Event not found\n");
+    log_msg(LOG_DEBUG, "Event not found\n");
     return 1;
   }
 
-  if (pthread_mutex_lock(&event->mutex) != 0) {
-    fprintf(stderr, "Error locking mutex\n");
+  size_t num_seats = event->rows * event->cols;
+  if (num_seats > show_capacity) {
+    pthread_once(&show_buffer_once, create_show_buffer_key);
+    unsigned int* grown = realloc(show_buffer, sizeof(unsigned int) * num_seats);
+    if (grown == NULL) {
+      log_msg(LOG_ERROR, "Error allocating memory for event seats\n");
+      return 1;
+    }
+    show_buffer = grown;
+    show_capacity = num_seats;
+    pthread_setspecific(show_buffer_key, show_buffer);  // Freed when the thread exits
+  }
+  if (read_seats(event, show_buffer) != 0) {
     return 1;
   }
 
   *num_rows = event->rows;
   *num_cols = event->cols;
-  *data = event->data;
+  *data = show_buffer;
+  return 0;
+}
+
+int ems_show_snapshot(unsigned int event_id, size_t* num_rows, size_t* num_cols, SeatSnapshot* snapshot) {
+  if (event_list == NULL) {
+    log_msg(LOG_ERROR, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  if (lock_list_read() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
+    return 1;
+  }
+
+  struct Event* event = find_event(event_id);
+
+  lockprof_rwunlock(&event_list->rwl);
+
+  if (event == NULL) {
+    log_msg(LOG_DEBUG, "Event not found\n");
+    return 1;
+  }
 
-  pthread_mutex_unlock(&event->mutex);
+  unsigned int* seats = snapshot_buffer(snapshot, event->rows * event->cols);
+  if (seats == NULL) {
+    log_msg(LOG_ERROR, "Error mapping snapshot for event seats\n");
+    return 1;
+  }
+  if (read_seats(event, seats) != 0) {
+    return 1;
+  }
+
+  *num_rows = event->rows;
+  *num_cols = event->cols;
   return 0;
 }
 
-int ems_list_events(size_t* num_events, unsigned int** event_ids) {
+int ems_clear_event(unsigned int event_id) {
   if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized\n");
+    log_msg(LOG_ERROR, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event_list->rwl) != 0) {
-    fprintf(stderr, "Error locking list rwl\n");
+  if (lock_list_read() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
     return 1;
   }
+  struct Event* event = find_event(event_id);
+  lockprof_rwunlock(&event_list->rwl);
 
-  struct ListNode* to = event_list->tail;
-  struct ListNode* current = event_list->head;
-  *num_events = 0;
+  if (event == NULL) {
+    log_msg(LOG_DEBUG, "Event not found\n");
+    return 1;
+  }
+  if (lock_event(event) != 0) {
+    log_msg(LOG_ERROR, "Error locking mutex\n");
+    return 1;
+  }
+  begin_write(event);
+  memset(event->data, 0, sizeof(unsigned int) * event->rows * event->cols);
+  memset(event->row_occupied, 0, sizeof(size_t) * event->rows);
+  atomic_store_explicit(&event->occupied, 0, memory_order_relaxed);
+  event->version++;
+  serve_waitlist(event);
+  end_write(event);
+  lockprof_unlock(&event->mutex, event->id);
+  return 0;
+}
 
-  if (current == NULL) {
-    *num_events = 0;
-    pthread_rwlock_unlock(&event_list->rwl);
-    return 0;
+int ems_list_events(size_t* num_events, unsigned int** event_ids, size_t** occupancy) {
+  if (event_list == NULL) {
+    log_msg(LOG_ERROR, "EMS state must be initialized\n");
+    return 1;
   }
 
-  while (1) {
-    (*num_events)++;
-    // printf("num_events: %ld\n", *num_events);
-    if (current == to) {
-      break;
-    }
-    current = current->next;
+  if (lock_list_read() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
+    return 1;
+  }
+
+  *num_events = event_list->num_events;
+  if (*num_events == 0) {
+    lockprof_rwunlock(&event_list->rwl);
+    return 0;
   }
 
   *event_ids = malloc(sizeof(unsigned int) * (*num_events));
   if (*event_ids == NULL) {
-    fprintf(stderr, "Error allocating memory for event id array\n");
-    pthread_rwlock_unlock(&event_list->rwl);
+    log_msg(LOG_ERROR, "Error allocating memory for event id array\n");
+    lockprof_rwunlock(&event_list->rwl);
+    return 1;
+  }
+  if (occupancy) {
+    *occupancy = malloc(sizeof(size_t) * 2 * (*num_events));
+    if (*occupancy == NULL) {
+      log_msg(LOG_ERROR, "Error allocating memory for event occupancy\n");
+      lockprof_rwunlock(&event_list->rwl);
+      free(*event_ids);
+      return 1;
+    }
+  }
+
+  for (size_t i = 0; i < *num_events; i++) {
+    struct Event* event = event_list->events[i];
+    (*event_ids)[i] = event->id;
+    if (occupancy) {
+      // A single counter per event, read without its mutex
+      (*occupancy)[i] = atomic_load_explicit(&event->occupied, memory_order_relaxed);
+      (*occupancy)[*num_events + i] = event->rows * event->cols;
+    }
+  }
+
+  lockprof_rwunlock(&event_list->rwl);
+  return 0;
+}
+
+int ems_event_stats(unsigned int event_id, size_t* num_rows, size_t* num_cols, size_t* occupied,
+                    size_t** row_occupied) {
+  if (event_list == NULL) {
+    log_msg(LOG_ERROR, "EMS state must be initialized\n");
     return 1;
   }
 
-  current = event_list->head;
-  for (unsigned int i = 0; i < *num_events; i++) {
-    (*event_ids)[i] = current->event->id;
-    current = current->next;
+  if (lock_list_read() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
+    return 1;
   }
+  struct Event* event = find_event(event_id);
+  lockprof_rwunlock(&event_list->rwl);
 
-  pthread_rwlock_unlock(&event_list->rwl);
+  if (event == NULL) {
+    log_msg(LOG_DEBUG, "Event not found\n");
+    return 1;
+  }
+
+  *row_occupied = malloc(sizeof(size_t) * event->rows);
+  if (*row_occupied == NULL) {
+    log_msg(LOG_ERROR, "Error allocating memory for row occupancy\n");
+    return 1;
+  }
+  if (read_consistent(event, *row_occupied, event->row_occupied, sizeof(size_t) * event->rows) != 0) {
+    free(*row_occupied);
+    return 1;
+  }
+
+  // Summed from the copy, so the total always agrees with the rows
+  *occupied = 0;
+  for (size_t row = 0; row < event->rows; row++) *occupied += (*row_occupied)[row];
+  *num_rows = event->rows;
+  *num_cols = event->cols;
   return 0;
+}
+
+int ems_snapshot_events(EventVisitor visit, void* arg) {
+  if (event_list == NULL) {
+    log_msg(LOG_ERROR, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  if (lock_list_read() != 0) {
+    log_msg(LOG_ERROR, "Error locking list rwl\n");
+    return 1;
+  }
+
+  // Events are never removed before ems_terminate(), so their pointers outlive the list lock
+  size_t num_events = event_list->num_events;
+  struct Event** events = malloc(sizeof(struct Event*) * (num_events + 1));
+  if (events == NULL) {
+    log_msg(LOG_ERROR, "Error allocating memory for event snapshot\n");
+    lockprof_rwunlock(&event_list->rwl);
+    return 1;
+  }
+  memcpy(events, event_list->events, sizeof(struct Event*) * num_events);
+  lockprof_rwunlock(&event_list->rwl);
+
+  unsigned int* seats = NULL;
+  size_t capacity = 0;
+  int ret = 0;
+  for (size_t i = 0; i < num_events && ret == 0; i++) {
+    struct Event* event = events[i];
+    size_t num_seats = event->rows * event->cols;  // Immutable after creation
+    if (num_seats > capacity) {
+      unsigned int* grown = realloc(seats, sizeof(unsigned int) * num_seats);
+      if (grown == NULL) {
+        log_msg(LOG_ERROR, "Error allocating memory for event snapshot\n");
+        ret = 1;
+        break;
+      }
+      seats = grown;
+      capacity = num_seats;
+    }
+
+    if (read_seats(event, seats) != 0) {
+      ret = 1;
+      break;
+    }
+
+    ret = visit(event->id, event->rows, event->cols, seats, arg);
+  }
+
+  free(seats);
+  free(events);
+  return ret;
 }
\ No newline at end of file
@@ -3,6 +3,15 @@
 
 #include <stddef.h>
 
+#include "snapshot.h"
+
+#define SHOW_OPTIMISTIC_RETRIES 16  // Lock free attempts at copying an event's seats before taking its mutex
+#define COMBINE_THRESHOLD 64        // Reservations finding an event's mutex taken before it switches to combining
+#define WAITLIST_MAX_PENDING 1024   // Waitlisted requests per event
+
+struct Event;
+struct Subscriber;
+
 /// Initializes the EMS state.
 /// @param delay_us Delay in microseconds.
 /// @return 0 if the EMS state was initialized successfully, 1 otherwise.
@@ -18,7 +27,36 @@ int ems_terminate();
 /// @return 0 if the event was created successfully, 1 otherwise.
 int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
 
-/// Creates a new reservation for the given event.
+/// Starts creating many events at once, before any session is served. Every event is set up with
+/// ems_preload_event(), by any number of threads at once, and they are all added with
+/// ems_preload_end(). The list lock is only taken here and there, and no state access delay applies.
+/// @param num_events Number of events.
+/// @return Array of num_events zeroed events, NULL on failure.
+struct Event** ems_preload_begin(size_t num_events);
+
+/// Sets up one of the events of ems_preload_begin(). The seats given are all taken by a single
+/// reservation, the first of the event. Different events can be set up concurrently.
+/// @param event Event to set up. If this fails, it is left unused and should be set to NULL.
+/// @param event_id Id of the event.
+/// @param num_rows Number of rows of the event.
+/// @param num_cols Number of columns of the event.
+/// @param num_seats Number of seats reserved up front, 0 for none.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @return 0 if the event was set up, 1 if its size or seats are invalid or it could not be allocated.
+int ems_preload_event(struct Event* event, unsigned int event_id, size_t num_rows, size_t num_cols, size_t num_seats,
+                      size_t* xs, size_t* ys);
+
+/// Adds every event set up with ems_preload_event() to the EMS state, releasing the array. Events
+/// whose id already exists are left out, with a warning.
+/// @param events Array returned by ems_preload_begin(), with NULL in place of unused events.
+/// @param num_events Number of events given to ems_preload_begin().
+/// @param num_created Pointer to store the number of events added in.
+/// @return 0 if the events were added, 1 otherwise.
+int ems_preload_end(struct Event** events, size_t num_events, size_t* num_created);
+
+/// Creates a new reservation for the given event. Once an event's mutex has been contended
+/// COMBINE_THRESHOLD times, its reservations are applied in batches by flat combining.
 /// @param event_id Id of the event to create a reservation for.
 /// @param num_seats Number of seats to reserve.
 /// @param xs Array of rows of the seats to reserve.
@@ -26,19 +64,91 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
 /// @return 0 if the reservation was created successfully, 1 otherwise.
 int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys);
 
+/// Reserves seats for a limited time. Held seats show as reserved, and are freed again when the
+/// hold expires unless it is confirmed first. Subscribers see the reservation and the release.
+/// @param event_id Id of the event to hold seats of.
+/// @param num_seats Number of seats to hold.
+/// @param xs Array of rows of the seats to hold.
+/// @param ys Array of columns of the seats to hold.
+/// @param ttl_s Seconds until the hold expires, between 1 and HOLD_MAX_TTL_S.
+/// @param hold_id Pointer to store the id of the hold in, to be confirmed with.
+/// @return 0 if the seats were held, 1 otherwise.
+int ems_hold(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys, unsigned int ttl_s,
+             unsigned int* hold_id);
+
+/// Confirms a hold, turning it into a permanent reservation.
+/// @param hold_id Id of the hold, as given by ems_hold().
+/// @return 0 if the hold was confirmed, 1 if it does not exist or already expired.
+int ems_confirm(unsigned int hold_id);
+
+/// Queues a request for any num_seats seats of an event. Requests are served in FIFO order as soon
+/// as enough seats are free, right away if nobody is ahead, or else when a hold expires or the event
+/// is cleared. The seats are reserved and sent as a NOTIFY_WAITLISTED record.
+/// @param event_id Id of the event to wait for.
+/// @param num_seats Number of seats, at most the size of the event.
+/// @param subscriber Subscriber of the session, notified once the seats are reserved.
+/// @return 0 if the request was queued, 1 otherwise.
+int ems_waitlist(unsigned int event_id, size_t num_seats, struct Subscriber* subscriber);
+
+/// Drops every waitlisted request of a session. Must be called before its subscriber is destroyed.
+/// @param subscriber Subscriber the requests were made with.
+void ems_waitlist_cancel(struct Subscriber* subscriber);
+
 /// Prepares information about given event. This list must NOT be freed by the caller.
+/// The seats are copied without locking the event, retrying if a reservation changed them meanwhile.
 /// @param event_id Id of the event to print.
 /// @param num_rows Pointer to number of rows of the event to print.
 /// @param num_cols Pointer to number of columns of the event to print.
-/// @param data Pointer to array of seats of the event to print.
+/// @param data Pointer to array of seats of the event to print. It is a consistent copy owned by the
+///             calling thread, valid until the thread's next call.
 /// @return 0 if the event was printed successfully, 1 otherwise.
 int ems_show(unsigned int event_id, size_t* num_rows, size_t* num_cols, unsigned int** data);
 
+/// Like ems_show(), but copies the seats into a snapshot that can be spliced into a pipe.
+/// @param event_id Id of the event to show.
+/// @param num_rows Pointer to store the number of rows in.
+/// @param num_cols Pointer to store the number of columns in.
+/// @param snapshot Snapshot to copy the seats into, see snapshot_send().
+/// @return 0 if the seats were copied, 1 otherwise.
+int ems_show_snapshot(unsigned int event_id, size_t* num_rows, size_t* num_cols, SeatSnapshot* snapshot);
+
+/// Frees every seat of an event, as if it had just been created. Subscribers are not notified.
+/// @note Only meant for tools that reuse a venue, such as the microbenchmarks.
+/// @param event_id Id of the event to clear.
+/// @return 0 if the event was cleared, 1 otherwise.
+int ems_clear_event(unsigned int event_id);
+
 /// Prepares a list of all the events. This list MUST be freed by the caller.
 /// @param num_events Pointer to number of events.
 /// @param event_ids Pointer to array of event ids.
+/// @param occupancy If not NULL, pointer to an array of 2 * num_events counts: the taken seats of
+///                  every event, then the total seats of every event. Read from counters kept by
+///                  every reservation, so listing is O(events) whatever their size.
 /// @return 0 if the events were printed successfully, 1 otherwise.
-/// @warning event_ids MUST be freed by the caller.
-int ems_list_events(size_t* num_events, unsigned int** event_ids);
+/// @warning event_ids and occupancy MUST be freed by the caller, unless num_events is 0.
+int ems_list_events(size_t* num_events, unsigned int** event_ids, size_t** occupancy);
+
+/// Gets how many seats of an event are taken, in total and per row, as a consistent snapshot.
+/// @param event_id Id of the event.
+/// @param num_rows Pointer to store the number of rows in.
+/// @param num_cols Pointer to store the number of columns in.
+/// @param occupied Pointer to store the number of taken seats in.
+/// @param row_occupied Pointer to an array of num_rows counts of taken seats, one per row.
+/// @return 0 if the counts were read, 1 otherwise.
+/// @warning row_occupied MUST be freed by the caller.
+int ems_event_stats(unsigned int event_id, size_t* num_rows, size_t* num_cols, size_t* occupied,
+                    size_t** row_occupied);
+
+/// Receives a copy of one event's seats, see ems_snapshot_events().
+/// @return 0 to continue with the next event, 1 to stop.
+typedef int (*EventVisitor)(unsigned int event_id, size_t num_rows, size_t num_cols, const unsigned int* seats,
+                            void* arg);
+
+/// Visits every event with a consistent copy of its seats. Seats are copied like in ems_show(), so
+/// a snapshot of the whole state never holds up reservations.
+/// @param visit Function to call for each event, in creation order.
+/// @param arg Passed to visit.
+/// @return 0 if every event was visited, 1 otherwise.
+int ems_snapshot_events(EventVisitor visit, void* arg);
 
 #endif  // SERVER_OPERATIONS_H
@@ -0,0 +1,186 @@
+#include "poller.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "stats.h"
+
+struct Poller {
+  WorkerPool* pool;
+  int idle_timeout_ms;
+  SessionHandler expire;
+  int wake[2];       // Self pipe, written to when sessions are added or on shutdown
+  Session* pending;  // Sessions added since the poller last rebuilt its set
+  int shutdown;
+  pthread_mutex_t mutex;
+  pthread_t thread;
+};
+
+/// Drops a session from the watched set by moving the last one into its place.
+static void remove_watched(Session** watched, struct pollfd* fds, size_t* num_watched, size_t i) {
+  (*num_watched)--;
+  watched[i] = watched[*num_watched];
+  fds[i + 1] = fds[*num_watched + 1];
+}
+
+/// Computes how long poll() may wait before the next watched session goes idle for too long.
+/// @return Timeout for poll(), -1 if there is no idle timeout or nothing to watch.
+static int next_expiry_ms(Poller* poller, Session** watched, size_t num_watched, uint64_t now) {
+  if (poller->idle_timeout_ms <= 0 || num_watched == 0) return -1;
+  uint64_t oldest = watched[0]->idle_since;
+  for (size_t i = 1; i < num_watched; i++) {
+    if (watched[i]->idle_since < oldest) oldest = watched[i]->idle_since;
+  }
+  uint64_t expiry = oldest + (uint64_t)poller->idle_timeout_ms * 1000000;
+  return expiry > now ? (int)((expiry - now + 999999) / 1000000) : 0;
+}
+
+static void* poller_thread(void* arg) {
+  Poller* poller = arg;
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGUSR1);
+  sigaddset(&set, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  Session** watched = NULL;
+  struct pollfd* fds = malloc(sizeof(struct pollfd));  // fds[0] is the wake pipe, fds[i + 1] is watched[i]
+  size_t num_watched = 0, capacity = 0;
+  if (!fds) return NULL;
+  fds[0].fd = poller->wake[0];
+  fds[0].events = POLLIN;
+
+  while (1) {
+    pthread_mutex_lock(&poller->mutex);
+    int shutdown = poller->shutdown;
+    while (poller->pending) {
+      if (num_watched == capacity) {
+        size_t grown = capacity ? capacity * 2 : 64;
+        Session** more_watched = realloc(watched, sizeof(Session*) * grown);
+        if (more_watched) watched = more_watched;
+        struct pollfd* more_fds = realloc(fds, sizeof(struct pollfd) * (grown + 1));
+        if (more_fds) fds = more_fds;
+        if (!more_watched || !more_fds) break;  // Left pending, retried on the next wake up
+        capacity = grown;
+      }
+      Session* session = poller->pending;
+      poller->pending = session->next;
+      session->next = NULL;
+      watched[num_watched] = session;
+      fds[num_watched + 1].fd = session->requests_fd;
+      fds[num_watched + 1].events = POLLIN;
+      num_watched++;
+    }
+    pthread_mutex_unlock(&poller->mutex);
+    if (shutdown) break;
+
+    if (poll(fds, num_watched + 1, next_expiry_ms(poller, watched, num_watched, stats_now())) == -1) {
+      if (errno == EINTR) continue;
+      log_msg(LOG_ERROR, "Failed to poll session pipes\n");
+      break;
+    }
+
+    if (fds[0].revents) {
+      char drain[64];
+      while (read(poller->wake[0], drain, sizeof(drain)) > 0) {
+      }
+    }
+    // Walk backwards so removing a session never skips the one moved into its place
+    for (size_t i = num_watched; i > 0; i--) {
+      if (!fds[i].revents) continue;
+      Session* session = watched[i - 1];
+      remove_watched(watched, fds, &num_watched, i - 1);
+      if (pool_submit(poller->pool, session) != 0) destroy_session(session);
+    }
+    if (poller->idle_timeout_ms > 0) {
+      uint64_t now = stats_now();
+      for (size_t i = num_watched; i > 0; i--) {
+        Session* session = watched[i - 1];
+        if (now - session->idle_since < (uint64_t)poller->idle_timeout_ms * 1000000) continue;
+        remove_watched(watched, fds, &num_watched, i - 1);
+        poller->expire(session);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < num_watched; i++) {
+    destroy_session(watched[i]);
+  }
+  free(watched);
+  free(fds);
+  return NULL;
+}
+
+Poller* create_poller(WorkerPool* pool, int idle_timeout_ms, SessionHandler expire) {
+  Poller* poller = malloc(sizeof(Poller));
+  if (!poller) return NULL;
+  poller->pool = pool;
+  poller->idle_timeout_ms = idle_timeout_ms;
+  poller->expire = expire;
+  poller->pending = NULL;
+  poller->shutdown = 0;
+  if (pipe(poller->wake) != 0) {
+    free(poller);
+    return NULL;
+  }
+  // Neither end may block: a full pipe already means the poller will wake up
+  fcntl(poller->wake[0], F_SETFL, O_NONBLOCK);
+  fcntl(poller->wake[1], F_SETFL, O_NONBLOCK);
+  pthread_mutex_init(&poller->mutex, NULL);
+
+  if (pthread_create(&poller->thread, NULL, poller_thread, poller) != 0) {
+    log_msg(LOG_ERROR, "Failed to create poller thread\n");
+    close(poller->wake[0]);
+    close(poller->wake[1]);
+    pthread_mutex_destroy(&poller->mutex);
+    free(poller);
+    return NULL;
+  }
+  return poller;
+}
+
+int poller_add(Poller* poller, Session* session) {
+  session->idle_since = stats_now();
+  pthread_mutex_lock(&poller->mutex);
+  if (poller->shutdown) {
+    pthread_mutex_unlock(&poller->mutex);
+    return 1;
+  }
+  session->next = poller->pending;
+  poller->pending = session;
+  pthread_mutex_unlock(&poller->mutex);
+
+  char wake = 1;
+  if (write(poller->wake[1], &wake, 1) == -1 && errno != EAGAIN) {
+    log_msg(LOG_ERROR, "Failed to wake the poller\n");
+  }
+  return 0;
+}
+
+void destroy_poller(Poller* poller) {
+  if (!poller) return;
+
+  pthread_mutex_lock(&poller->mutex);
+  poller->shutdown = 1;
+  pthread_mutex_unlock(&poller->mutex);
+  char wake = 1;
+  write(poller->wake[1], &wake, 1);
+  pthread_join(poller->thread, NULL);
+
+  while (poller->pending) {
+    Session* session = poller->pending;
+    poller->pending = session->next;
+    destroy_session(session);
+  }
+  close(poller->wake[0]);
+  close(poller->wake[1]);
+  pthread_mutex_destroy(&poller->mutex);
+  free(poller);
+}
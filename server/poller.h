@@ -0,0 +1,28 @@
+#ifndef SERVER_POLLER_H
+#define SERVER_POLLER_H
+
+#include "pool.h"
+#include "session.h"
+
+typedef struct Poller Poller;
+
+// Creates a thread that watches the request pipes of idle sessions and submits a session to the
+// pool as soon as its next request (or a hang up) arrives, so workers are only busy while serving
+// @param pool Pool readable sessions are submitted to
+// @param idle_timeout_ms Time a session may go without sending a request, 0 or less for no limit
+// @param expire Function sessions that reach the idle timeout are handed to, it must destroy them
+// @return Pointer to the newly created poller, NULL on failure
+// @warning The created structure should be destroyed with destroy_poller()
+Poller* create_poller(WorkerPool* pool, int idle_timeout_ms, SessionHandler expire);
+
+// Starts watching an open session. Never blocks
+// @param poller Pointer to the poller
+// @param session Pointer to the session, owned by the poller until it is submitted
+// @return 0 if the session is being watched, 1 if the poller is shutting down
+int poller_add(Poller* poller, Session* session);
+
+// Stops the poller thread and destroys every session it was still watching
+// @param poller Pointer to the poller
+void destroy_poller(Poller* poller);
+
+#endif  // SERVER_POLLER_H
@@ -0,0 +1,321 @@
+#define _GNU_SOURCE  // pthread_setaffinity_np()
+#include "pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "stats.h"
+
+// A worker's deque of sessions with a pending request. Each has its own lock, so workers only
+// contend when one of them steals, instead of all of them contending on a single queue.
+typedef struct {
+  _Alignas(64) pthread_mutex_t mutex;  // Protects everything below
+  Session** items;                     // Ring buffer of queued sessions, oldest at head
+  size_t head;
+  size_t size;
+  size_t capacity;
+  int active;  // Owned by a running worker, sessions are only submitted to active slots
+} WorkerSlot;
+
+struct WorkerPool {
+  WorkerSlot* slots;  // One per potential worker
+  unsigned int min_workers;
+  unsigned int max_workers;
+  int pin_workers;
+  long num_cpus;
+  SessionHandler handle;
+  atomic_uint num_workers;
+  atomic_uint idle_workers;  // Workers sleeping on wake, or about to
+  atomic_uint next_slot;     // Round robin start for sessions without a worker
+  atomic_int shutdown;
+  atomic_size_t steals;
+  pthread_mutex_t mutex;  // Protects slot allocation and sleeping
+  pthread_cond_t wake;
+  pthread_cond_t exited;
+};
+
+typedef struct {
+  WorkerPool* pool;
+  unsigned int index;
+} WorkerArgs;
+
+static void* pool_worker(void* arg);
+
+/// Queues a session on a slot, at the back or, for priority sessions, at the front. Must be
+/// called with the slot mutex held.
+/// @return 0 if the session was queued, 1 if the ring could not grow.
+static int slot_push(WorkerSlot* slot, Session* session) {
+  if (slot->size == slot->capacity) {
+    size_t capacity = slot->capacity ? slot->capacity * 2 : 16;
+    Session** items = malloc(sizeof(Session*) * capacity);
+    if (!items) return 1;
+    for (size_t i = 0; i < slot->size; i++) {
+      items[i] = slot->items[(slot->head + i) % slot->capacity];
+    }
+    free(slot->items);
+    slot->items = items;
+    slot->head = 0;
+    slot->capacity = capacity;
+  }
+  if (session->priority) {
+    slot->head = (slot->head + slot->capacity - 1) % slot->capacity;
+    slot->items[slot->head] = session;
+  } else {
+    slot->items[(slot->head + slot->size) % slot->capacity] = session;
+  }
+  slot->size++;
+  return 0;
+}
+
+/// Takes the oldest session of a slot, used both by its owner and by thieves.
+/// @return The session, NULL if the slot is empty.
+static Session* slot_pop(WorkerSlot* slot) {
+  pthread_mutex_lock(&slot->mutex);
+  Session* session = NULL;
+  if (slot->size > 0) {
+    session = slot->items[slot->head];
+    slot->head = (slot->head + 1) % slot->capacity;
+    slot->size--;
+  }
+  pthread_mutex_unlock(&slot->mutex);
+  return session;
+}
+
+/// Finds work for a worker: its own slot first, then the other slots in order.
+static Session* find_session(WorkerPool* pool, unsigned int index) {
+  Session* session = slot_pop(&pool->slots[index]);
+  if (session) return session;
+
+  for (unsigned int i = 1; i < pool->max_workers; i++) {
+    WorkerSlot* victim = &pool->slots[(index + i) % pool->max_workers];
+    // Unlocked peek, a stale size only costs a missed or an empty steal
+    if (__atomic_load_n(&victim->size, __ATOMIC_RELAXED) == 0) continue;
+    session = slot_pop(victim);
+    if (session) {
+      atomic_fetch_add_explicit(&pool->steals, 1, memory_order_relaxed);
+      return session;
+    }
+  }
+  return NULL;
+}
+
+/// Starts a worker in a free slot. Must be called with the pool mutex held.
+/// @return 0 if the worker was started, 1 otherwise.
+static int spawn_worker(WorkerPool* pool) {
+  unsigned int index = 0;
+  for (; index < pool->max_workers; index++) {
+    WorkerSlot* slot = &pool->slots[index];
+    pthread_mutex_lock(&slot->mutex);
+    int free_slot = !slot->active;
+    if (free_slot) slot->active = 1;
+    pthread_mutex_unlock(&slot->mutex);
+    if (free_slot) break;
+  }
+  if (index == pool->max_workers) return 1;
+
+  WorkerArgs* args = malloc(sizeof(WorkerArgs));
+  int ret = 1;
+  if (args) {
+    args->pool = pool;
+    args->index = index;
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, pool_worker, args);
+    pthread_attr_destroy(&attr);
+  }
+  if (ret != 0) {
+    log_msg(LOG_ERROR, "Failed to create worker thread\n");
+    free(args);
+    pthread_mutex_lock(&pool->slots[index].mutex);
+    pool->slots[index].active = 0;
+    pthread_mutex_unlock(&pool->slots[index].mutex);
+    return 1;
+  }
+  unsigned int running = atomic_fetch_add(&pool->num_workers, 1) + 1;
+  log_msg(LOG_DEBUG, "Worker %u started, %u running\n", index, running);
+  return 0;
+}
+
+/// Releases a worker's slot if it has no queued sessions. Must be called with the pool mutex held.
+/// @return 1 if the worker may exit, 0 if it must keep serving its slot.
+static int retire_worker(WorkerPool* pool, unsigned int index) {
+  WorkerSlot* slot = &pool->slots[index];
+  pthread_mutex_lock(&slot->mutex);
+  int retired = slot->size == 0;
+  if (retired) slot->active = 0;
+  pthread_mutex_unlock(&slot->mutex);
+  return retired;
+}
+
+static void* pool_worker(void* arg) {
+  WorkerArgs args = *(WorkerArgs*)arg;
+  WorkerPool* pool = args.pool;
+  free(arg);
+
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGUSR1);
+  sigaddset(&set, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  if (pool->pin_workers && pool->num_cpus > 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET((size_t)args.index % (size_t)pool->num_cpus, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus) != 0) {
+      log_msg(LOG_WARN, "Failed to pin worker %u\n", args.index);
+    }
+  }
+
+  int retired = 0;
+  while (!atomic_load(&pool->shutdown)) {
+    Session* session = find_session(pool, args.index);
+    if (!session) {
+      pthread_mutex_lock(&pool->mutex);
+      // Announce the sleep before looking again: a submitter either sees idle_workers and
+      // signals, or its session is found by the second look
+      atomic_fetch_add(&pool->idle_workers, 1);
+      session = find_session(pool, args.index);
+      int timed_out = 0;
+      if (!session && !atomic_load(&pool->shutdown)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += POOL_IDLE_TIMEOUT_MS / 1000;
+        deadline.tv_nsec += (POOL_IDLE_TIMEOUT_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+          deadline.tv_sec++;
+          deadline.tv_nsec -= 1000000000L;
+        }
+        timed_out = pthread_cond_timedwait(&pool->wake, &pool->mutex, &deadline) == ETIMEDOUT;
+      }
+      atomic_fetch_sub(&pool->idle_workers, 1);
+      // Idle for a whole timeout: give the thread back unless the pool is at its minimum. The
+      // pool mutex is kept until num_workers drops, so two workers can't both take the last step
+      if (!session && timed_out && atomic_load(&pool->num_workers) > pool->min_workers &&
+          retire_worker(pool, args.index)) {
+        retired = 1;
+        break;
+      }
+      pthread_mutex_unlock(&pool->mutex);
+      if (!session) continue;
+    }
+
+    session->worker = (int)args.index;
+    pool->handle(session);
+  }
+
+  if (!retired) {
+    pthread_mutex_lock(&pool->mutex);
+    retire_worker(pool, args.index);
+  }
+  unsigned int running = atomic_fetch_sub(&pool->num_workers, 1) - 1;
+  log_msg(LOG_DEBUG, "Worker %u stopped, %u running\n", args.index, running);
+  pthread_cond_broadcast(&pool->exited);
+  pthread_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+WorkerPool* create_pool(unsigned int min_workers, unsigned int max_workers, int pin_workers, SessionHandler handle) {
+  if (min_workers == 0 || max_workers < min_workers) return NULL;
+
+  WorkerPool* pool = malloc(sizeof(WorkerPool));
+  if (!pool) return NULL;
+  pool->slots = calloc(max_workers, sizeof(WorkerSlot));
+  if (!pool->slots) {
+    free(pool);
+    return NULL;
+  }
+  for (unsigned int i = 0; i < max_workers; i++) {
+    pthread_mutex_init(&pool->slots[i].mutex, NULL);
+  }
+  pool->min_workers = min_workers;
+  pool->max_workers = max_workers;
+  pool->pin_workers = pin_workers;
+  pool->num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  pool->handle = handle;
+  atomic_init(&pool->num_workers, 0);
+  atomic_init(&pool->idle_workers, 0);
+  atomic_init(&pool->next_slot, 0);
+  atomic_init(&pool->shutdown, 0);
+  atomic_init(&pool->steals, 0);
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->exited, NULL);
+
+  pthread_mutex_lock(&pool->mutex);
+  for (unsigned int i = 0; i < min_workers; i++) {
+    if (spawn_worker(pool) != 0) {
+      pthread_mutex_unlock(&pool->mutex);
+      destroy_pool(pool);
+      return NULL;
+    }
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return pool;
+}
+
+int pool_submit(WorkerPool* pool, Session* session) {
+  if (!pool || !session || atomic_load(&pool->shutdown)) return 1;
+
+  session->enqueued_at = stats_now();
+  // Prefer the worker that served the session last, its state is likely still in that core's cache
+  unsigned int start = session->worker >= 0 ? (unsigned int)session->worker : atomic_fetch_add(&pool->next_slot, 1);
+  int queued = 0;
+  for (unsigned int i = 0; i < pool->max_workers && !queued; i++) {
+    WorkerSlot* slot = &pool->slots[(start + i) % pool->max_workers];
+    pthread_mutex_lock(&slot->mutex);
+    queued = slot->active && slot_push(slot, session) == 0;
+    pthread_mutex_unlock(&slot->mutex);
+  }
+  if (!queued) return 1;
+
+  if (atomic_load(&pool->idle_workers) > 0) {
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+  } else if (atomic_load(&pool->num_workers) < pool->max_workers) {
+    // Every worker is busy, so this session would wait behind another request
+    pthread_mutex_lock(&pool->mutex);
+    if (!atomic_load(&pool->shutdown)) spawn_worker(pool);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+  return 0;
+}
+
+void destroy_pool(WorkerPool* pool) {
+  if (!pool) return;
+
+  pthread_mutex_lock(&pool->mutex);
+  atomic_store(&pool->shutdown, 1);
+  pthread_cond_broadcast(&pool->wake);
+  while (atomic_load(&pool->num_workers) > 0) {
+    pthread_cond_wait(&pool->exited, &pool->mutex);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  log_msg(LOG_DEBUG, "Worker pool stopped after %zu steals\n", atomic_load(&pool->steals));
+
+  for (unsigned int i = 0; i < pool->max_workers; i++) {
+    WorkerSlot* slot = &pool->slots[i];
+    Session* session;
+    while ((session = slot_pop(slot)) != NULL) {
+      destroy_session(session);
+    }
+    free(slot->items);
+    pthread_mutex_destroy(&slot->mutex);
+  }
+  free(pool->slots);
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->wake);
+  pthread_cond_destroy(&pool->exited);
+  free(pool);
+}
@@ -0,0 +1,38 @@
+#ifndef SERVER_POOL_H
+#define SERVER_POOL_H
+
+#include "session.h"
+
+#define DEFAULT_MIN_WORKERS 2
+#define DEFAULT_MAX_WORKERS 8
+#define POOL_IDLE_TIMEOUT_MS 2000  // Workers above the minimum exit after being idle this long
+
+// Serves one unit of work for a session, see pool_submit()
+typedef void (*SessionHandler)(Session* session);
+
+typedef struct WorkerPool WorkerPool;
+
+// Creates a pool of worker threads that grows while sessions are waiting for a worker and
+// shrinks back to min_workers when workers stay idle. Each worker has its own queue, and idle
+// workers steal from the others
+// @param min_workers Workers kept alive even when idle, at least 1
+// @param max_workers Upper bound on the number of workers
+// @param pin_workers Whether to pin each worker to a CPU, worker slot i runs on CPU i modulo the CPU count
+// @param handle Function each queued session is handed to
+// @return Pointer to the newly created pool, NULL on failure
+// @warning The created structure should be destroyed with destroy_pool()
+WorkerPool* create_pool(unsigned int min_workers, unsigned int max_workers, int pin_workers, SessionHandler handle);
+
+// Queues a session on the worker that served it last (or the next one, round robin), starting a
+// new worker if every worker is busy. Priority sessions are queued ahead of the others
+// @param pool Pointer to the pool
+// @param session Pointer to the session, owned by the pool until it is handed to the handler
+// @return 0 if the session was queued, 1 if the pool is shutting down
+int pool_submit(WorkerPool* pool, Session* session);
+
+// Waits for every worker to finish its current session and destroys the pool. Sessions still
+// queued are destroyed without being handled
+// @param pool Pointer to the pool
+void destroy_pool(WorkerPool* pool);
+
+#endif  // SERVER_POOL_H
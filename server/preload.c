@@ -0,0 +1,202 @@
+#include "preload.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common/io.h"
+#include "log.h"
+#include "operations.h"
+#include "stats.h"
+
+// Lines of the manifest set up by one thread
+typedef struct {
+  const char* start;
+  const char* end;
+  size_t first_line;     // Index of the chunk's first line in the manifest
+  struct Event** events;  // One per line of the manifest, NULL once unused
+  size_t num_invalid;
+  size_t num_seats;  // Seats reserved up front
+} PreloadChunk;
+
+/// Parses a number, after any spaces.
+/// @return 0 if a number that fits was found, 1 otherwise.
+static int parse_number(const char** cursor, const char* end, size_t* value) {
+  const char* p = *cursor;
+  while (p < end && (*p == ' ' || *p == '\t')) p++;
+  if (p == end || *p < '0' || *p > '9') return 1;
+
+  *value = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    size_t digit = (size_t)(*p - '0');
+    if (*value > (SIZE_MAX - digit) / 10) return 1;
+    *value = *value * 10 + digit;
+  }
+  *cursor = p;
+  return 0;
+}
+
+/// Skips any spaces and then the given character.
+/// @return 0 if the character was found, 1 otherwise.
+static int parse_char(const char** cursor, const char* end, char c) {
+  const char* p = *cursor;
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+  if (p == end || *p != c) return 1;
+  *cursor = p + 1;
+  return 0;
+}
+
+/// Checks that nothing but spaces is left on a line.
+static int at_line_end(const char* cursor, const char* end) {
+  while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) cursor++;
+  return cursor == end;
+}
+
+/// Parses the seats of a line, growing the coordinate arrays as needed.
+/// @return 0 if the seats are well formed, 1 otherwise.
+static int parse_seats(const char** cursor, const char* end, size_t** xs, size_t** ys, size_t* capacity,
+                       size_t* num_seats) {
+  *num_seats = 0;
+  if (parse_char(cursor, end, '[')) return 0;  // No seats
+
+  while (parse_char(cursor, end, ']')) {
+    if (*num_seats == *capacity) {
+      size_t grown_capacity = *capacity ? *capacity * 2 : 64;
+      size_t* grown_xs = realloc(*xs, sizeof(size_t) * grown_capacity);
+      if (grown_xs) *xs = grown_xs;
+      size_t* grown_ys = realloc(*ys, sizeof(size_t) * grown_capacity);
+      if (grown_ys) *ys = grown_ys;
+      if (!grown_xs || !grown_ys) return 1;
+      *capacity = grown_capacity;
+    }
+    if (parse_char(cursor, end, '(') || parse_number(cursor, end, &(*xs)[*num_seats]) ||
+        parse_char(cursor, end, ',') || parse_number(cursor, end, &(*ys)[*num_seats]) ||
+        parse_char(cursor, end, ')')) {
+      return 1;
+    }
+    (*num_seats)++;
+  }
+  return 0;
+}
+
+static void* preload_chunk(void* arg) {
+  PreloadChunk* chunk = arg;
+  size_t* xs = NULL;
+  size_t* ys = NULL;
+  size_t capacity = 0;
+
+  size_t line = chunk->first_line;
+  for (const char* start = chunk->start; start < chunk->end; line++) {
+    const char* end = memchr(start, '\n', (size_t)(chunk->end - start));
+    if (end == NULL) end = chunk->end;
+    const char* cursor = start;
+    start = end + 1;
+
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) cursor++;
+    if (cursor == end || *cursor == '#') {
+      chunk->events[line] = NULL;
+      continue;
+    }
+
+    size_t event_id, num_rows, num_cols, num_seats;
+    if (parse_number(&cursor, end, &event_id) || event_id > UINT_MAX || parse_number(&cursor, end, &num_rows) ||
+        parse_number(&cursor, end, &num_cols) || parse_seats(&cursor, end, &xs, &ys, &capacity, &num_seats) ||
+        !at_line_end(cursor, end) ||
+        ems_preload_event(chunk->events[line], (unsigned int)event_id, num_rows, num_cols, num_seats, xs, ys)) {
+      log_msg(LOG_ERROR, "Invalid event on line %zu of the manifest\n", line + 1);
+      chunk->events[line] = NULL;
+      chunk->num_invalid++;
+      continue;
+    }
+    chunk->num_seats += num_seats;
+  }
+
+  free(xs);
+  free(ys);
+  return NULL;
+}
+
+int preload_events(const char* path) {
+  uint64_t start = stats_now();
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    log_msg(LOG_ERROR, "Failed to open event manifest %s\n", path);
+    if (fd != -1) close(fd);
+    return 1;
+  }
+  size_t size = (size_t)st.st_size;
+  char* data = malloc(size + 1);
+  if (data == NULL || read_all(fd, data, size) != 0) {
+    log_msg(LOG_ERROR, "Failed to read event manifest %s\n", path);
+    free(data);
+    close(fd);
+    return 1;
+  }
+  close(fd);
+
+  // Every line gets an event slot, so each thread knows where its lines go
+  size_t num_lines = 0;
+  for (const char* p = data; p < data + size; num_lines++) {
+    const char* newline = memchr(p, '\n', (size_t)(data + size - p));
+    p = newline ? newline + 1 : data + size;
+  }
+
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t num_threads = num_cpus > 0 ? (size_t)num_cpus : 1;
+  if (num_threads > PRELOAD_MAX_THREADS) num_threads = PRELOAD_MAX_THREADS;
+  if (num_threads > num_lines / PRELOAD_MIN_LINES_PER_THREAD) num_threads = num_lines / PRELOAD_MIN_LINES_PER_THREAD;
+  if (num_threads == 0) num_threads = 1;
+
+  struct Event** events = ems_preload_begin(num_lines);
+  if (events == NULL) {
+    free(data);
+    return 1;
+  }
+
+  PreloadChunk chunks[PRELOAD_MAX_THREADS];
+  pthread_t threads[PRELOAD_MAX_THREADS];
+  const char* p = data;
+  size_t line = 0;
+  for (size_t i = 0; i < num_threads; i++) {
+    size_t last_line = num_lines * (i + 1) / num_threads;
+    chunks[i] = (PreloadChunk){p, p, line, events, 0, 0};
+    for (; line < last_line; line++) {
+      const char* newline = memchr(p, '\n', (size_t)(data + size - p));
+      p = newline ? newline + 1 : data + size;
+    }
+    chunks[i].end = p;
+  }
+
+  // The calling thread takes the first chunk, and any other that can't get a thread of its own
+  size_t started = 1;
+  for (; started < num_threads; started++) {
+    if (pthread_create(&threads[started], NULL, preload_chunk, &chunks[started]) != 0) break;
+  }
+  for (size_t i = started; i < num_threads; i++) preload_chunk(&chunks[i]);
+  preload_chunk(&chunks[0]);
+  size_t num_invalid = chunks[0].num_invalid, num_seats = chunks[0].num_seats;
+  for (size_t i = 1; i < num_threads; i++) {
+    if (i < started) pthread_join(threads[i], NULL);
+    num_invalid += chunks[i].num_invalid;
+    num_seats += chunks[i].num_seats;
+  }
+  free(data);
+
+  size_t num_built = 0, num_created;
+  for (size_t i = 0; i < num_lines; i++) num_built += events[i] != NULL;
+  if (ems_preload_end(events, num_lines, &num_created) != 0) return 1;
+  log_msg(LOG_INFO, "Preloaded %zu events with %zu seats reserved from %s in %.3fs using %zu threads\n", num_created,
+          num_seats, path, (double)(stats_now() - start) / 1e9, started);
+  if (num_invalid > 0 || num_created < num_built) {
+    log_msg(LOG_ERROR, "%zu invalid and %zu duplicate events in the manifest %s\n", num_invalid,
+            num_built - num_created, path);
+    return 1;
+  }
+  return 0;
+}
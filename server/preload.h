@@ -0,0 +1,16 @@
+#ifndef SERVER_PRELOAD_H
+#define SERVER_PRELOAD_H
+
+#define PRELOAD_MAX_THREADS 64             // Threads setting up events at once
+#define PRELOAD_MIN_LINES_PER_THREAD 1024  // Smaller manifests aren't worth another thread
+
+/// Creates the events listed in a manifest, before any session is served. Each line holds an event
+/// id and its size, optionally followed by seats that are reserved up front, written as in a .jobs
+/// file: <event_id> <rows> <cols> [(<row>,<col>) ...]
+/// Empty lines and lines starting with # are ignored. The lines are split between threads, one per
+/// online CPU, that parse them and set up their events in parallel, see ems_preload_begin().
+/// @param path Path of the manifest.
+/// @return 0 if every event in the manifest was created, 1 otherwise.
+int preload_events(const char* path);
+
+#endif  // SERVER_PRELOAD_H
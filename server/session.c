@@ -1,8 +1,21 @@
 #include "session.h"
 
-#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/constants.h"
+#include "common/io.h"
+#include "log.h"
+#include "operations.h"
+#include "stats.h"
+#include "subscriptions.h"
+#include "uring.h"
 
 Session* create_session(unsigned int session_id, char* requests, char* responses) {
   Session* session = (Session*)malloc(sizeof(Session));
@@ -18,12 +31,32 @@ Session* create_session(unsigned int session_id, char* requests, char* responses
   strcpy(session->requests, requests);
   strcpy(session->responses, responses);
   session->id = session_id;
+  session->requests_fd = -1;
+  session->responses_fd = -1;
+  session->subscriber = NULL;
+  session->created_at = stats_now();
+  session->enqueued_at = 0;
+  session->idle_since = 0;
+  session->worker = -1;
+  session->priority = 0;
+  session->waitlisted = 0;
+  session->protocol = PROTOCOL_V1;
+  snapshot_init(&session->snapshot);
+  session->input_start = 0;
+  session->input_len = 0;
+  session->output_len = 0;
+  session->next = NULL;
   return session;
 }
 
 void destroy_session(Session* session) {
   if (!session) return;
 
+  if (session->waitlisted) ems_waitlist_cancel(session->subscriber);
+  destroy_subscriber(session->subscriber);
+  if (session->requests_fd != -1) close(session->requests_fd);
+  if (session->responses_fd != -1) close(session->responses_fd);
+  snapshot_release(&session->snapshot);
   if (session->requests) {
     free(session->requests);
   }
@@ -35,64 +68,154 @@ void destroy_session(Session* session) {
   }
 }
 
-SessionQueue* create_session_queue() {
-  SessionQueue* queue = (SessionQueue*)malloc(sizeof(SessionQueue));
-  if (!queue) return NULL;
-  queue->size = 0;
-  queue->front = 0;
-  queue->rear = -1;
-  queue->shutdown = 0;
-  for (int i = 0; i < MAX_SESSIONS; i++) {
-    queue->sessions[i] = NULL;
+/// Opens the writing end of a FIFO, waiting at most timeout_ms for a reader.
+/// @return The file descriptor, in blocking mode, or -1 on failure.
+static int open_writer(const char* path, int timeout_ms) {
+  if (timeout_ms <= 0) return open(path, O_WRONLY);
+
+  // A non-blocking open fails with ENXIO until there is a reader, so it is retried every millisecond
+  uint64_t deadline = stats_now() + (uint64_t)timeout_ms * 1000000;
+  struct timespec retry = {0, 1000000};
+  int fd;
+  while ((fd = open(path, O_WRONLY | O_NONBLOCK)) == -1 && (errno == ENXIO || errno == EINTR)) {
+    if (stats_now() >= deadline) {
+      log_msg(LOG_WARN, "Client did not open %s within %d ms\n", path, timeout_ms);
+      return -1;
+    }
+    nanosleep(&retry, NULL);
   }
-  pthread_mutex_init(&queue->mutex, NULL);
-  pthread_cond_init(&queue->full, NULL);
-  pthread_cond_init(&queue->empty, NULL);
-  return queue;
+  if (fd != -1) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  return fd;
 }
 
-void destroy_session_queue(SessionQueue* queue) {
-  if (!queue) return;
-  pthread_mutex_destroy(&queue->mutex);
-  pthread_cond_destroy(&queue->full);
-  pthread_cond_destroy(&queue->empty);
-  free(queue);
+int open_session(Session* session, int timeout_ms) {
+  session->responses_fd = open_writer(session->responses, timeout_ms);
+  if (session->responses_fd == -1) {
+    log_msg(LOG_ERROR, "Failed to open response pipe\n");
+    return 1;
+  }
+  if (write_all(session->responses_fd, &session->id, sizeof(unsigned int)) != 0) {
+    log_msg(LOG_ERROR, "Failed to write session id (%d)\n", session->id);
+    return 1;
+  }
+  // With a timeout, the reading end is opened without waiting for the client. Until the client
+  // opens its end, the pipe never polls readable, so the session is left to the idle timeout
+  session->requests_fd = open(session->requests, timeout_ms > 0 ? O_RDONLY | O_NONBLOCK : O_RDONLY);
+  if (session->requests_fd != -1 && timeout_ms > 0) {
+    fcntl(session->requests_fd, F_SETFL, fcntl(session->requests_fd, F_GETFL) & ~O_NONBLOCK);
+  }
+  if (session->requests_fd == -1) {
+    log_msg(LOG_ERROR, "Failed to open request pipe\n");
+    return 1;
+  }
+  return 0;
+}
+/// Reads what the pipe has, waiting at most timeout_ms for the first byte.
+/// @return Number of bytes read, 0 on end of file, -1 on error or timeout (with errno set to ETIMEDOUT).
+static ssize_t read_some(int fd, void* buffer, size_t len, int timeout_ms) {
+  if (uring_enabled()) {
+    ssize_t read_bytes = uring_read(fd, buffer, len, timeout_ms);
+    if (read_bytes != -1 || errno != ENOSYS) return read_bytes;
+  }
+  if (timeout_ms > 0) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready == 0) errno = ETIMEDOUT;
+    if (ready <= 0) return -1;
+  }
+  return read(fd, buffer, len);
 }
 
-int enqueue_session(SessionQueue* queue, Session* session) {
-  if (!queue || !session) return 1;
-  pthread_mutex_lock(&queue->mutex);
-  while (queue->size >= MAX_SESSIONS) {
-    pthread_cond_wait(&queue->full, &queue->mutex);
-    if (queue->shutdown) {
-      pthread_mutex_unlock(&queue->mutex);
-      return 1;
+int session_read(Session* session, void* buffer, size_t len, int timeout_ms) {
+  char* bytes = buffer;
+  uint64_t deadline = stats_now() + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0) * 1000000;
+  while (len > 0) {
+    if (session->input_len == 0) {
+      int remaining_ms = 0;
+      if (timeout_ms > 0) {
+        uint64_t now = stats_now();
+        if (now >= deadline) {
+          errno = ETIMEDOUT;
+          return 1;
+        }
+        remaining_ms = (int)((deadline - now + 999999) / 1000000);
+      }
+      // Big fields (the seats of a reservation, a batch) are read straight into place
+      int in_place = len >= SESSION_INPUT_SIZE;
+      ssize_t read_bytes = read_some(session->requests_fd, in_place ? bytes : session->input,
+                                     in_place ? len : SESSION_INPUT_SIZE, remaining_ms);
+      if (read_bytes == -1 && errno == EINTR) continue;
+      if (read_bytes <= 0) return 1;
+      if (in_place) {
+        bytes += read_bytes;
+        len -= (size_t)read_bytes;
+        continue;
+      }
+      session->input_start = 0;
+      session->input_len = (size_t)read_bytes;
     }
+
+    size_t chunk = len < session->input_len ? len : session->input_len;
+    memcpy(bytes, session->input + session->input_start, chunk);
+    session->input_start += chunk;
+    session->input_len -= chunk;
+    bytes += chunk;
+    len -= chunk;
   }
-  queue->rear = (queue->rear + 1) % MAX_SESSIONS;
-  queue->sessions[queue->rear] = session;
-  queue->size++;
-  pthread_cond_signal(&queue->empty);
-  pthread_mutex_unlock(&queue->mutex);
   return 0;
 }
 
-Session* dequeue_session(SessionQueue* queue) {
-  if (!queue) return NULL;
-  pthread_mutex_lock(&queue->mutex);
-  while (queue->size <= 0) {
-    pthread_cond_wait(&queue->empty, &queue->mutex);
-    // Threads might be waiting on empty when shutdown is called
-    if (queue->shutdown) {
-      pthread_mutex_unlock(&queue->mutex);
-      return NULL;
+int session_has_input(const Session* session) { return session->input_len > 0; }
+
+/// Writes every byte of the given buffers, recording the time spent in STAT_IO_WRITE.
+/// @return 0 if all bytes were written, 1 otherwise.
+static int write_out(int fd, struct iovec* iov, int iovcnt) {
+  uint64_t start = stats_now();
+  int failed = 0;
+  if (uring_enabled()) {
+    failed = uring_write_all(fd, iov, iovcnt);
+    if (failed && errno == ENOSYS) {
+      failed = 0;  // This thread has no ring, the blocking path below is used
+    } else {
+      iovcnt = 0;
+    }
+  }
+  while (!failed && iovcnt > 0) {
+    ssize_t written = writev(fd, iov, iovcnt);
+    if (written == -1 && errno == EINTR) continue;
+    if (written == -1) {
+      failed = 1;
+      break;
+    }
+    while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+      written -= (ssize_t)iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char*)iov->iov_base + written;
+      iov->iov_len -= (size_t)written;
     }
   }
-  Session* session = queue->sessions[queue->front];
-  queue->front = (queue->front + 1) % MAX_SESSIONS;
-  queue->size--;
-  pthread_cond_signal(&queue->full);
-  pthread_mutex_unlock(&queue->mutex);
+  stats_record(STAT_IO_WRITE, stats_now() - start);
+  return failed;
+}
 
-  return session;
-}
\ No newline at end of file
+int session_write(Session* session, const void* buffer, size_t len) {
+  if (session->output_len + len <= SESSION_OUTPUT_SIZE) {
+    memcpy(session->output + session->output_len, buffer, len);
+    session->output_len += len;
+    return 0;
+  }
+  // Large payloads (a big SHOW) skip the buffer instead of being copied into it
+  struct iovec iov[2] = {{session->output, session->output_len}, {(void*)buffer, len}};
+  session->output_len = 0;
+  return write_out(session->responses_fd, iov, 2);
+}
+
+int session_flush(Session* session) {
+  if (session->output_len == 0) return 0;
+  struct iovec iov = {session->output, session->output_len};
+  session->output_len = 0;
+  return write_out(session->responses_fd, &iov, 1);
+}
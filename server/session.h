@@ -1,29 +1,49 @@
 #ifndef SERVER_SESSION_H
 #define SERVER_SESSION_H
 
-#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 
-#define MAX_SESSIONS 8
+#include "snapshot.h"
 
-typedef struct {
+#define DEFAULT_IDLE_TIMEOUT_S 300       // Sessions without a request for this long are closed, 0 never closes them
+#define DEFAULT_REQUEST_TIMEOUT_MS 5000  // Time a client has to send a whole request, 0 waits forever
+#define SESSION_INPUT_SIZE 4096          // Request bytes read at once, bigger fields are read in place
+#define SESSION_OUTPUT_SIZE 4096         // Response bytes gathered before they are written
+
+struct Subscriber;
+
+// What is left of a session after serving one of its requests
+enum SessionStatus {
+  SESSION_OPEN,    // Waiting for the next request
+  SESSION_CLOSED,  // The client quit
+  SESSION_FAILED,  // A pipe failed or the client sent a malformed request
+};
+
+typedef struct Session {
   unsigned int id;
   char* requests;
   char* responses;
+  int requests_fd;                // -1 until the pipes are opened by open_session()
+  int responses_fd;               // -1 until the pipes are opened by open_session()
+  struct Subscriber* subscriber;  // Change notifications, NULL until the first SUBSCRIBE
+  uint64_t created_at;            // See stats_now()
+  uint64_t enqueued_at;           // When the session was last queued for a worker, see stats_now()
+  uint64_t idle_since;            // When the session was last handed to the poller, see stats_now()
+  int worker;                     // Pool slot that last served the session, -1 if none yet
+  int priority;                   // Requests are queued ahead of those of other sessions
+  int waitlisted;                 // Set once the session waitlisted a request, see ems_waitlist()
+  unsigned int protocol;          // Wire format agreed on with a VERSION request, see common/constants.h
+  SeatSnapshot snapshot;          // Seats of the last zero-copy SHOW, see ems_show_snapshot()
+  size_t input_start;             // First byte read ahead that no request consumed yet
+  size_t input_len;               // Bytes read ahead, from input_start
+  size_t output_len;              // Response bytes waiting for session_flush()
+  char input[SESSION_INPUT_SIZE];
+  char output[SESSION_OUTPUT_SIZE];
+  struct Session* next;           // Next session in the poller's pending list
 
 } Session;
 
-typedef struct {
-  Session* sessions[MAX_SESSIONS];
-  int size;
-  int front;
-  int rear;
-  int shutdown;
-  pthread_mutex_t mutex;
-  pthread_cond_t full;
-  pthread_cond_t empty;
-} SessionQueue;
-
 // Creates a new session structure, representing a client/server relationship
 // @param session_id Session identifier
 // @param requests Name of the requests pipe
@@ -32,28 +52,42 @@ typedef struct {
 // @warning The created structure should be destroyed with destroy_session()
 Session* create_session(unsigned int session_id, char* requests, char* responses);
 
-// Destroys a session structure, freeing all resources
+// Destroys a session structure, closing its pipes and freeing all resources
 // @param session Pointer to the session structure to be destroyed
 void destroy_session(Session* session);
 
-// Creates a new session queue, used to store sessions
-// @return Pointer to the newly created session queue
-// @warning The created structure should be destroyed with destroy_session_queue()
-SessionQueue* create_session_queue();
-
-// Destroys a session queue, freeing all resources
-// @param queue Pointer to the session queue to be destroyed
-void destroy_session_queue(SessionQueue* queue);
-
-// Places a session into the session queue
-// @param queue Pointer to the session queue
-// @param session Pointer to the session to be enqueued
-int enqueue_session(SessionQueue* queue, Session* session);
-
-// Removes a session from the session queue
-// @param queue Pointer to the session queue
-// @return Pointer to the dequeued session
-// @warning This function may fail, returning a NULL pointer
-Session* dequeue_session(SessionQueue* queue);
+// Opens the session's pipes and sends the client its session id
+// @param session Pointer to the session
+// @param timeout_ms Time the client has to open its response pipe, 0 waits forever
+// @return 0 if the session is ready for requests, 1 otherwise
+// @warning Without a timeout, blocks until the client opens its end of both pipes
+int open_session(Session* session, int timeout_ms);
+
+// Reads part of a request. Reads as much as the pipe has at once and serves the following calls
+// from it, so a request usually takes one system call, or one io_uring submission (see uring_enable())
+// @param session Pointer to the session
+// @param buffer Buffer to store the bytes in
+// @param len Number of bytes to read
+// @param timeout_ms Time allowed for the whole read, 0 or less waits forever
+// @return 0 if all bytes were read, 1 on error, end of file or timeout (with errno set to ETIMEDOUT)
+int session_read(Session* session, void* buffer, size_t len, int timeout_ms);
+
+// Checks whether bytes of the next request were already read, so the poller would not see them
+// @param session Pointer to the session
+// @return 1 if a request is waiting in the session, 0 otherwise
+int session_has_input(const Session* session);
+
+// Queues part of a response, written with the rest of it by session_flush(). Payloads that don't
+// fit are written right away, in the same system call as what was queued before them
+// @param session Pointer to the session
+// @param buffer Bytes to write
+// @param len Number of bytes
+// @return 0 if the bytes were queued or written, 1 if writing failed
+int session_write(Session* session, const void* buffer, size_t len);
+
+// Writes the queued response bytes
+// @param session Pointer to the session
+// @return 0 if everything queued was written, 1 otherwise
+int session_flush(Session* session);
 
 #endif  // SERVER_SESSION_H
\ No newline at end of file
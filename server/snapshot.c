@@ -0,0 +1,74 @@
+#define _GNU_SOURCE  // vmsplice
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "common/io.h"
+
+void snapshot_init(SeatSnapshot* snapshot) {
+  snapshot->seats = NULL;
+  snapshot->capacity = 0;
+  snapshot->pipe_fd = -1;
+}
+
+void snapshot_release(SeatSnapshot* snapshot) {
+  if (snapshot->seats) munmap(snapshot->seats, snapshot->capacity * sizeof(unsigned int));
+  snapshot_init(snapshot);
+}
+
+/// Checks whether the pipe the buffer was last spliced into may still reference it.
+static int snapshot_in_use(const SeatSnapshot* snapshot) {
+  if (snapshot->pipe_fd == -1) return 0;
+  // The pipe drops its references to the pages as the reader consumes them
+  int unread;
+  return ioctl(snapshot->pipe_fd, FIONREAD, &unread) != 0 || unread > 0;
+}
+
+unsigned int* snapshot_buffer(SeatSnapshot* snapshot, size_t num_seats) {
+  if (snapshot_in_use(snapshot) || num_seats > snapshot->capacity) snapshot_release(snapshot);
+  snapshot->pipe_fd = -1;
+  if (snapshot->seats) return snapshot->seats;
+
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = (num_seats * sizeof(unsigned int) + page - 1) / page * page;
+  if (size == 0) size = page;
+  void* seats = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (seats == MAP_FAILED) return NULL;
+  snapshot->seats = seats;
+  snapshot->capacity = size / sizeof(unsigned int);
+  return snapshot->seats;
+}
+
+int snapshot_send(SeatSnapshot* snapshot, int fd, size_t num_seats) {
+  char* data = (char*)snapshot->seats;
+  size_t len = num_seats * sizeof(unsigned int);
+  if (len < SNAPSHOT_MIN_SPLICE_BYTES) return write_all(fd, data, len);
+
+  // A spliced page costs the pipe a reference, not a copy, so a bigger pipe takes the seats in fewer
+  // calls and wakeups. Failing is fine, the pipe keeps its size
+  int pipe_size = fcntl(fd, F_GETPIPE_SZ);
+  if (pipe_size != -1 && (size_t)pipe_size < len && pipe_size < SNAPSHOT_MAX_PIPE_BYTES) {
+    fcntl(fd, F_SETPIPE_SZ, len < SNAPSHOT_MAX_PIPE_BYTES ? (int)len : SNAPSHOT_MAX_PIPE_BYTES);
+  }
+
+  while (len > 0) {
+    // Blocks like write() while the pipe is full, only the pages still queued are referenced on return
+    struct iovec iov = {data, len};
+    ssize_t spliced = vmsplice(fd, &iov, 1, 0);
+    if (spliced == -1 && errno == EINTR) continue;
+    if (spliced == -1) {
+      // Not a pipe, or no vmsplice, the rest is copied instead
+      if (errno == EBADF || errno == EINVAL || errno == ENOSYS) return write_all(fd, data, len);
+      return 1;
+    }
+    snapshot->pipe_fd = fd;
+    data += spliced;
+    len -= (size_t)spliced;
+  }
+  return 0;
+}
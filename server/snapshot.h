@@ -0,0 +1,41 @@
+#ifndef SERVER_SNAPSHOT_H
+#define SERVER_SNAPSHOT_H
+
+#include <stddef.h>
+
+#define SNAPSHOT_MIN_SPLICE_BYTES (64 << 10)  // Smaller seat maps are cheaper to copy into the pipe
+#define SNAPSHOT_MAX_PIPE_BYTES (1 << 20)     // Pipes are grown up to this, the default unprivileged limit
+
+// Copy of an event's seats that is handed to a pipe by reference with vmsplice(2), so the kernel
+// never copies it. The pipe keeps pointing at the pages until the reader consumes them, so the
+// buffer is only written again once that pipe has drained; until then, a new one is mapped.
+// Buffers are mapped on their own, so unmapping one never frees pages a pipe still points at.
+typedef struct {
+  unsigned int* seats;  // Page aligned, NULL until the first snapshot
+  size_t capacity;      // Number of seats that fit in the buffer
+  int pipe_fd;          // Pipe that may still reference the buffer, -1 if none
+} SeatSnapshot;
+
+/// Initializes an empty snapshot.
+/// @param snapshot Snapshot to initialize.
+void snapshot_init(SeatSnapshot* snapshot);
+
+/// Gets a buffer the next snapshot can be copied into.
+/// @param snapshot Snapshot to reuse.
+/// @param num_seats Number of seats the buffer must hold.
+/// @return The buffer, or NULL if it could not be mapped.
+unsigned int* snapshot_buffer(SeatSnapshot* snapshot, size_t num_seats);
+
+/// Sends the seats of the snapshot, splicing them into the pipe when it pays off. Falls back to
+/// copying when fd is not a pipe or the kernel can't splice.
+/// @param snapshot Snapshot filled through snapshot_buffer().
+/// @param fd File descriptor to send the seats to.
+/// @param num_seats Number of seats to send.
+/// @return 0 if all seats were sent, 1 otherwise.
+int snapshot_send(SeatSnapshot* snapshot, int fd, size_t num_seats);
+
+/// Unmaps the snapshot's buffer. Pages a pipe still references stay readable until consumed.
+/// @param snapshot Snapshot to release, left empty.
+void snapshot_release(SeatSnapshot* snapshot);
+
+#endif  // SERVER_SNAPSHOT_H
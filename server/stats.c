@@ -0,0 +1,279 @@
+#include "stats.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common/histogram.h"
+#include "common/io.h"
+
+// Counters owned by a single thread. Only the owner writes them, with relaxed atomic stores, so
+// recording never needs a lock; snapshots read them with relaxed loads from any thread.
+typedef struct StatsShard {
+  struct StatsShard* next;
+  int owned;  // Cleared when the owning thread exits, so another thread can take the shard and its counts over
+  uint64_t errors[STATS_MAX_OPCODES];
+  Histogram histograms[STATS_MAX_OPCODES][STAT_NUM_METRICS];
+} StatsShard;
+
+static StatsShard* shards = NULL;
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;  // Only taken when a thread first records
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+
+static _Thread_local StatsShard* shard = NULL;
+static _Thread_local int current_opcode = 0;
+
+static const char* opcode_names[STATS_MAX_OPCODES] = {"OTHER", "SETUP",     "QUIT",        "CREATE", "RESERVE", "SHOW",
+                                                      "LIST",  "SUBSCRIBE", "UNSUBSCRIBE", "BATCH",  "STATS",   "HOLD",
+                                                      "CONFIRM", "WAITLIST",  "EVENT_STATS", "VERSION"};
+static const char* metric_names[STAT_NUM_METRICS] = {"service",      "queue_wait", "lock_wait",
+                                                     "state_access", "io_write",   "cache_hit"};
+
+static pthread_t dump_thread;
+static int dump_running = 0;
+static pthread_mutex_t dump_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dump_stop = PTHREAD_COND_INITIALIZER;
+static int dump_fd = -1;
+static int dump_binary = 0;
+static unsigned int dump_interval_s = 0;
+
+#define RELAXED_ADD(field, value) \
+  __atomic_store_n(&(field), __atomic_load_n(&(field), __ATOMIC_RELAXED) + (value), __ATOMIC_RELAXED)
+#define RELAXED_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+static void release_shard(void* arg) {
+  StatsShard* owned = arg;
+  __atomic_store_n(&owned->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void create_shard_key(void) { pthread_key_create(&shard_key, release_shard); }
+
+/// Gets the calling thread's shard, reusing the shard of a finished thread when possible. Reused shards
+/// keep their counts, so the totals of finished sessions are not lost.
+static StatsShard* get_shard(void) {
+  if (shard) return shard;
+
+  pthread_once(&shard_key_once, create_shard_key);
+  pthread_mutex_lock(&shards_mutex);
+  for (StatsShard* current = shards; current; current = current->next) {
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&current->owned, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      shard = current;
+      break;
+    }
+  }
+  if (!shard) {
+    shard = calloc(1, sizeof(StatsShard));
+    if (shard) {
+      for (int op = 0; op < STATS_MAX_OPCODES; op++) {
+        for (int metric = 0; metric < STAT_NUM_METRICS; metric++) {
+          histogram_init(&shard->histograms[op][metric]);
+        }
+      }
+      shard->owned = 1;
+      shard->next = shards;
+      shards = shard;
+    }
+  }
+  pthread_mutex_unlock(&shards_mutex);
+
+  if (shard) pthread_setspecific(shard_key, shard);
+  return shard;
+}
+
+uint64_t stats_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void stats_set_opcode(int opcode) { current_opcode = opcode >= 0 && opcode < STATS_MAX_OPCODES ? opcode : 0; }
+
+void stats_record(enum StatsMetric metric, uint64_t ns) {
+  StatsShard* own = get_shard();
+  if (!own) return;
+
+  Histogram* histogram = &own->histograms[current_opcode][metric];
+  RELAXED_ADD(histogram->counts[histogram_bucket(ns)], 1);
+  RELAXED_ADD(histogram->count, 1);
+  RELAXED_ADD(histogram->sum, ns);
+  if (ns > histogram->max) __atomic_store_n(&histogram->max, ns, __ATOMIC_RELAXED);
+  if (ns < histogram->min) __atomic_store_n(&histogram->min, ns, __ATOMIC_RELAXED);
+}
+
+void stats_record_error(void) {
+  StatsShard* own = get_shard();
+  if (!own) return;
+  RELAXED_ADD(own->errors[current_opcode], 1);
+}
+
+size_t stats_snapshot(StatsRow* rows, size_t max) {
+  Histogram* merged = malloc(sizeof(Histogram));
+  if (!merged) return 0;
+
+  pthread_mutex_lock(&shards_mutex);
+  StatsShard* head = shards;
+  pthread_mutex_unlock(&shards_mutex);
+
+  size_t num_rows = 0;
+  for (int op = 0; op < STATS_MAX_OPCODES; op++) {
+    for (int metric = 0; metric < STAT_NUM_METRICS && num_rows < max; metric++) {
+      histogram_init(merged);
+      uint64_t errors = 0;
+      // Shards are only ever prepended, so walking from a snapshot of the head is safe
+      for (StatsShard* current = head; current; current = current->next) {
+        Histogram* from = &current->histograms[op][metric];
+        for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+          merged->counts[i] += RELAXED_LOAD(from->counts[i]);
+        }
+        merged->count += RELAXED_LOAD(from->count);
+        merged->sum += RELAXED_LOAD(from->sum);
+        uint64_t from_max = RELAXED_LOAD(from->max);
+        if (from_max > merged->max) merged->max = from_max;
+        if (metric == STAT_SERVICE) errors += RELAXED_LOAD(current->errors[op]);
+      }
+      if (merged->count == 0) continue;
+
+      StatsRow* row = &rows[num_rows++];
+      row->opcode = op;
+      row->metric = metric;
+      row->count = merged->count;
+      row->errors = errors;
+      row->sum_ns = merged->sum;
+      row->p50_ns = histogram_percentile(merged, 50);
+      row->p90_ns = histogram_percentile(merged, 90);
+      row->p99_ns = histogram_percentile(merged, 99);
+      row->p999_ns = histogram_percentile(merged, 99.9);
+      row->max_ns = merged->max;
+    }
+  }
+
+  free(merged);
+  return num_rows;
+}
+
+const char* stats_opcode_name(int opcode) {
+  if (opcode < 0 || opcode >= STATS_MAX_OPCODES || !opcode_names[opcode]) return "OTHER";
+  return opcode_names[opcode];
+}
+
+const char* stats_metric_name(int metric) {
+  if (metric < 0 || metric >= STAT_NUM_METRICS) return "unknown";
+  return metric_names[metric];
+}
+
+char* stats_csv(size_t* len) {
+  StatsRow rows[STATS_MAX_OPCODES * STAT_NUM_METRICS];
+  size_t num_rows = stats_snapshot(rows, STATS_MAX_OPCODES * STAT_NUM_METRICS);
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  size_t cap = STATS_CSV_LINE_SIZE * (num_rows + 1);
+  char* csv = malloc(cap);
+  if (!csv) return NULL;
+  *len = 0;
+  for (size_t i = 0; i < num_rows; i++) {
+    StatsRow* row = &rows[i];
+    int written = snprintf(csv + *len, cap - *len, "%lld,%s,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                           (long long)now.tv_sec, stats_opcode_name(row->opcode), stats_metric_name(row->metric),
+                           (unsigned long long)row->count, (unsigned long long)row->errors,
+                           (unsigned long long)row->sum_ns, (unsigned long long)row->p50_ns,
+                           (unsigned long long)row->p90_ns, (unsigned long long)row->p99_ns,
+                           (unsigned long long)row->p999_ns, (unsigned long long)row->max_ns);
+    if (written < 0 || (size_t)written >= cap - *len) break;
+    *len += (size_t)written;
+  }
+  return csv;
+}
+
+/// Appends one snapshot to the dump file.
+static void write_dump(void) {
+  if (dump_binary) {
+    StatsRow rows[STATS_MAX_OPCODES * STAT_NUM_METRICS];
+    size_t num_rows = stats_snapshot(rows, STATS_MAX_OPCODES * STAT_NUM_METRICS);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t timestamp = (uint64_t)now.tv_sec;
+    if (write_all(dump_fd, &timestamp, sizeof(uint64_t)) || write_all(dump_fd, &num_rows, sizeof(size_t)) ||
+        write_all(dump_fd, rows, sizeof(StatsRow) * num_rows)) {
+      fprintf(stderr, "Failed to write stats dump\n");
+    }
+    return;
+  }
+
+  // One buffer per snapshot, so a dump is a single write
+  size_t len;
+  char* csv = stats_csv(&len);
+  if (!csv) return;
+  if (write_all(dump_fd, csv, len)) {
+    fprintf(stderr, "Failed to write stats dump\n");
+  }
+  free(csv);
+}
+
+static void* stats_dump_thread(void* arg) {
+  (void)arg;
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  sigaddset(&set, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  pthread_mutex_lock(&dump_mutex);
+  while (dump_running) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += dump_interval_s;
+    while (dump_running && pthread_cond_timedwait(&dump_stop, &dump_mutex, &deadline) == 0) {
+    }
+    pthread_mutex_unlock(&dump_mutex);
+    write_dump();
+    pthread_mutex_lock(&dump_mutex);
+  }
+  pthread_mutex_unlock(&dump_mutex);
+  return NULL;
+}
+
+int stats_start_dump(const char* path, unsigned int interval_s, int binary) {
+  dump_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0640);
+  if (dump_fd == -1) {
+    fprintf(stderr, "Failed to open stats dump file %s\n", path);
+    return 1;
+  }
+
+  if (!binary && lseek(dump_fd, 0, SEEK_END) == 0) {
+    write_all(dump_fd, STATS_CSV_HEADER, strlen(STATS_CSV_HEADER));
+  }
+
+  dump_binary = binary;
+  dump_interval_s = interval_s > 0 ? interval_s : 1;
+  dump_running = 1;
+  if (pthread_create(&dump_thread, NULL, stats_dump_thread, NULL) != 0) {
+    dump_running = 0;
+    close(dump_fd);
+    dump_fd = -1;
+    return 1;
+  }
+  return 0;
+}
+
+void stats_stop_dump(void) {
+  pthread_mutex_lock(&dump_mutex);
+  if (!dump_running) {
+    pthread_mutex_unlock(&dump_mutex);
+    return;
+  }
+  dump_running = 0;
+  pthread_cond_signal(&dump_stop);
+  pthread_mutex_unlock(&dump_mutex);
+
+  pthread_join(dump_thread, NULL);
+  close(dump_fd);
+  dump_fd = -1;
+}
@@ -0,0 +1,79 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATS_MAX_OPCODES 16     // Opcodes are indexed directly, anything above is folded into 0
+#define STATS_CSV_LINE_SIZE 192  // Upper bound on the length of one CSV line
+#define STATS_CSV_HEADER "timestamp,opcode,metric,count,errors,sum_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n"
+
+// What a recorded duration measures
+enum StatsMetric {
+  STAT_SERVICE,       // Whole request, from reading the opcode to writing the last response byte
+  STAT_QUEUE_WAIT,    // Time a session waited in the session queue before a worker picked it up
+  STAT_LOCK_WAIT,     // Time spent acquiring the event list lock or an event mutex
+  STAT_STATE_ACCESS,  // Time spent in get_event_with_delay(), one per hot event cache miss
+  STAT_IO_WRITE,      // Time spent writing responses
+  STAT_CACHE_HIT,     // Time spent finding an event in the hot event cache, one per hit
+  STAT_NUM_METRICS,
+};
+
+// Aggregated view of one (opcode, metric) histogram, as sent by the STATS operation
+typedef struct {
+  int opcode;
+  int metric;
+  uint64_t count;
+  uint64_t errors;  // Failed requests, only set for STAT_SERVICE
+  uint64_t sum_ns;
+  uint64_t p50_ns;
+  uint64_t p90_ns;
+  uint64_t p99_ns;
+  uint64_t p999_ns;
+  uint64_t max_ns;
+} StatsRow;
+
+/// Gets a monotonic timestamp for measuring durations.
+/// @return Current time in nanoseconds.
+uint64_t stats_now(void);
+
+/// Sets the opcode the calling thread's subsequent measurements are attributed to.
+/// @param opcode Opcode of the request being served.
+void stats_set_opcode(int opcode);
+
+/// Records a duration for the calling thread's current opcode. Never takes a lock.
+/// @param metric What the duration measures.
+/// @param ns Duration in nanoseconds.
+void stats_record(enum StatsMetric metric, uint64_t ns);
+
+/// Counts a failed request for the calling thread's current opcode.
+void stats_record_error(void);
+
+/// Aggregates the counters of every thread.
+/// @param rows Array to store one row per non-empty (opcode, metric) pair in.
+/// @param max Capacity of rows, STATS_MAX_OPCODES * STAT_NUM_METRICS is always enough.
+/// @return Number of rows stored.
+size_t stats_snapshot(StatsRow* rows, size_t max);
+
+/// Formats a snapshot as CSV lines, without the STATS_CSV_HEADER line.
+/// @param len Pointer to the variable to store the length of the text in.
+/// @return Newly allocated text, NULL on failure.
+/// @warning The returned buffer should be freed by the caller.
+char* stats_csv(size_t* len);
+
+/// Gets the printable name of an opcode or metric.
+const char* stats_opcode_name(int opcode);
+const char* stats_metric_name(int metric);
+
+/// Starts a thread that appends a snapshot to the given file every interval.
+/// @param path File to append to.
+/// @param interval_s Seconds between dumps.
+/// @param binary If set, rows are written as raw StatsRow structures preceded by a timestamp and a count,
+///               otherwise as CSV.
+/// @return 0 if the thread was started, 1 otherwise.
+int stats_start_dump(const char* path, unsigned int interval_s, int binary);
+
+/// Stops the dump thread, writing a last snapshot.
+void stats_stop_dump(void);
+
+#endif  // SERVER_STATS_H
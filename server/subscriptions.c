@@ -0,0 +1,341 @@
+#include "subscriptions.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common/io.h"
+
+static Subscriber* registry = NULL;
+static pthread_rwlock_t registry_rwl = PTHREAD_RWLOCK_INITIALIZER;
+static atomic_int num_subscribers = 0;  // Lets publish skip the registry when nobody listens
+
+static void release_record(ChangeRecord* record) {
+  if (atomic_fetch_sub(&record->refs, 1) == 1) {
+    free(record);
+  }
+}
+
+/// Allocates a record holding its own copy of the seats, with a single reference.
+/// @return The record, NULL if it could not be allocated.
+static ChangeRecord* create_record(int kind, unsigned int event_id, unsigned int version, unsigned int reservation_id,
+                                   size_t num_seats, size_t* xs, size_t* ys) {
+  ChangeRecord* record = malloc(sizeof(ChangeRecord) + 2 * num_seats * sizeof(size_t));
+  if (!record) return NULL;
+  record->kind = kind;
+  record->event_id = event_id;
+  record->version = version;
+  record->reservation_id = reservation_id;
+  record->num_seats = num_seats;
+  record->xs = (size_t*)(record + 1);
+  record->ys = record->xs + num_seats;
+  memcpy(record->xs, xs, num_seats * sizeof(size_t));
+  memcpy(record->ys, ys, num_seats * sizeof(size_t));
+  atomic_init(&record->refs, 1);
+  record->next = NULL;
+  return record;
+}
+
+/// Finds the subscription to an event.
+/// @note The subscriber's mutex must be held.
+static Subscription* find_subscription(Subscriber* subscriber, unsigned int event_id) {
+  for (size_t i = 0; i < subscriber->num_events; i++) {
+    if (subscriber->events[i].event_id == event_id) {
+      return &subscriber->events[i];
+    }
+  }
+  return NULL;
+}
+
+/// Serializes a record into the notification pipe with a single write where possible.
+/// Layout: kind, event id, version, reservation id, num seats, xs[num_seats], ys[num_seats].
+/// Fails if the client leaves the pipe full for SUBSCRIBER_WRITE_TIMEOUT_MS, and is then dropped.
+static int deliver_record(int fd, int kind, unsigned int event_id, unsigned int version, unsigned int reservation_id,
+                          size_t num_seats, const size_t* xs, const size_t* ys) {
+  size_t header = sizeof(int) + 3 * sizeof(unsigned int) + sizeof(size_t);
+  size_t len = header + 2 * num_seats * sizeof(size_t);
+  char* buffer = malloc(len);
+  if (!buffer) return 1;
+
+  char* cursor = buffer;
+  memcpy(cursor, &kind, sizeof(int));
+  cursor += sizeof(int);
+  memcpy(cursor, &event_id, sizeof(unsigned int));
+  cursor += sizeof(unsigned int);
+  memcpy(cursor, &version, sizeof(unsigned int));
+  cursor += sizeof(unsigned int);
+  memcpy(cursor, &reservation_id, sizeof(unsigned int));
+  cursor += sizeof(unsigned int);
+  memcpy(cursor, &num_seats, sizeof(size_t));
+  cursor += sizeof(size_t);
+  if (num_seats > 0) {
+    memcpy(cursor, xs, num_seats * sizeof(size_t));
+    cursor += num_seats * sizeof(size_t);
+    memcpy(cursor, ys, num_seats * sizeof(size_t));
+  }
+
+  int ret = write_all_timeout(fd, buffer, len, SUBSCRIBER_WRITE_TIMEOUT_MS);
+  free(buffer);
+  return ret;
+}
+
+/// Delivers queued records to the notification pipe. Runs until the subscriber is closed.
+static void* subscriber_thread(void* arg) {
+  Subscriber* subscriber = arg;
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  // Blocks until the client opens the read end, or until destroy_subscriber() unblocks it
+  int fd = open(subscriber->path, O_WRONLY);
+  pthread_mutex_lock(&subscriber->mutex);
+  subscriber->fd = fd;
+  pthread_mutex_unlock(&subscriber->mutex);
+  if (fd == -1) {
+    fprintf(stderr, "Failed to open notification pipe %s\n", subscriber->path);
+  } else {
+    // Writes are bounded in time, so a client that stops reading can't hold up destroy_subscriber()
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+
+  while (1) {
+    pthread_mutex_lock(&subscriber->mutex);
+    while (subscriber->size == 0 && subscriber->pending_overflows == 0 && !subscriber->direct &&
+           !subscriber->closing) {
+      pthread_cond_wait(&subscriber->ready, &subscriber->mutex);
+    }
+    if (subscriber->closing) {
+      pthread_mutex_unlock(&subscriber->mutex);
+      break;
+    }
+
+    if (subscriber->direct || subscriber->size > 0) {
+      ChangeRecord* record;
+      if (subscriber->direct) {
+        record = subscriber->direct;
+        subscriber->direct = record->next;
+      } else {
+        record = subscriber->queue[subscriber->front];
+        subscriber->front = (subscriber->front + 1) % SUBSCRIBER_QUEUE_SIZE;
+        subscriber->size--;
+      }
+      pthread_mutex_unlock(&subscriber->mutex);
+
+      if (fd != -1 && deliver_record(fd, record->kind, record->event_id, record->version, record->reservation_id,
+                                     record->num_seats, record->xs, record->ys) != 0) {
+        fprintf(stderr, "Failed to deliver change record to %s\n", subscriber->path);
+        close(fd);
+        fd = -1;
+      }
+      release_record(record);
+      continue;
+    }
+
+    // Queue drained: emit one coalesced record per event that overflowed
+    unsigned int event_id = 0, version = 0;
+    for (size_t i = 0; i < subscriber->num_events; i++) {
+      if (subscriber->events[i].overflowed) {
+        event_id = subscriber->events[i].event_id;
+        version = subscriber->events[i].overflow_version;
+        subscriber->events[i].overflowed = 0;
+        break;
+      }
+    }
+    subscriber->pending_overflows--;
+    pthread_mutex_unlock(&subscriber->mutex);
+
+    if (fd != -1 && deliver_record(fd, NOTIFY_COALESCED, event_id, version, 0, 0, NULL, NULL) != 0) {
+      fprintf(stderr, "Failed to deliver change record to %s\n", subscriber->path);
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  if (fd != -1) close(fd);
+  return NULL;
+}
+
+Subscriber* create_subscriber(const char* notify_path) {
+  Subscriber* subscriber = malloc(sizeof(Subscriber));
+  if (!subscriber) return NULL;
+  subscriber->path = strdup(notify_path);
+  if (!subscriber->path) {
+    free(subscriber);
+    return NULL;
+  }
+  subscriber->fd = -1;
+  subscriber->closing = 0;
+  subscriber->pending_overflows = 0;
+  subscriber->num_events = 0;
+  subscriber->size = 0;
+  subscriber->front = 0;
+  subscriber->rear = -1;
+  subscriber->direct = NULL;
+  subscriber->direct_tail = NULL;
+  pthread_mutex_init(&subscriber->mutex, NULL);
+  pthread_cond_init(&subscriber->ready, NULL);
+
+  if (pthread_create(&subscriber->thread, NULL, subscriber_thread, subscriber) != 0) {
+    pthread_mutex_destroy(&subscriber->mutex);
+    pthread_cond_destroy(&subscriber->ready);
+    free(subscriber->path);
+    free(subscriber);
+    return NULL;
+  }
+
+  pthread_rwlock_wrlock(&registry_rwl);
+  subscriber->next = registry;
+  registry = subscriber;
+  atomic_fetch_add(&num_subscribers, 1);
+  pthread_rwlock_unlock(&registry_rwl);
+  return subscriber;
+}
+
+void destroy_subscriber(Subscriber* subscriber) {
+  if (!subscriber) return;
+
+  pthread_rwlock_wrlock(&registry_rwl);
+  for (Subscriber** current = &registry; *current; current = &(*current)->next) {
+    if (*current == subscriber) {
+      *current = subscriber->next;
+      break;
+    }
+  }
+  atomic_fetch_sub(&num_subscribers, 1);
+  pthread_rwlock_unlock(&registry_rwl);
+
+  pthread_mutex_lock(&subscriber->mutex);
+  subscriber->closing = 1;
+  int opened = subscriber->fd != -1;
+  pthread_cond_signal(&subscriber->ready);
+  pthread_mutex_unlock(&subscriber->mutex);
+
+  // The thread may still be waiting for a reader in open(); give it one so it can exit
+  int unblock_fd = -1;
+  if (!opened) {
+    unblock_fd = open(subscriber->path, O_RDONLY | O_NONBLOCK);
+    if (unblock_fd == -1) pthread_cancel(subscriber->thread);
+  }
+  pthread_join(subscriber->thread, NULL);
+  if (unblock_fd != -1) close(unblock_fd);
+
+  while (subscriber->size > 0) {
+    release_record(subscriber->queue[subscriber->front]);
+    subscriber->front = (subscriber->front + 1) % SUBSCRIBER_QUEUE_SIZE;
+    subscriber->size--;
+  }
+  while (subscriber->direct) {
+    ChangeRecord* record = subscriber->direct;
+    subscriber->direct = record->next;
+    release_record(record);
+  }
+  pthread_mutex_destroy(&subscriber->mutex);
+  pthread_cond_destroy(&subscriber->ready);
+  free(subscriber->path);
+  free(subscriber);
+}
+
+int subscribe_event(Subscriber* subscriber, unsigned int event_id) {
+  if (!subscriber) return 1;
+  pthread_mutex_lock(&subscriber->mutex);
+  if (find_subscription(subscriber, event_id)) {
+    pthread_mutex_unlock(&subscriber->mutex);
+    return 0;
+  }
+  if (subscriber->num_events >= MAX_SUBSCRIBED_EVENTS) {
+    pthread_mutex_unlock(&subscriber->mutex);
+    return 1;
+  }
+  Subscription* subscription = &subscriber->events[subscriber->num_events++];
+  subscription->event_id = event_id;
+  subscription->overflowed = 0;
+  subscription->overflow_version = 0;
+  pthread_mutex_unlock(&subscriber->mutex);
+  return 0;
+}
+
+int unsubscribe_event(Subscriber* subscriber, unsigned int event_id) {
+  if (!subscriber) return 1;
+  pthread_mutex_lock(&subscriber->mutex);
+  Subscription* subscription = find_subscription(subscriber, event_id);
+  if (!subscription) {
+    pthread_mutex_unlock(&subscriber->mutex);
+    return 1;
+  }
+  if (subscription->overflowed) subscriber->pending_overflows--;
+  *subscription = subscriber->events[--subscriber->num_events];
+  pthread_mutex_unlock(&subscriber->mutex);
+  return 0;
+}
+
+/// Queues a change on every subscriber of the event, see publish_reservation().
+static void publish_change(int kind, unsigned int event_id, unsigned int version, unsigned int reservation_id,
+                           size_t num_seats, size_t* xs, size_t* ys) {
+  if (atomic_load(&num_subscribers) == 0) return;
+
+  ChangeRecord* record = NULL;
+  pthread_rwlock_rdlock(&registry_rwl);
+  for (Subscriber* subscriber = registry; subscriber; subscriber = subscriber->next) {
+    pthread_mutex_lock(&subscriber->mutex);
+    Subscription* subscription = find_subscription(subscriber, event_id);
+    if (!subscription) {
+      pthread_mutex_unlock(&subscriber->mutex);
+      continue;
+    }
+
+    if (!record && !subscription->overflowed && subscriber->size < SUBSCRIBER_QUEUE_SIZE) {
+      // Held by the publisher until every queue is visited
+      record = create_record(kind, event_id, version, reservation_id, num_seats, xs, ys);
+    }
+
+    if (record && !subscription->overflowed && subscriber->size < SUBSCRIBER_QUEUE_SIZE) {
+      atomic_fetch_add(&record->refs, 1);
+      subscriber->rear = (subscriber->rear + 1) % SUBSCRIBER_QUEUE_SIZE;
+      subscriber->queue[subscriber->rear] = record;
+      subscriber->size++;
+    } else {
+      // Slow reader (or out of memory): fold the update into a single coalesced record
+      if (!subscription->overflowed) {
+        subscription->overflowed = 1;
+        subscriber->pending_overflows++;
+      }
+      if (version > subscription->overflow_version) subscription->overflow_version = version;
+    }
+    pthread_cond_signal(&subscriber->ready);
+    pthread_mutex_unlock(&subscriber->mutex);
+  }
+  pthread_rwlock_unlock(&registry_rwl);
+
+  if (record) release_record(record);
+}
+
+int notify_subscriber(Subscriber* subscriber, int kind, unsigned int event_id, unsigned int version,
+                      unsigned int reservation_id, size_t num_seats, size_t* xs, size_t* ys) {
+  ChangeRecord* record = create_record(kind, event_id, version, reservation_id, num_seats, xs, ys);
+  if (!record) return 1;
+  pthread_mutex_lock(&subscriber->mutex);
+  if (subscriber->direct) {
+    subscriber->direct_tail->next = record;
+  } else {
+    subscriber->direct = record;
+  }
+  subscriber->direct_tail = record;
+  pthread_cond_signal(&subscriber->ready);
+  pthread_mutex_unlock(&subscriber->mutex);
+  return 0;
+}
+
+void publish_reservation(unsigned int event_id, unsigned int version, unsigned int reservation_id, size_t num_seats,
+                         size_t* xs, size_t* ys) {
+  publish_change(NOTIFY_RESERVED, event_id, version, reservation_id, num_seats, xs, ys);
+}
+
+void publish_release(unsigned int event_id, unsigned int version, unsigned int reservation_id, size_t num_seats,
+                     size_t* xs, size_t* ys) {
+  publish_change(NOTIFY_RELEASED, event_id, version, reservation_id, num_seats, xs, ys);
+}
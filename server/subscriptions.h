@@ -0,0 +1,122 @@
+#ifndef SERVER_SUBSCRIPTIONS_H
+#define SERVER_SUBSCRIPTIONS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define MAX_SUBSCRIBED_EVENTS 16          // Events a single session may be subscribed to
+#define SUBSCRIBER_QUEUE_SIZE 32          // Pending change records per subscriber before coalescing
+#define SUBSCRIBER_WRITE_TIMEOUT_MS 1000  // A client not reading its notification pipe for this long is dropped
+
+// Kinds of records written to a notification pipe
+enum NotifyKind {
+  NOTIFY_RESERVED = 1,    // Seats in the record were reserved with the given reservation id
+  NOTIFY_COALESCED = 2,   // Updates were dropped; the event is at least at the given version
+  NOTIFY_RELEASED = 3,    // Seats in the record were held under the given reservation id and are free again
+  NOTIFY_WAITLISTED = 4,  // A waitlisted request of the session got the seats in the record
+};
+
+// A single change to an event, shared by every subscriber it is queued on
+typedef struct ChangeRecord {
+  int kind;
+  unsigned int event_id;
+  unsigned int version;
+  unsigned int reservation_id;
+  size_t num_seats;
+  size_t* xs;
+  size_t* ys;
+  atomic_int refs;            // Number of queues still holding the record
+  struct ChangeRecord* next;  // Next record sent to this subscriber alone, see notify_subscriber()
+} ChangeRecord;
+
+typedef struct {
+  unsigned int event_id;
+  int overflowed;                 // Set when a record for this event was dropped
+  unsigned int overflow_version;  // Highest version dropped while overflowed
+} Subscription;
+
+typedef struct Subscriber {
+  struct Subscriber* next;  // Next subscriber in the registry
+
+  char* path;  // Notification pipe path
+  int fd;      // Notification pipe, -1 until the client opens it
+  int closing;
+  int pending_overflows;  // Number of subscriptions with overflowed set
+
+  Subscription events[MAX_SUBSCRIBED_EVENTS];
+  size_t num_events;
+
+  ChangeRecord* queue[SUBSCRIBER_QUEUE_SIZE];
+  int size;
+  int front;
+  int rear;
+
+  ChangeRecord* direct;       // Records for this subscriber alone, never dropped nor coalesced
+  ChangeRecord* direct_tail;  // Last record in direct
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t ready;
+} Subscriber;
+
+/// Creates a subscriber that delivers change records to the given notification pipe.
+/// The pipe is opened by a dedicated thread, so this call does not wait for the client.
+/// @param notify_path Path to the notification pipe, created by the client.
+/// @return Pointer to the new subscriber, NULL on failure.
+/// @warning The created structure should be destroyed with destroy_subscriber()
+Subscriber* create_subscriber(const char* notify_path);
+
+/// Stops delivery, unregisters and frees a subscriber. Waits at most SUBSCRIBER_WRITE_TIMEOUT_MS
+/// for a record being written to a client that stopped reading.
+/// @param subscriber Subscriber to destroy, may be NULL.
+void destroy_subscriber(Subscriber* subscriber);
+
+/// Subscribes to changes of an event.
+/// @param subscriber Subscriber to be modified.
+/// @param event_id Event to subscribe to.
+/// @return 0 if the subscription was added (or already existed), 1 otherwise.
+int subscribe_event(Subscriber* subscriber, unsigned int event_id);
+
+/// Unsubscribes from changes of an event.
+/// @param subscriber Subscriber to be modified.
+/// @param event_id Event to unsubscribe from.
+/// @return 0 if the subscription was removed, 1 if it did not exist.
+int unsubscribe_event(Subscriber* subscriber, unsigned int event_id);
+
+/// Queues a reservation on every subscriber of the event. Never waits on a subscriber's pipe:
+/// when a subscriber's queue is full the update is coalesced into a NOTIFY_COALESCED record.
+/// @param event_id Event that changed.
+/// @param version Version of the event after the change.
+/// @param reservation_id Reservation id assigned to the seats.
+/// @param num_seats Number of seats in the change.
+/// @param xs Rows of the changed seats.
+/// @param ys Columns of the changed seats.
+void publish_reservation(unsigned int event_id, unsigned int version, unsigned int reservation_id, size_t num_seats,
+                         size_t* xs, size_t* ys);
+
+/// Queues a change for a single subscriber, whether or not it is subscribed to the event. Unlike
+/// published changes these are never coalesced, so the subscriber always gets the seats.
+/// @param subscriber Subscriber to notify.
+/// @param kind Kind of record, see enum NotifyKind.
+/// @param event_id Event that changed.
+/// @param version Version of the event after the change.
+/// @param reservation_id Reservation id assigned to the seats.
+/// @param num_seats Number of seats in the change.
+/// @param xs Rows of the changed seats.
+/// @param ys Columns of the changed seats.
+/// @return 0 if the record was queued, 1 if it could not be allocated.
+int notify_subscriber(Subscriber* subscriber, int kind, unsigned int event_id, unsigned int version,
+                      unsigned int reservation_id, size_t num_seats, size_t* xs, size_t* ys);
+
+/// Queues the release of seats on every subscriber of the event, like publish_reservation().
+/// @param event_id Event that changed.
+/// @param version Version of the event after the change.
+/// @param reservation_id Reservation id the seats were held under.
+/// @param num_seats Number of seats in the change.
+/// @param xs Rows of the freed seats.
+/// @param ys Columns of the freed seats.
+void publish_release(unsigned int event_id, unsigned int version, unsigned int reservation_id, size_t num_seats,
+                     size_t* xs, size_t* ys);
+
+#endif  // SERVER_SUBSCRIPTIONS_H
@@ -0,0 +1,117 @@
+#include "timerwheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+void timer_list_init(TimerNode* list) {
+  list->prev = list;
+  list->next = list;
+}
+
+static void list_append(TimerNode* list, TimerNode* node) {
+  node->prev = list->prev;
+  node->next = list;
+  list->prev->next = node;
+  list->prev = node;
+}
+
+static void list_unlink(TimerNode* node) {
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  node->prev = node;
+  node->next = node;
+}
+
+/// Puts a timer in the slot it belongs to, relative to the wheel's current tick.
+/// @note Timers expiring on the current tick go into the level 0 slot that is about to be collected,
+///       so this must only be called for them while cascading.
+static void place(TimerWheel* wheel, TimerNode* timer) {
+  uint64_t expires = timer->expires;
+  uint64_t delta = expires - wheel->now;
+  if (delta >= TIMER_WHEEL_SPAN) {
+    // Parked at the end of the span, it is placed again when that slot is cascaded
+    expires = wheel->now + TIMER_WHEEL_SPAN - 1;
+    delta = TIMER_WHEEL_SPAN - 1;
+  }
+
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 && delta >= 1ull << (TIMER_WHEEL_BITS * (level + 1))) {
+    level++;
+  }
+  size_t slot = (size_t)(expires >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+  list_append(&wheel->slots[level][slot], timer);
+}
+
+void timer_wheel_init(TimerWheel* wheel, uint64_t now) {
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    for (size_t slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+      timer_list_init(&wheel->slots[level][slot]);
+    }
+  }
+  wheel->now = now;
+  wheel->count = 0;
+}
+
+void timer_wheel_add(TimerWheel* wheel, TimerNode* timer, uint64_t now) {
+  // Nothing is pending, so no tick up to now has anything to fire or cascade
+  if (wheel->count == 0 && now > wheel->now) wheel->now = now;
+  // The current tick was already collected
+  if (timer->expires <= wheel->now) timer->expires = wheel->now + 1;
+  place(wheel, timer);
+  wheel->count++;
+}
+
+void timer_wheel_cancel(TimerWheel* wheel, TimerNode* timer) {
+  list_unlink(timer);
+  wheel->count--;
+}
+
+/// Moves the timers of a slot one or more levels down, now that the levels below it wrapped around.
+static void cascade(TimerWheel* wheel, int level, size_t slot) {
+  TimerNode pending;
+  timer_list_init(&pending);
+  TimerNode* list = &wheel->slots[level][slot];
+  while (list->next != list) {
+    TimerNode* timer = list->next;
+    list_unlink(timer);
+    list_append(&pending, timer);
+  }
+  while (pending.next != &pending) {
+    TimerNode* timer = pending.next;
+    list_unlink(timer);
+    place(wheel, timer);
+  }
+}
+
+void timer_wheel_advance(TimerWheel* wheel, uint64_t now, TimerNode* expired) {
+  while (wheel->now < now) {
+    if (wheel->count == 0) {
+      // Nothing to fire or cascade, skip straight to the present
+      wheel->now = now;
+      break;
+    }
+
+    wheel->now++;
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+      // Level n - 1 wrapped around iff the tick is a multiple of its whole span
+      if ((wheel->now & ((1ull << (TIMER_WHEEL_BITS * level)) - 1)) != 0) break;
+      cascade(wheel, level, (size_t)(wheel->now >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK);
+    }
+
+    TimerNode* list = &wheel->slots[0][wheel->now & SLOT_MASK];
+    while (list->next != list) {
+      TimerNode* timer = list->next;
+      list_unlink(timer);
+      list_append(expired, timer);
+      wheel->count--;
+    }
+  }
+}
+
+uint64_t timer_wheel_next(const TimerWheel* wheel) {
+  if (wheel->count == 0) return UINT64_MAX;
+  for (uint64_t tick = wheel->now + 1;; tick++) {
+    const TimerNode* list = &wheel->slots[0][tick & SLOT_MASK];
+    // At a multiple of the level 0 span, higher levels may have timers to bring down
+    if (list->next != list || (tick & SLOT_MASK) == 0) return tick;
+  }
+}
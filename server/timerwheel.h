@@ -0,0 +1,63 @@
+#ifndef SERVER_TIMER_WHEEL_H
+#define SERVER_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_BITS 6    // Slots per level, as a power of two
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4  // Covers 2^24 ticks ahead
+#define TIMER_WHEEL_SPAN (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+// A pending timer. Meant to be embedded in the structure it times, which is found back from the node.
+typedef struct TimerNode {
+  struct TimerNode* prev;
+  struct TimerNode* next;
+  uint64_t expires;  // Tick the timer fires at
+} TimerNode;
+
+// Hierarchical timer wheel: level 0 has one slot per tick, and every slot of level n covers a whole
+// turn of level n - 1. Timers are moved one level down as the lower level wraps around, so adding,
+// cancelling and firing a timer are all O(1), no matter how many are pending.
+// Not thread safe: every call must be made under the same lock.
+typedef struct {
+  TimerNode slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];  // Sentinels of circular lists
+  uint64_t now;                                            // Last tick processed
+  size_t count;                                            // Pending timers
+} TimerWheel;
+
+/// Initializes an empty wheel.
+/// @param wheel Wheel to initialize.
+/// @param now Current tick.
+void timer_wheel_init(TimerWheel* wheel, uint64_t now);
+
+/// Adds a timer. Timers already due fire on the next tick. Timers further than TIMER_WHEEL_SPAN
+/// ticks ahead are parked at the end of the span and still fire on time, after one more cascade.
+/// @param wheel Wheel to add the timer to.
+/// @param timer Timer with expires set, must not be pending.
+/// @param now Current tick. An empty wheel skips straight to it, so the next advance does not have
+///            to step through every tick it sat idle for.
+void timer_wheel_add(TimerWheel* wheel, TimerNode* timer, uint64_t now);
+
+/// Cancels a pending timer.
+/// @param wheel Wheel the timer was added to.
+/// @param timer Timer to cancel.
+void timer_wheel_cancel(TimerWheel* wheel, TimerNode* timer);
+
+/// Moves the wheel forward, collecting every timer that expired on the way.
+/// @param wheel Wheel to advance.
+/// @param now Current tick.
+/// @param expired Sentinel of the list the expired timers are appended to. Must be initialized with
+///                timer_list_init(), and the timers in it are no longer pending.
+void timer_wheel_advance(TimerWheel* wheel, uint64_t now, TimerNode* expired);
+
+/// Gets the next tick the wheel must be advanced to. Only level 0 is looked at, so this is either
+/// the tick of the earliest timer or the next time a higher level has to be cascaded.
+/// @param wheel Wheel to inspect.
+/// @return The tick, or UINT64_MAX if no timer is pending.
+uint64_t timer_wheel_next(const TimerWheel* wheel);
+
+/// Initializes a list sentinel, see timer_wheel_advance().
+void timer_list_init(TimerNode* list);
+
+#endif  // SERVER_TIMER_WHEEL_H
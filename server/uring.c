@@ -0,0 +1,246 @@
+#define _GNU_SOURCE  // syscall, MAP_POPULATE
+#include "uring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// liburing is not a dependency, the rings are set up and driven with the raw system calls
+typedef struct {
+  int fd;
+  void* rings;  // Submission and completion rings, in one mapping (IORING_FEAT_SINGLE_MMAP)
+  size_t rings_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+  _Atomic unsigned int* sq_tail;
+  unsigned int* sq_mask;
+  unsigned int* sq_array;
+  _Atomic unsigned int* cq_head;
+  _Atomic unsigned int* cq_tail;
+  unsigned int* cq_mask;
+  struct io_uring_cqe* cqes;
+} Ring;
+
+static int enabled = 0;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local Ring* ring = NULL;
+static _Thread_local int ring_failed = 0;  // Not retried on every call once setting up a ring failed
+
+static void destroy_ring(void* arg) {
+  Ring* owned = arg;
+  munmap(owned->sqes, owned->sqes_size);
+  munmap(owned->rings, owned->rings_size);
+  close(owned->fd);
+  free(owned);
+}
+
+static void create_ring_key(void) { pthread_key_create(&ring_key, destroy_ring); }
+
+static Ring* create_ring(void) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = (int)syscall(SYS_io_uring_setup, URING_ENTRIES, &params);
+  if (fd == -1) return NULL;
+  // Older kernels map each ring on its own and can't read at the file position of a pipe
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_RW_CUR_POS)) {
+    close(fd);
+    errno = ENOSYS;
+    return NULL;
+  }
+
+  Ring* created = calloc(1, sizeof(Ring));
+  if (!created) {
+    close(fd);
+    return NULL;
+  }
+  created->fd = fd;
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  created->rings_size = sq_size > cq_size ? sq_size : cq_size;
+  created->rings = mmap(NULL, created->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                        IORING_OFF_SQ_RING);
+  created->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  created->sqes = mmap(NULL, created->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                       IORING_OFF_SQES);
+  if (created->rings == MAP_FAILED || created->sqes == MAP_FAILED) {
+    if (created->rings != MAP_FAILED) munmap(created->rings, created->rings_size);
+    if (created->sqes != MAP_FAILED) munmap(created->sqes, created->sqes_size);
+    close(fd);
+    free(created);
+    return NULL;
+  }
+
+  char* rings = created->rings;
+  created->sq_tail = (_Atomic unsigned int*)(rings + params.sq_off.tail);
+  created->sq_mask = (unsigned int*)(rings + params.sq_off.ring_mask);
+  created->sq_array = (unsigned int*)(rings + params.sq_off.array);
+  created->cq_head = (_Atomic unsigned int*)(rings + params.cq_off.head);
+  created->cq_tail = (_Atomic unsigned int*)(rings + params.cq_off.tail);
+  created->cq_mask = (unsigned int*)(rings + params.cq_off.ring_mask);
+  created->cqes = (struct io_uring_cqe*)(rings + params.cq_off.cqes);
+  return created;
+}
+
+/// Gets the calling thread's ring, setting it up on first use.
+/// @return The ring, NULL with errno set to ENOSYS if the thread can't have one.
+static Ring* get_ring(void) {
+  if (ring) return ring;
+  if (!ring_failed) {
+    ring = create_ring();
+    ring_failed = ring == NULL;
+  }
+  if (!ring) {
+    errno = ENOSYS;
+    return NULL;
+  }
+  pthread_once(&ring_key_once, create_ring_key);
+  pthread_setspecific(ring_key, ring);
+  return ring;
+}
+
+int uring_enable(void) {
+  Ring* probe = create_ring();
+  if (!probe) return 1;
+  destroy_ring(probe);
+  enabled = 1;
+  return 0;
+}
+
+int uring_enabled(void) { return enabled; }
+
+/// Gets the next free submission entry, cleared. Only ever called for fewer than URING_ENTRIES
+/// entries between submits, and every submit waits for all of them, so the ring is never full.
+static struct io_uring_sqe* next_sqe(Ring* own, unsigned int* queued) {
+  unsigned int tail = atomic_load_explicit(own->sq_tail, memory_order_relaxed) + *queued;
+  unsigned int index = tail & *own->sq_mask;
+  struct io_uring_sqe* sqe = &own->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  own->sq_array[index] = index;
+  (*queued)++;
+  return sqe;
+}
+
+/// Tears the calling thread's ring down for good, so the thread falls back to the blocking calls.
+/// Closing the ring cancels whatever it still has in flight.
+static void drop_ring(void) {
+  int error = errno;
+  pthread_setspecific(ring_key, NULL);
+  destroy_ring(ring);
+  ring = NULL;
+  ring_failed = 1;
+  errno = error;
+}
+
+/// Submits the queued entries and waits for as many completions, storing each result by user_data.
+/// @return 0 once every entry completed, 1 if the kernel refused them with errno set. The ring is
+///         then dropped, see drop_ring(), and errno is ENOSYS if none of the entries had been taken.
+static int submit_and_wait(Ring* own, unsigned int queued, int* results) {
+  atomic_fetch_add_explicit(own->sq_tail, queued, memory_order_release);
+  unsigned int to_submit = queued, completed = 0;
+  while (completed < queued) {
+    int ret = (int)syscall(SYS_io_uring_enter, own->fd, to_submit, queued - completed, IORING_ENTER_GETEVENTS,
+                           NULL, 0);
+    if (ret == -1 && errno != EINTR) {
+      // Entries may still be queued or in flight, and their completions would be taken for the
+      // results of the thread's next call. When the kernel took none of them nothing was read or
+      // written, so the caller can still do it with the blocking calls
+      if (to_submit == queued) errno = ENOSYS;
+      drop_ring();
+      return 1;
+    }
+    if (ret > 0) to_submit -= (unsigned int)ret < to_submit ? (unsigned int)ret : to_submit;
+
+    unsigned int head = atomic_load_explicit(own->cq_head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(own->cq_tail, memory_order_acquire);
+    for (; head != tail; head++) {
+      struct io_uring_cqe* cqe = &own->cqes[head & *own->cq_mask];
+      results[cqe->user_data] = cqe->res;
+      completed++;
+    }
+    atomic_store_explicit(own->cq_head, head, memory_order_release);
+  }
+  return 0;
+}
+
+ssize_t uring_read(int fd, void* buffer, size_t len, int timeout_ms) {
+  Ring* own = get_ring();
+  if (!own) return -1;
+
+  unsigned int queued = 0;
+  struct io_uring_sqe* sqe = next_sqe(own, &queued);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buffer;
+  sqe->len = len > UINT32_MAX ? UINT32_MAX : (uint32_t)len;
+  sqe->off = (uint64_t)-1;  // Current position, pipes have no offset
+  sqe->user_data = 0;
+
+  struct __kernel_timespec timeout = {timeout_ms / 1000, (long long)(timeout_ms % 1000) * 1000000};
+  if (timeout_ms > 0) {
+    sqe->flags = IOSQE_IO_LINK;
+    sqe = next_sqe(own, &queued);
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->addr = (uint64_t)(uintptr_t)&timeout;
+    sqe->len = 1;
+    sqe->user_data = 1;
+  }
+
+  int results[2];
+  if (submit_and_wait(own, queued, results) != 0) return -1;
+  if (results[0] == -ECANCELED && timeout_ms > 0) {
+    errno = ETIMEDOUT;  // Cancelled by the linked timeout
+    return -1;
+  }
+  if (results[0] < 0) {
+    errno = -results[0];
+    return -1;
+  }
+  return results[0];
+}
+
+int uring_write_all(int fd, struct iovec* iov, int iovcnt) {
+  Ring* own = get_ring();
+  if (!own) return 1;
+
+  for (;;) {
+    // One write per buffer, linked so they land in order. A short write fails the rest of the
+    // chain, which is submitted again from where it stopped
+    unsigned int queued = 0;
+    struct io_uring_sqe* sqe = NULL;
+    for (int i = 0; i < iovcnt; i++) {
+      if (iov[i].iov_len == 0) continue;
+      if (sqe) sqe->flags = IOSQE_IO_LINK;
+      sqe = next_sqe(own, &queued);
+      sqe->opcode = IORING_OP_WRITE;
+      sqe->fd = fd;
+      sqe->addr = (uint64_t)(uintptr_t)iov[i].iov_base;
+      sqe->len = iov[i].iov_len > UINT32_MAX ? UINT32_MAX : (uint32_t)iov[i].iov_len;
+      sqe->off = (uint64_t)-1;
+      sqe->user_data = (unsigned int)i;
+    }
+    if (queued == 0) return 0;
+
+    int results[URING_ENTRIES];
+    for (int i = 0; i < iovcnt; i++) results[i] = 0;
+    if (submit_and_wait(own, queued, results) != 0) return 1;
+    for (int i = 0; i < iovcnt; i++) {
+      if (results[i] < 0 && results[i] != -ECANCELED && results[i] != -EINTR) {
+        errno = -results[i];
+        return 1;
+      }
+      if (results[i] > 0) {
+        iov[i].iov_base = (char*)iov[i].iov_base + results[i];
+        iov[i].iov_len -= (size_t)results[i];
+      }
+    }
+  }
+}
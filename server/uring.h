@@ -0,0 +1,37 @@
+#ifndef SERVER_URING_H
+#define SERVER_URING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define URING_ENTRIES 8  // Submission slots per ring, every call waits for its own entries
+
+/// Switches session I/O to io_uring, if the kernel offers it. Each thread that does I/O gets its
+/// own ring the first time, released when it exits or once the kernel refuses its entries. Without
+/// it, the blocking calls are used.
+/// @return 0 if io_uring is used from now on, 1 if it is unavailable.
+int uring_enable(void);
+
+/// Checks whether session I/O goes through io_uring, see uring_enable().
+int uring_enabled(void);
+
+/// Reads what is available from a file descriptor, waiting for at least one byte. The read and its
+/// timeout are submitted as linked entries, with a single system call.
+/// @param fd File descriptor to read from.
+/// @param buffer Buffer to store the bytes in.
+/// @param len Size of the buffer.
+/// @param timeout_ms Time to wait for the first byte, 0 or less waits forever.
+/// @return Number of bytes read, 0 on end of file, -1 on error with errno set (ETIMEDOUT on timeout,
+///         ENOSYS if this thread has no ring and nothing was read).
+ssize_t uring_read(int fd, void* buffer, size_t len, int timeout_ms);
+
+/// Writes every byte of the given buffers, in order, with one system call unless the writes are short.
+/// @param fd File descriptor to write to.
+/// @param iov Buffers to write, modified to track progress.
+/// @param iovcnt Number of buffers, at most URING_ENTRIES.
+/// @return 0 if all bytes were written, 1 otherwise with errno set (ENOSYS if this thread has no ring
+///         and nothing was written).
+int uring_write_all(int fd, struct iovec* iov, int iovcnt);
+
+#endif  // SERVER_URING_H